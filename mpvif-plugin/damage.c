@@ -0,0 +1,152 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <sys/param.h>
+
+#include "damage.h"
+
+void damage_clear(struct damage *damage)
+{
+    damage->count = 0;
+}
+
+bool damage_is_empty(const struct damage *damage)
+{
+    return damage->count == 0;
+}
+
+static bool rect_contains(const struct damage_rect *a,
+        const struct damage_rect *b)
+{
+    return b->x >= a->x && b->y >= a->y &&
+        b->x + b->width <= a->x + a->width &&
+        b->y + b->height <= a->y + a->height;
+}
+
+void damage_add(struct damage *damage, int32_t x, int32_t y, int32_t width,
+        int32_t height)
+{
+    if (width <= 0 || height <= 0)
+        return;
+
+    struct damage_rect rect = { x, y, width, height };
+
+    for (int i = 0; i < damage->count; i++) {
+        if (rect_contains(&damage->rects[i], &rect))
+            return;
+    }
+
+    /* drop rectangles which the new one covers */
+    int count = 0;
+    for (int i = 0; i < damage->count; i++) {
+        if (!rect_contains(&rect, &damage->rects[i]))
+            damage->rects[count++] = damage->rects[i];
+    }
+    damage->count = count;
+
+    if (damage->count < DAMAGE_MAX_RECTS) {
+        damage->rects[damage->count++] = rect;
+        return;
+    }
+
+    int32_t x1 = rect.x, y1 = rect.y;
+    int32_t x2 = rect.x + rect.width, y2 = rect.y + rect.height;
+    for (int i = 0; i < damage->count; i++) {
+        const struct damage_rect *r = &damage->rects[i];
+        x1 = MIN(x1, r->x);
+        y1 = MIN(y1, r->y);
+        x2 = MAX(x2, r->x + r->width);
+        y2 = MAX(y2, r->y + r->height);
+    }
+    damage->rects[0] = (struct damage_rect){ x1, y1, x2 - x1, y2 - y1 };
+    damage->count = 1;
+}
+
+void damage_add_damage(struct damage *damage, const struct damage *other)
+{
+    for (int i = 0; i < other->count; i++) {
+        const struct damage_rect *r = &other->rects[i];
+        damage_add(damage, r->x, r->y, r->width, r->height);
+    }
+}
+
+static int compare_int32(const void *a, const void *b)
+{
+    int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_rect_y(const void *a, const void *b)
+{
+    const struct damage_rect *x = a, *y = b;
+    return (x->y > y->y) - (x->y < y->y);
+}
+
+uint64_t damage_area(const struct damage *damage)
+{
+    if (damage->count == 1)
+        return (uint64_t)damage->rects[0].width * damage->rects[0].height;
+
+    /* sweep over the columns between rectangle edges and merge the rows
+     * covered in each. there are only a few rectangles. */
+    int32_t edges[DAMAGE_MAX_RECTS * 2];
+    int edge_count = 0;
+    for (int i = 0; i < damage->count; i++) {
+        edges[edge_count++] = damage->rects[i].x;
+        edges[edge_count++] = damage->rects[i].x + damage->rects[i].width;
+    }
+    qsort(edges, edge_count, sizeof(edges[0]), compare_int32);
+
+    struct damage_rect sorted[DAMAGE_MAX_RECTS];
+    for (int i = 0; i < damage->count; i++)
+        sorted[i] = damage->rects[i];
+    qsort(sorted, damage->count, sizeof(sorted[0]), compare_rect_y);
+
+    uint64_t area = 0;
+    for (int e = 0; e + 1 < edge_count; e++) {
+        int32_t left = edges[e], right = edges[e + 1];
+        if (left == right)
+            continue;
+
+        uint64_t covered = 0;
+        int32_t top = 0, bottom = 0;
+        bool open = false;
+        for (int i = 0; i < damage->count; i++) {
+            const struct damage_rect *r = &sorted[i];
+            if (r->x > left || r->x + r->width < right)
+                continue;
+            if (open && r->y <= bottom) {
+                bottom = MAX(bottom, r->y + r->height);
+                continue;
+            }
+            if (open)
+                covered += bottom - top;
+            top = r->y;
+            bottom = r->y + r->height;
+            open = true;
+        }
+        if (open)
+            covered += bottom - top;
+
+        area += covered * (uint64_t)(right - left);
+    }
+
+    return area;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPVIF_DAMAGE_H
+#define MPVIF_DAMAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * A small damage region made of rectangles, for the damage events and requests
+ * of ext-image-copy-capture. When more rectangles are added than fit, the
+ * region degrades to its bounding box, which is still correct, just larger.
+ */
+
+#define DAMAGE_MAX_RECTS 16
+
+struct damage_rect {
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+};
+
+struct damage {
+    int count;
+    struct damage_rect rects[DAMAGE_MAX_RECTS];
+};
+
+void damage_clear(struct damage *damage);
+bool damage_is_empty(const struct damage *damage);
+void damage_add(struct damage *damage, int32_t x, int32_t y, int32_t width,
+        int32_t height);
+void damage_add_damage(struct damage *damage, const struct damage *other);
+/* the area covered by the region, overlaps are only counted once */
+uint64_t damage_area(const struct damage *damage);
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "frame-ring.h"
+
+struct frame_ring_slot {
+    char *data;
+    uint64_t timestamp;
+    /* readers which are in the middle of this frame */
+    int readers;
+    bool writing;
+};
+
+struct frame_ring {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int refs;
+    void *data;
+    size_t size;
+    size_t frame_size;
+    struct frame_ring_slot slots[FRAME_RING_SLOTS];
+    /* the newest published slot, or -1 */
+    int latest;
+    /* incremented for every published frame */
+    uint64_t seq;
+    bool closed;
+};
+
+struct frame_ring *frame_ring_create(void *data, size_t size,
+        size_t frame_size)
+{
+    struct frame_ring *ring = calloc(1, sizeof(*ring));
+    if (!ring)
+        return NULL;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    /* frame timestamps are on the monotonic clock */
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    ring->refs = 1;
+    ring->data = data;
+    ring->size = size;
+    ring->frame_size = frame_size;
+    ring->latest = -1;
+
+    for (int i = 0; i < FRAME_RING_SLOTS; i++)
+        ring->slots[i].data = (char *)data + i * frame_size;
+
+    return ring;
+}
+
+void frame_ring_ref(struct frame_ring *ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    ring->refs++;
+    pthread_mutex_unlock(&ring->lock);
+}
+
+void frame_ring_unref(struct frame_ring *ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    int refs = --ring->refs;
+    pthread_mutex_unlock(&ring->lock);
+
+    if (refs > 0)
+        return;
+
+    munmap(ring->data, ring->size);
+    pthread_cond_destroy(&ring->cond);
+    pthread_mutex_destroy(&ring->lock);
+    free(ring);
+}
+
+size_t frame_ring_frame_size(struct frame_ring *ring)
+{
+    return ring->frame_size;
+}
+
+void *frame_ring_slot_data(struct frame_ring *ring, int slot)
+{
+    return ring->slots[slot].data;
+}
+
+int frame_ring_begin_write(struct frame_ring *ring)
+{
+    int slot = -1;
+
+    pthread_mutex_lock(&ring->lock);
+    for (int i = 0; i < FRAME_RING_SLOTS; i++) {
+        struct frame_ring_slot *s = &ring->slots[i];
+        if (i != ring->latest && !s->readers && !s->writing) {
+            s->writing = true;
+            slot = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    return slot;
+}
+
+void frame_ring_abort_write(struct frame_ring *ring, int slot)
+{
+    pthread_mutex_lock(&ring->lock);
+    ring->slots[slot].writing = false;
+    pthread_mutex_unlock(&ring->lock);
+}
+
+void frame_ring_publish(struct frame_ring *ring, int slot, uint64_t timestamp)
+{
+    pthread_mutex_lock(&ring->lock);
+    ring->slots[slot].writing = false;
+    ring->slots[slot].timestamp = timestamp;
+    ring->latest = slot;
+    ring->seq++;
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+bool frame_ring_has_frame(struct frame_ring *ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    bool ret = ring->latest != -1;
+    pthread_mutex_unlock(&ring->lock);
+    return ret;
+}
+
+void frame_ring_close(struct frame_ring *ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    ring->closed = true;
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+void frame_ring_reader_init(struct frame_ring_reader *reader,
+        struct frame_ring *ring)
+{
+    frame_ring_ref(ring);
+    *reader = (struct frame_ring_reader){
+        .ring = ring,
+        .slot = -1,
+    };
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec * UINT64_C(1000000) + tp.tv_nsec / 1000;
+}
+
+static bool is_late(struct frame_ring *ring, uint64_t max_latency)
+{
+    uint64_t timestamp = ring->slots[ring->latest].timestamp;
+    return max_latency && timestamp && now_us() > timestamp + max_latency;
+}
+
+/* waits until a frame newer than the last one read is published, returns
+ * false on close or cancellation. called with the lock held. */
+static bool wait_for_frame(struct frame_ring_reader *reader,
+        const struct timespec *deadline)
+{
+    struct frame_ring *ring = reader->ring;
+
+    while (!ring->closed && !reader->cancelled &&
+            (ring->latest == -1 || ring->seq == reader->seq)) {
+        if (!deadline)
+            pthread_cond_wait(&ring->cond, &ring->lock);
+        else if (pthread_cond_timedwait(&ring->cond, &ring->lock,
+                    deadline) == ETIMEDOUT)
+            break;
+    }
+
+    return !ring->closed && !reader->cancelled;
+}
+
+const void *frame_ring_acquire(struct frame_ring_reader *reader,
+        uint64_t max_latency)
+{
+    struct frame_ring *ring = reader->ring;
+
+    pthread_mutex_lock(&ring->lock);
+    if (!wait_for_frame(reader, NULL)) {
+        pthread_mutex_unlock(&ring->lock);
+        return NULL;
+    }
+
+    /* a frame which is late already is only passed on if no newer one shows
+     * up within the latency bound, so that a still screen isn't lost */
+    if (is_late(ring, max_latency)) {
+        uint64_t seq = ring->seq;
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += max_latency / 1000000;
+        deadline.tv_nsec += max_latency % 1000000 * 1000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        reader->seq = seq;
+        if (!wait_for_frame(reader, &deadline)) {
+            pthread_mutex_unlock(&ring->lock);
+            return NULL;
+        }
+        if (ring->seq != seq)
+            reader->late_frames++;
+    }
+
+    /* frames published since the last read are skipped */
+    reader->slot = ring->latest;
+    reader->seq = ring->seq;
+    reader->timestamp = ring->slots[reader->slot].timestamp;
+    ring->slots[reader->slot].readers++;
+    pthread_mutex_unlock(&ring->lock);
+
+    /* the slot can't be written to while we're counted as a reader */
+    return ring->slots[reader->slot].data;
+}
+
+void frame_ring_release(struct frame_ring_reader *reader)
+{
+    struct frame_ring *ring = reader->ring;
+
+    pthread_mutex_lock(&ring->lock);
+    ring->slots[reader->slot].readers--;
+    pthread_mutex_unlock(&ring->lock);
+    reader->slot = -1;
+}
+
+void frame_ring_cancel(struct frame_ring_reader *reader)
+{
+    struct frame_ring *ring = reader->ring;
+
+    pthread_mutex_lock(&ring->lock);
+    reader->cancelled = true;
+    pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+void frame_ring_reader_finish(struct frame_ring_reader *reader)
+{
+    struct frame_ring *ring = reader->ring;
+
+    if (reader->slot != -1)
+        frame_ring_release(reader);
+
+    frame_ring_unref(ring);
+    reader->ring = NULL;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPVIF_FRAME_RING_H
+#define MPVIF_FRAME_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A latest-frame-only ring shared between the capture (the plugin thread) and
+ * the mpvif:// stream (mpv's demuxer thread).
+ *
+ * The capture writes into a free slot and publishes it, which replaces the
+ * previously published frame. A reader always acquires the newest published
+ * frame and keeps that slot until it releases it, so frames which were never
+ * read are simply overwritten instead of queued. With one reader, there is
+ * always a free slot for the capture.
+ *
+ * The slots are a single mapping which the ring takes ownership of. It is
+ * unmapped when the last reference is dropped, so a reader may keep using a
+ * ring after the capture has closed it (e.g. because the size changed).
+ */
+
+#define FRAME_RING_SLOTS 3
+
+struct frame_ring;
+
+struct frame_ring_reader {
+    struct frame_ring *ring;
+    int slot;
+    uint64_t seq;
+    /* of the acquired frame */
+    uint64_t timestamp;
+    /* late frames which were replaced by a newer one */
+    uint64_t late_frames;
+    bool cancelled;
+};
+
+/* data is a mapping of size bytes holding FRAME_RING_SLOTS frames of
+ * frame_size bytes each */
+struct frame_ring *frame_ring_create(void *data, size_t size,
+        size_t frame_size);
+void frame_ring_ref(struct frame_ring *ring);
+void frame_ring_unref(struct frame_ring *ring);
+
+size_t frame_ring_frame_size(struct frame_ring *ring);
+void *frame_ring_slot_data(struct frame_ring *ring, int slot);
+
+/* writer side */
+int frame_ring_begin_write(struct frame_ring *ring);
+void frame_ring_abort_write(struct frame_ring *ring, int slot);
+/* timestamp is in microseconds on the monotonic clock, 0 if unknown */
+void frame_ring_publish(struct frame_ring *ring, int slot, uint64_t timestamp);
+bool frame_ring_has_frame(struct frame_ring *ring);
+/* readers get EOF once they finish the frame they are on */
+void frame_ring_close(struct frame_ring *ring);
+
+/* reader side, takes a reference on the ring */
+void frame_ring_reader_init(struct frame_ring_reader *reader,
+        struct frame_ring *ring);
+/* blocks until a frame newer than the last one read is published and keeps
+ * it from being overwritten until it is released. returns NULL on EOF or
+ * cancellation. A frame older than max_latency microseconds (0 for no limit)
+ * is skipped if a newer one is published within max_latency. */
+const void *frame_ring_acquire(struct frame_ring_reader *reader,
+        uint64_t max_latency);
+void frame_ring_release(struct frame_ring_reader *reader);
+/* may be called from any thread to make a blocked read return */
+void frame_ring_cancel(struct frame_ring_reader *reader);
+void frame_ring_reader_finish(struct frame_ring_reader *reader);
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "histogram.h"
+
+static int bucket_of(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS)
+        return value;
+
+    /* the position of the highest bit selects the power of two, the bits
+     * below it the linear bucket within */
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << HISTOGRAM_SUB_BITS) +
+        (int)((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+void histogram_reset(struct histogram *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void histogram_add(struct histogram *h, uint64_t value)
+{
+    h->buckets[bucket_of(value)]++;
+    h->count++;
+    h->sum += value;
+    if (value > h->max)
+        h->max = value;
+}
+
+uint64_t histogram_bucket_limit(int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return bucket;
+
+    int shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+    uint64_t sub = bucket & (HISTOGRAM_SUB_BUCKETS - 1);
+    uint64_t lower = (HISTOGRAM_SUB_BUCKETS + sub) << shift;
+    return lower + ((UINT64_C(1) << shift) - 1);
+}
+
+uint64_t histogram_percentile(const struct histogram *h, double fraction)
+{
+    if (!h->count)
+        return 0;
+
+    /* the rank of the value, counting from 1 */
+    uint64_t rank = fraction * h->count + 0.5;
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t limit = histogram_bucket_limit(i);
+            return limit < h->max ? limit : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+uint64_t histogram_count_at_most(const struct histogram *h, uint64_t limit)
+{
+    uint64_t count = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (histogram_bucket_limit(i) > limit)
+            break;
+        count += h->buckets[i];
+    }
+    return count;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPVIF_HISTOGRAM_H
+#define MPVIF_HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * A histogram with logarithmic buckets in the style of HdrHistogram: every
+ * power of two is split into HISTOGRAM_SUB_BUCKETS linear buckets, so any
+ * value is recorded with a relative error of at most 1/HISTOGRAM_SUB_BUCKETS
+ * and adding one is a few instructions without any allocation.
+ */
+
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+struct histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+void histogram_reset(struct histogram *h);
+void histogram_add(struct histogram *h, uint64_t value);
+/* the largest value a bucket holds */
+uint64_t histogram_bucket_limit(int bucket);
+/* the value which the given fraction (0 to 1) of the recorded values doesn't
+ * exceed, rounded up to its bucket, 0 if nothing was recorded */
+uint64_t histogram_percentile(const struct histogram *h, double fraction);
+/* the values in the buckets which hold nothing above limit, so a bucket
+ * which straddles it isn't counted */
+uint64_t histogram_count_at_most(const struct histogram *h, uint64_t limit);
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+struct journal {
+    int fd;
+    size_t size;
+    struct journal_header *header;
+    struct journal_record *records;
+    uint64_t mask;
+    /* index of the next record */
+    uint64_t next;
+};
+
+struct journal *journal_create(uint64_t capacity)
+{
+    uint64_t size = 1;
+    while (size < capacity)
+        size *= 2;
+    capacity = size;
+
+    struct journal *journal = calloc(1, sizeof(*journal));
+    if (!journal)
+        return NULL;
+    journal->mask = capacity - 1;
+
+    journal->size = sizeof(struct journal_header) +
+        capacity * sizeof(struct journal_record);
+    journal->fd = memfd_create("mpvif-journal",
+            MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (journal->fd == -1)
+        goto err_free;
+
+    if (ftruncate(journal->fd, journal->size) == -1)
+        goto err_close;
+
+    /* readers may map it for as long as they like */
+    fcntl(journal->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+    journal->header = mmap(NULL, journal->size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, journal->fd, 0);
+    if (journal->header == MAP_FAILED)
+        goto err_close;
+    journal->records = (struct journal_record *)(journal->header + 1);
+
+    memcpy(journal->header->magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    journal->header->header_size = sizeof(struct journal_header);
+    journal->header->record_size = sizeof(struct journal_record);
+    journal->header->capacity = capacity;
+
+    return journal;
+
+err_close:
+    close(journal->fd);
+err_free:
+    free(journal);
+    return NULL;
+}
+
+void journal_destroy(struct journal *journal)
+{
+    munmap(journal->header, journal->size);
+    close(journal->fd);
+    free(journal);
+}
+
+int journal_fd(struct journal *journal)
+{
+    return journal->fd;
+}
+
+void journal_add(struct journal *journal, enum journal_type type,
+        int64_t timestamp, const int32_t *args, int count)
+{
+    uint64_t index = journal->next++;
+    struct journal_record *r =
+        &journal->records[index & journal->mask];
+
+    atomic_store_explicit(&r->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    r->timestamp = timestamp;
+    r->type = type;
+    memcpy(r->args, args, count * sizeof(args[0]));
+    memset(r->args + count, 0, (11 - count) * sizeof(args[0]));
+    atomic_store_explicit(&r->seq, index + 1, memory_order_release);
+}
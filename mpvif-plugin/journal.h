@@ -0,0 +1,93 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPVIF_JOURNAL_H
+#define MPVIF_JOURNAL_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * A ring of fixed-size records in a memfd, for tools which want to see what
+ * the plugin forwarded without asking it. Only the plugin thread writes, and
+ * a record is one cache line, so adding one writes only that line, without
+ * any syscall or lock. An input event is a single record.
+ *
+ * The file starts with a struct journal_header (one cache line), which isn't
+ * written after creation, followed by capacity records, a power of two.
+ * Record i is at i % capacity, and its seq is i + 1 once it's complete. A
+ * reader maps the file read-only and finds the newest record by the highest
+ * seq (read with acquire semantics), then follows the ring by waiting for
+ * the seq of the next slot. A record is valid if its seq is still the same
+ * after copying it, since the writer may be lapping the reader.
+ */
+
+#define JOURNAL_MAGIC "MPVIFJ1"
+
+enum journal_type {
+    /* mpv's mouse-pos which wasn't forwarded (e.g. no video size yet): x, y,
+     * hover */
+    JOURNAL_MOUSE_POS = 1,
+    /* mpv's mouse-pos and the motion_absolute request it turned into:
+     * x, y, hover, then time (ms), x, y, x_extent, y_extent of the request */
+    JOURNAL_MOTION,
+    /* an application pointer warp: output-local x, y, then the mouse-pos x,
+     * y it was relayed as */
+    JOURNAL_WARP,
+    /* a setting which changed: enum journal_toggle, value */
+    JOURNAL_TOGGLE,
+};
+
+enum journal_toggle {
+    JOURNAL_TOGGLE_INPUT_FORWARDING = 1,
+    JOURNAL_TOGGLE_FORCE_GRAB_CURSOR,
+};
+
+struct journal_header {
+    char magic[8];
+    uint32_t header_size;
+    uint32_t record_size;
+    uint64_t capacity;
+    char reserved[40];
+};
+
+struct journal_record {
+    /* the record's index plus one, 0 while it's being written */
+    _Atomic uint64_t seq;
+    /* ns, CLOCK_MONOTONIC */
+    int64_t timestamp;
+    uint32_t type;
+    int32_t args[11];
+};
+
+_Static_assert(sizeof(struct journal_header) == 64, "one cache line");
+_Static_assert(sizeof(struct journal_record) == 64, "one cache line");
+
+struct journal;
+
+/* capacity is in records, rounded up to a power of two */
+struct journal *journal_create(uint64_t capacity);
+void journal_destroy(struct journal *journal);
+int journal_fd(struct journal *journal);
+
+/* from the plugin thread only, count is at most 11 */
+void journal_add(struct journal *journal, enum journal_type type,
+        int64_t timestamp, const int32_t *args, int count);
+
+#endif
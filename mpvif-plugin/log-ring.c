@@ -0,0 +1,124 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log-ring.h"
+
+struct log_slot {
+    /* the position the slot may be written at, plus one once the message at
+     * that position is written */
+    _Atomic uint64_t seq;
+    int level;
+    char text[LOG_RING_MESSAGE_SIZE];
+};
+
+struct log_ring {
+    _Atomic uint64_t head;
+    /* only touched by the reader */
+    uint64_t tail;
+    _Atomic uint64_t dropped;
+    size_t mask;
+    struct log_slot *slots;
+};
+
+struct log_ring *log_ring_create(size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity)
+        size *= 2;
+
+    struct log_ring *ring = calloc(1, sizeof(*ring));
+    if (!ring)
+        return NULL;
+
+    ring->slots = calloc(size, sizeof(*ring->slots));
+    if (!ring->slots) {
+        free(ring);
+        return NULL;
+    }
+    ring->mask = size - 1;
+
+    for (size_t i = 0; i < size; i++)
+        atomic_init(&ring->slots[i].seq, i);
+
+    return ring;
+}
+
+void log_ring_destroy(struct log_ring *ring)
+{
+    free(ring->slots);
+    free(ring);
+}
+
+bool log_ring_push(struct log_ring *ring, int level, const char *fmt,
+        va_list ap)
+{
+    uint64_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct log_slot *s;
+
+    while (true) {
+        s = &ring->slots[pos & ring->mask];
+        uint64_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos,
+                        pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (seq < pos) {
+            /* the reader hasn't consumed this slot's previous message */
+            atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+            return false;
+        } else {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+
+    s->level = level;
+    vsnprintf(s->text, sizeof(s->text), fmt, ap);
+    atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+
+    return true;
+}
+
+bool log_ring_pop(struct log_ring *ring, int *level, char *text)
+{
+    struct log_slot *s = &ring->slots[ring->tail & ring->mask];
+
+    if (atomic_load_explicit(&s->seq, memory_order_acquire) != ring->tail + 1)
+        return false;
+
+    *level = s->level;
+    memcpy(text, s->text, strlen(s->text) + 1);
+
+    /* free for the message one lap later */
+    atomic_store_explicit(&s->seq, ring->tail + ring->mask + 1,
+            memory_order_release);
+    ring->tail++;
+
+    return true;
+}
+
+uint64_t log_ring_take_dropped(struct log_ring *ring)
+{
+    return atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+}
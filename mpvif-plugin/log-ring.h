@@ -0,0 +1,55 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPVIF_LOG_RING_H
+#define MPVIF_LOG_RING_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A bounded queue of formatted log messages, so that logging never waits on
+ * the mpv core. Any thread may push, only one thread may pop.
+ *
+ * Pushing claims a slot with a compare-and-swap and formats straight into
+ * it. A message which doesn't fit because the reader has fallen behind is
+ * dropped and counted instead of overwriting older ones.
+ */
+
+#define LOG_RING_MESSAGE_SIZE 1024
+
+struct log_ring;
+
+/* capacity is rounded up to a power of two */
+struct log_ring *log_ring_create(size_t capacity);
+void log_ring_destroy(struct log_ring *ring);
+
+/* returns false if the ring is full */
+bool log_ring_push(struct log_ring *ring, int level, const char *fmt,
+        va_list ap);
+/* copies the oldest message into text, which must hold LOG_RING_MESSAGE_SIZE
+ * bytes. returns false if there is none, or if the oldest one is still being
+ * written. */
+bool log_ring_pop(struct log_ring *ring, int *level, char *text);
+/* the messages which were dropped since the last call */
+uint64_t log_ring_take_dropped(struct log_ring *ring);
+
+#endif
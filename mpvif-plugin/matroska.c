@@ -0,0 +1,182 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "matroska.h"
+
+#define EBML_HEADER 0x1a45dfa3
+#define EBML_VERSION 0x4286
+#define EBML_READ_VERSION 0x42f7
+#define EBML_MAX_ID_LENGTH 0x42f2
+#define EBML_MAX_SIZE_LENGTH 0x42f3
+#define DOC_TYPE 0x4282
+#define DOC_TYPE_VERSION 0x4287
+#define DOC_TYPE_READ_VERSION 0x4285
+#define SEGMENT 0x18538067
+#define INFO 0x1549a966
+#define TIMESTAMP_SCALE 0x2ad7b1
+#define MUXING_APP 0x4d80
+#define WRITING_APP 0x5741
+#define TRACKS 0x1654ae6b
+#define TRACK_ENTRY 0xae
+#define TRACK_NUMBER 0xd7
+#define TRACK_UID 0x73c5
+#define TRACK_TYPE 0x83
+#define FLAG_LACING 0x9c
+#define CODEC_ID 0x86
+#define VIDEO 0xe0
+#define PIXEL_WIDTH 0xb0
+#define PIXEL_HEIGHT 0xba
+#define COLOUR_SPACE 0x2eb524
+#define COLOUR 0x55b0
+#define MATRIX_COEFFICIENTS 0x55b1
+#define RANGE 0x55b9
+#define CLUSTER 0x1f43b675
+#define TIMESTAMP 0xe7
+#define SIMPLE_BLOCK 0xa3
+
+/* an 8-byte size with all value bits set means unknown */
+#define UNKNOWN_SIZE UINT64_MAX
+
+static uint8_t *put_id(uint8_t *p, uint32_t id)
+{
+    /* the length of an ID is part of its value */
+    int len = id > 0xffffff ? 4 : id > 0xffff ? 3 : id > 0xff ? 2 : 1;
+    for (int i = len - 1; i >= 0; i--)
+        *p++ = id >> (i * 8);
+    return p;
+}
+
+/* always 8 bytes, so sizes of master elements can be filled in afterwards */
+static uint8_t *put_size(uint8_t *p, uint64_t size)
+{
+    *p++ = 0x01;
+    for (int i = 6; i >= 0; i--)
+        *p++ = size == UNKNOWN_SIZE ? 0xff : size >> (i * 8);
+    return p;
+}
+
+static uint8_t *put_uint(uint8_t *p, uint32_t id, uint64_t value)
+{
+    int len = 1;
+    while (len < 8 && value >> (len * 8))
+        len++;
+
+    p = put_id(p, id);
+    *p++ = 0x80 | len;
+    for (int i = len - 1; i >= 0; i--)
+        *p++ = value >> (i * 8);
+    return p;
+}
+
+static uint8_t *put_binary(uint8_t *p, uint32_t id, const void *data,
+        size_t size)
+{
+    p = put_id(p, id);
+    p = put_size(p, size);
+    memcpy(p, data, size);
+    return p + size;
+}
+
+static uint8_t *put_string(uint8_t *p, uint32_t id, const char *string)
+{
+    return put_binary(p, id, string, strlen(string));
+}
+
+static uint8_t *begin_master(uint8_t *p, uint32_t id, uint8_t **size_pos)
+{
+    p = put_id(p, id);
+    *size_pos = p;
+    return p + 8;
+}
+
+static void end_master(uint8_t *p, uint8_t *size_pos)
+{
+    put_size(size_pos, p - (size_pos + 8));
+}
+
+size_t matroska_write_header(void *buf, const struct matroska_video *video)
+{
+    uint8_t *p = buf, *size_pos, *track_size, *video_size, *colour_size;
+
+    p = begin_master(p, EBML_HEADER, &size_pos);
+    p = put_uint(p, EBML_VERSION, 1);
+    p = put_uint(p, EBML_READ_VERSION, 1);
+    p = put_uint(p, EBML_MAX_ID_LENGTH, 4);
+    p = put_uint(p, EBML_MAX_SIZE_LENGTH, 8);
+    p = put_string(p, DOC_TYPE, "matroska");
+    p = put_uint(p, DOC_TYPE_VERSION, 4);
+    p = put_uint(p, DOC_TYPE_READ_VERSION, 2);
+    end_master(p, size_pos);
+
+    p = put_id(p, SEGMENT);
+    p = put_size(p, UNKNOWN_SIZE);
+
+    p = begin_master(p, INFO, &size_pos);
+    p = put_uint(p, TIMESTAMP_SCALE, 1000);
+    p = put_string(p, MUXING_APP, "mpvif-plugin");
+    p = put_string(p, WRITING_APP, "mpvif-plugin");
+    end_master(p, size_pos);
+
+    p = begin_master(p, TRACKS, &size_pos);
+    p = begin_master(p, TRACK_ENTRY, &track_size);
+    p = put_uint(p, TRACK_NUMBER, 1);
+    p = put_uint(p, TRACK_UID, 1);
+    p = put_uint(p, TRACK_TYPE, 1);
+    p = put_uint(p, FLAG_LACING, 0);
+    p = put_string(p, CODEC_ID, "V_UNCOMPRESSED");
+    p = begin_master(p, VIDEO, &video_size);
+    p = put_uint(p, PIXEL_WIDTH, video->width);
+    p = put_uint(p, PIXEL_HEIGHT, video->height);
+    p = put_binary(p, COLOUR_SPACE, video->fourcc, 4);
+    if (video->matrix) {
+        p = begin_master(p, COLOUR, &colour_size);
+        p = put_uint(p, MATRIX_COEFFICIENTS, video->matrix);
+        /* broadcast range */
+        p = put_uint(p, RANGE, 1);
+        end_master(p, colour_size);
+    }
+    end_master(p, video_size);
+    end_master(p, track_size);
+    end_master(p, size_pos);
+
+    return p - (uint8_t *)buf;
+}
+
+size_t matroska_write_block_header(void *buf, uint64_t timestamp,
+        size_t frame_size)
+{
+    uint8_t *p = buf, *size_pos;
+
+    /* the block timestamp is a 16-bit offset from the cluster's, a cluster
+     * per frame avoids dealing with it */
+    p = begin_master(p, CLUSTER, &size_pos);
+    p = put_uint(p, TIMESTAMP, timestamp);
+    p = put_id(p, SIMPLE_BLOCK);
+    p = put_size(p, 4 + frame_size);
+    /* track number 1 as a 1-byte vint, offset 0, keyframe */
+    *p++ = 0x81;
+    *p++ = 0;
+    *p++ = 0;
+    *p++ = 0x80;
+    put_size(size_pos, p - (size_pos + 8) + frame_size);
+
+    return p - (uint8_t *)buf;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPVIF_MATROSKA_H
+#define MPVIF_MATROSKA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Just enough of a Matroska writer to send raw video frames with timestamps
+ * to mpv as a live stream: a header with one V_UNCOMPRESSED track, then a
+ * cluster with a single SimpleBlock per frame. The segment has an unknown
+ * size and there are no cues, like any live recording.
+ */
+
+struct matroska_video {
+    int32_t width;
+    int32_t height;
+    /* the raw pixel format, as a libavcodec FourCC */
+    char fourcc[4];
+    /* ISO/IEC 23091-4 matrix coefficients of limited range YUV, 0 for RGB */
+    int matrix;
+};
+
+#define MATROSKA_HEADER_MAX 256
+#define MATROSKA_BLOCK_HEADER_MAX 48
+
+/* timestamps are in microseconds */
+size_t matroska_write_header(void *buf, const struct matroska_video *video);
+/* the frame data follows the block header */
+size_t matroska_write_block_header(void *buf, uint64_t timestamp,
+        size_t frame_size);
+
+#endif
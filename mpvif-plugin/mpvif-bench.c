@@ -0,0 +1,400 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmarks and consistency checks for the CPU kernels of the capture path.
+ * Every SIMD implementation is compared against the scalar reference before
+ * its throughput is measured.
+ *
+ * The YUV conversion is also checked against a floating point version of the
+ * formula for every 24-bit colour, and its throughput is measured with the
+ * thread pool the plugin uses.
+ *
+ * usage: mpvif-bench [hash|yuv] [-s WIDTHxHEIGHT] [-t SECONDS]
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "thread-pool.h"
+#include "tile-hash.h"
+#include "yuv.h"
+
+static int frame_width = 1920;
+static int frame_height = 1080;
+static double bench_seconds = 1.0;
+
+static double now(void)
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec + tp.tv_nsec / 1e9;
+}
+
+static uint64_t rng_state = 0x853c49e6748fea9b;
+
+static uint32_t rng(void)
+{
+    /* xorshift64* */
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 0x2545f4914f6cdd1d) >> 32;
+}
+
+static uint32_t *random_frame(int width, int height)
+{
+    uint32_t *frame = malloc((size_t)width * height * 4);
+    if (!frame) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < (size_t)width * height; i++)
+        frame[i] = rng();
+    return frame;
+}
+
+static bool check_hash(enum tile_hash_impl impl, tile_hash_fn fn)
+{
+    tile_hash_fn ref = tile_hash_get(TILE_HASH_SCALAR);
+    int width = 301, height = 77;
+    uint32_t *frame = random_frame(width, height);
+    bool ok = true;
+
+    for (int i = 0; i < 2000 && ok; i++) {
+        int w = 1 + rng() % width, h = 1 + rng() % height;
+        int x = rng() % (width - w + 1), y = rng() % (height - h + 1);
+        const uint32_t *start = frame + y * width + x;
+        if (fn(start, width * 4, w, h) != ref(start, width * 4, w, h)) {
+            fprintf(stderr, "%s: hash of %dx%d at %d,%d differs from scalar\n",
+                    tile_hash_impl_name(impl), w, h, x, y);
+            ok = false;
+        }
+    }
+
+    /* a single changed pixel, and two swapped blocks, must change the hash */
+    uint64_t before = fn(frame, width * 4, 64, 64);
+    frame[5 * width + 7] ^= 1;
+    if (fn(frame, width * 4, 64, 64) == before) {
+        fprintf(stderr, "%s: flipped bit not detected\n",
+                tile_hash_impl_name(impl));
+        ok = false;
+    }
+    frame[5 * width + 7] ^= 1;
+    uint32_t block[4];
+    memcpy(block, frame, 16);
+    memcpy(frame, frame + 4, 16);
+    memcpy(frame + 4, block, 16);
+    if (fn(frame, width * 4, 64, 64) == before) {
+        fprintf(stderr, "%s: swapped blocks not detected\n",
+                tile_hash_impl_name(impl));
+        ok = false;
+    }
+
+    free(frame);
+    return ok;
+}
+
+static int bench_hash(void)
+{
+    uint32_t *frame = random_frame(frame_width, frame_height);
+    size_t stride = frame_width * 4;
+    double frame_bytes = (double)frame_width * frame_height * 4;
+    int ret = 0;
+
+    printf("tile hash, %dx%d frame in %dx%d tiles\n", frame_width,
+            frame_height, TILE_SIZE, TILE_SIZE);
+
+    for (int impl = 0; impl < TILE_HASH_IMPL_COUNT; impl++) {
+        tile_hash_fn fn = tile_hash_get(impl);
+        if (!fn) {
+            printf("  %-8s unsupported\n", tile_hash_impl_name(impl));
+            continue;
+        }
+
+        if (!check_hash(impl, fn)) {
+            ret = 1;
+            continue;
+        }
+
+        uint64_t digest = 0;
+        int frames = 0;
+        double start = now(), elapsed;
+        do {
+            digest = 0;
+            for (int y = 0; y < frame_height; y += TILE_SIZE) {
+                for (int x = 0; x < frame_width; x += TILE_SIZE) {
+                    digest ^= fn((char *)frame + y * stride + x * 4, stride,
+                            MIN(TILE_SIZE, frame_width - x),
+                            MIN(TILE_SIZE, frame_height - y));
+                }
+            }
+            frames++;
+            elapsed = now() - start;
+        } while (elapsed < bench_seconds);
+
+        /* the digest is the same for every implementation */
+        printf("  %-8s %8.2f ms/frame %8.2f GB/s (%016llx)\n",
+                tile_hash_impl_name(impl), elapsed * 1000 / frames,
+                frame_bytes * frames / elapsed / 1e9,
+                (unsigned long long)digest);
+    }
+
+    free(frame);
+    return ret;
+}
+
+static bool check_yuv(enum yuv_impl impl, yuv_row_fn fn, int depth)
+{
+    yuv_row_fn ref = yuv_row_get(YUV_SCALAR);
+    struct yuv_coeffs c;
+    yuv_coeffs_init(&c, YUV_BT709, depth);
+    int width = 301;
+    uint32_t *row = random_frame(width, 1);
+    size_t size = yuv_frame_size(width, 1, depth);
+    char *out = malloc(size), *expected = malloc(size);
+    bool ok = out && expected;
+
+    /* every width up to a few vectors, to cover all tails */
+    for (int w = 1; w <= width && ok; w++) {
+        size_t plane = size / 3 / width * w;
+        memset(out, 0, size);
+        memset(expected, 0, size);
+        fn(&c, row, out, out + plane, out + 2 * plane, w);
+        ref(&c, row, expected, expected + plane, expected + 2 * plane, w);
+        if (memcmp(out, expected, plane * 3) != 0) {
+            fprintf(stderr, "%s: %d-bit row of %d pixels differs from scalar\n",
+                    yuv_impl_name(impl), depth, w);
+            ok = false;
+        }
+    }
+
+    free(expected);
+    free(out);
+    free(row);
+    return ok;
+}
+
+/* the exact result of the conversion, in output code values */
+static void reference_yuv(enum yuv_matrix matrix, int depth, uint32_t p,
+        double out[3])
+{
+    double kr = matrix == YUV_BT709 ? 0.2126 : 0.299;
+    double kb = matrix == YUV_BT709 ? 0.0722 : 0.114;
+    double b = (p & 0xff) / 255.0, g = (p >> 8 & 0xff) / 255.0,
+           r = (p >> 16 & 0xff) / 255.0;
+    double y = kr * r + (1 - kr - kb) * g + kb * b;
+    int shift = depth - 8;
+
+    out[0] = (16 << shift) + (219 << shift) * y;
+    out[1] = (128 << shift) + (224 << shift) * (b - y) / (2 * (1 - kb));
+    out[2] = (128 << shift) + (224 << shift) * (r - y) / (2 * (1 - kr));
+}
+
+/* every 24-bit colour, compared to the floating point formula */
+static void yuv_accuracy(enum yuv_matrix matrix, int depth)
+{
+    yuv_row_fn fn = yuv_row_get(YUV_SCALAR);
+    struct yuv_coeffs c;
+    yuv_coeffs_init(&c, matrix, depth);
+    int width = 4096;
+    uint32_t row[4096];
+    uint16_t out[3][4096];
+    double max_error = 0, total_error = 0;
+    int64_t off_by_one = 0;
+
+    for (uint32_t base = 0; base < 1 << 24; base += width) {
+        for (int i = 0; i < width; i++)
+            row[i] = base + i;
+
+        if (depth > 8) {
+            fn(&c, row, out[0], out[1], out[2], width);
+        } else {
+            /* widened to compare in the same loop */
+            uint8_t out8[3][4096];
+            fn(&c, row, out8[0], out8[1], out8[2], width);
+            for (int p = 0; p < 3; p++)
+                for (int i = 0; i < width; i++)
+                    out[p][i] = out8[p][i];
+        }
+
+        for (int i = 0; i < width; i++) {
+            double ref[3];
+            reference_yuv(matrix, depth, row[i], ref);
+            for (int p = 0; p < 3; p++) {
+                double error = out[p][i] - ref[p];
+                error = error < 0 ? -error : error;
+                max_error = MAX(max_error, error);
+                total_error += error;
+                /* further off than rounding to nearest */
+                if (error > 0.5 + 1e-9)
+                    off_by_one++;
+            }
+        }
+    }
+
+    printf("  %-6s %2d-bit max error %.3f, mean %.3f, %lld/%d samples not "
+            "rounded to nearest\n", matrix == YUV_BT709 ? "bt.709" : "bt.601",
+            depth, max_error, total_error / (3.0 * (1 << 24)),
+            (long long)off_by_one, 3 << 24);
+}
+
+struct yuv_job {
+    yuv_row_fn fn;
+    struct yuv_coeffs *c;
+    const uint32_t *src;
+    char *dst;
+    int jobs;
+};
+
+static void yuv_job_run(void *data, int job)
+{
+    struct yuv_job *j = data;
+    yuv_convert_rows(j->fn, j->c, j->src, frame_width * 4, j->dst,
+            frame_width, frame_height, frame_height * job / j->jobs,
+            frame_height * (job + 1) / j->jobs);
+}
+
+static double bench_yuv_frames(struct thread_pool *pool, struct yuv_job *job)
+{
+    int frames = 0;
+    double start = now(), elapsed;
+    do {
+        thread_pool_run(pool, yuv_job_run, job, job->jobs);
+        frames++;
+        elapsed = now() - start;
+    } while (elapsed < bench_seconds);
+    return elapsed / frames;
+}
+
+static int bench_yuv(void)
+{
+    uint32_t *frame = random_frame(frame_width, frame_height);
+    char *dst = malloc(yuv_frame_size(frame_width, frame_height, 10));
+    double frame_bytes = (double)frame_width * frame_height * 4;
+    int ret = 0;
+
+    if (!dst) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    printf("yuv444 accuracy against the exact formula\n");
+    for (int depth = 8; depth <= 10; depth += 2) {
+        yuv_accuracy(YUV_BT601, depth);
+        yuv_accuracy(YUV_BT709, depth);
+    }
+
+    printf("yuv444 conversion, %dx%d frame\n", frame_width, frame_height);
+
+    struct thread_pool *single = thread_pool_create(1);
+    for (int impl = 0; impl < YUV_IMPL_COUNT; impl++) {
+        yuv_row_fn fn = yuv_row_get(impl);
+        if (!fn) {
+            printf("  %-8s unsupported\n", yuv_impl_name(impl));
+            continue;
+        }
+
+        for (int depth = 8; depth <= 10; depth += 2) {
+            if (!check_yuv(impl, fn, depth)) {
+                ret = 1;
+                continue;
+            }
+
+            struct yuv_coeffs c;
+            yuv_coeffs_init(&c, yuv_guess_matrix(frame_width, frame_height),
+                    depth);
+            struct yuv_job job = { fn, &c, frame, dst, 1 };
+            double t = bench_yuv_frames(single, &job);
+            printf("  %-8s %2d-bit %8.2f ms/frame %8.2f GB/s\n",
+                    yuv_impl_name(impl), depth, t * 1000,
+                    frame_bytes / t / 1e9);
+        }
+    }
+    thread_pool_destroy(single);
+
+    /* the plugin splits frames into a few bands per thread */
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int threads = 2; threads <= MIN(cpus, 8); threads *= 2) {
+        struct thread_pool *pool = thread_pool_create(threads);
+        struct yuv_coeffs c;
+        yuv_coeffs_init(&c, yuv_guess_matrix(frame_width, frame_height), 10);
+        struct yuv_job job = { yuv_row_best(), &c, frame, dst, threads * 4 };
+        double t = bench_yuv_frames(pool, &job);
+        printf("  best     10-bit %8.2f ms/frame %8.2f GB/s, %d threads\n",
+                t * 1000, frame_bytes / t / 1e9,
+                thread_pool_threads(pool));
+        thread_pool_destroy(pool);
+    }
+
+    free(dst);
+    free(frame);
+    return ret;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [hash|yuv] [-s WIDTHxHEIGHT] [-t SECONDS]\n",
+            argv0);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:t:h")) != -1) {
+        switch (opt) {
+            case 's':
+                if (sscanf(optarg, "%dx%d", &frame_width,
+                            &frame_height) != 2 ||
+                        frame_width <= 0 || frame_height <= 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 't':
+                bench_seconds = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    const char *what = optind < argc ? argv[optind] : NULL;
+    int ret = 0;
+
+    if (!what || strcmp(what, "hash") == 0)
+        ret |= bench_hash();
+    if (!what || strcmp(what, "yuv") == 0)
+        ret |= bench_yuv();
+    if (what && strcmp(what, "hash") != 0 && strcmp(what, "yuv") != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    return ret;
+}
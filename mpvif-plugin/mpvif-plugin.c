@@ -18,26 +18,55 @@
  */
 
 #define _GNU_SOURCE
+#include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 
 #include <mpv/client.h>
+#include <mpv/stream_cb.h>
 
 #include <wayland-client.h>
 #include <wayland-util.h>
 
 #include "ext-data-control-client-protocol.h"
+#include "ext-image-capture-source-client-protocol.h"
+#include "ext-image-copy-capture-client-protocol.h"
 #include "foreign-toplevel-management-client-protocol.h"
+#include "output-management-client-protocol.h"
+#include "pointer-constraints-client-protocol.h"
+#include "pointer-warp-client-protocol.h"
 #include "virtual-pointer-client-protocol.h"
 
+#include "damage.h"
+#include "frame-ring.h"
+#include "histogram.h"
+#include "journal.h"
+#include "log-ring.h"
+#include "matroska.h"
+#include "shader-cache.h"
+#include "thread-pool.h"
+#include "tile-hash.h"
+#include "trace.h"
+#include "yuv.h"
+
 #define I3IPC_IMPLEMENTATION
 #include "i3ipc.h"
 
@@ -78,15 +107,46 @@ struct wayland_output {
 struct wayland_seat {
     struct wl_seat *obj;
     uint32_t global_id;
+    uint32_t capabilities;
     struct wl_list link;
 };
 
+/*
+ * A string buffer which is reused for every update, since some applications
+ * (e.g. games with an FPS counter in the title) change their title many times
+ * a second. str is NULL until the first update.
+ */
+struct toplevel_string {
+    char *str;
+    size_t size;
+};
+
+/*
+ * Events for a handle are routed to it through the listener data pointer, so
+ * the list is only walked on teardown.
+ */
 struct wayland_toplevel_handle {
     struct zwlr_foreign_toplevel_handle_v1 *obj;
-    char *title;
-    char *app_id;
+    struct toplevel_string title;
+    struct toplevel_string app_id;
     bool visible_on_remote_output;
     bool fullscreen;
+    /* something which affects the media title changed since the last done */
+    bool dirty;
+    /* lite mode: the title was dropped while off the remote output, and is
+     * picked up again on the next title event once it's back */
+    bool title_dropped;
+    struct wl_list link;
+};
+
+/*
+ * A deadline handled by the main loop. The poll timeout is the time until the
+ * nearest armed timer.
+ */
+struct timer {
+    int64_t deadline;
+    void (*callback)(void);
+    bool armed;
     struct wl_list link;
 };
 
@@ -99,8 +159,136 @@ struct wayland_data_control_source {
 struct mouse_pos_values {
     int64_t x;
     int64_t y;
+    bool hover;
+};
+
+/*
+ * Remote cursor images, keyed by a hash of their content. Applications tend
+ * to cycle between a handful of shapes, so a shape which was seen before is
+ * looked up instead of being copied out of the capture buffer again, and the
+ * overlay isn't re-added when neither the shape nor the position changed.
+ */
+struct cursor_image {
+    uint64_t hash;
+    int32_t width;
+    int32_t height;
+    uint32_t *data;
+    /* overlay-add commands which mpv hasn't read the data of yet */
+    int pending_commands;
+    struct wl_list link;
+};
+
+/*
+ * Heads and modes of wlr-output-management. Only the head of the remote output
+ * is ever changed, but a configuration has to mention every head.
+ */
+struct output_head_mode {
+    struct zwlr_output_mode_v1 *obj;
+    struct output_head *head;
+    int32_t width;
+    int32_t height;
+    /* mHz, 0 if not fixed */
+    int32_t refresh;
+    struct wl_list link;
+};
+
+struct output_head {
+    struct zwlr_output_head_v1 *obj;
+    char *name;
+    bool enabled;
+    struct output_head_mode *current_mode;
+    struct wl_list modes;
+    struct wl_list link;
+};
+
+struct app_profile {
+    char *app_id;
+    char *profile;
+    /* the remote output mode from mpvif-output-mode in the profile, 0 for
+     * keeping the current value */
+    int32_t width;
+    int32_t height;
+    int32_t refresh;
+    /* the profile sets glsl-shaders, so shader chains aren't picked */
+    bool sets_shaders;
+    struct wl_list link;
 };
 
+#define CURSOR_IMAGE_CACHE_SIZE 32
+#define CURSOR_OVERLAY_ID "63"
+
+static struct cursor_capture {
+    struct wl_pointer *pointer;
+    struct ext_image_capture_source_v1 *source;
+    struct ext_image_copy_capture_cursor_session_v1 *cursor_session;
+    struct ext_image_copy_capture_session_v1 *session;
+    struct ext_image_copy_capture_frame_v1 *frame;
+    struct wl_buffer *buffer;
+    void *buffer_data;
+    size_t buffer_size;
+    int32_t buffer_width;
+    int32_t buffer_height;
+    /* latest constraints sent by the compositor */
+    int32_t width;
+    int32_t height;
+    bool shm_format_ok;
+    bool pending_shm_format_ok;
+    bool entered;
+    int32_t hotspot_x;
+    int32_t hotspot_y;
+    int32_t pending_hotspot_x;
+    int32_t pending_hotspot_y;
+    struct cursor_image *image;
+} cursor;
+
+/*
+ * Capture of the remote output for the mpvif:// stream. The compositor copies
+ * frames straight into the shm buffers backing the slots of the frame ring,
+ * which the stream reads from on mpv's demuxer thread.
+ *
+ * The slots keep their contents between captures, so the compositor only has
+ * to update what changed since a slot was last captured: the damage of the
+ * frames which went into the other slots in the meantime (slot_damage, sent
+ * as buffer damage) and the damage of the new frame.
+ *
+ * Compositors often damage regions without changing them (a blinking cursor
+ * redrawn in the same state, a client committing the same contents), so the
+ * damaged tiles are hashed and a frame which hashes the same as the latest
+ * published one isn't passed on to mpv either.
+ */
+static struct output_capture {
+    struct ext_image_capture_source_v1 *source;
+    struct ext_image_copy_capture_session_v1 *session;
+    struct ext_image_copy_capture_frame_v1 *frame;
+    int frame_slot;
+    struct frame_ring *ring;
+    struct wl_buffer *buffers[FRAME_RING_SLOTS];
+    struct damage slot_damage[FRAME_RING_SLOTS];
+    /* buffer damage sent with the pending frame, and its frame damage */
+    struct damage buffer_damage;
+    struct damage frame_damage;
+    /* presentation time of the pending frame in microseconds, 0 if the
+     * compositor didn't send one */
+    uint64_t frame_time;
+    int32_t buffer_width;
+    int32_t buffer_height;
+    uint32_t buffer_format;
+    /* latest constraints sent by the compositor */
+    int32_t width;
+    int32_t height;
+    bool xrgb_ok;
+    bool argb_ok;
+    bool pending_xrgb_ok;
+    bool pending_argb_ok;
+    /* TILE_SIZE tile hashes of the latest published frame, and of the frame
+     * being checked */
+    uint64_t *tile_hashes;
+    uint64_t *new_tile_hashes;
+    int32_t tiles_x;
+    int32_t tiles_y;
+    bool tile_hashes_valid;
+} capture;
+
 static struct osd_dimensions_values {
     int64_t ml;
     int64_t mr;
@@ -113,6 +301,11 @@ static struct osd_dimensions_values {
 static struct video_params_values {
     int64_t w;
     int64_t h;
+    /* the part of the video which is shown, 0 if not reported */
+    int64_t crop_x;
+    int64_t crop_y;
+    int64_t crop_w;
+    int64_t crop_h;
 } video_v;
 
 static struct wayland_toplevel_handle *current_eligible_toplevel;
@@ -127,6 +320,8 @@ static bool dc_offer_is_our_own;
 static struct wl_list wayland_output_list;
 static struct wl_list wayland_seat_list;
 static struct wl_list wayland_toplevel_handle_list;
+static struct wl_list cursor_image_list;
+static int cursor_image_count;
 
 static struct wl_display *display;
 static struct wl_registry *registry;
@@ -135,15 +330,89 @@ static struct zwlr_virtual_pointer_manager_v1 *virtual_pointer_manager;
 static struct zwlr_virtual_pointer_v1 *virtual_pointer;
 
 static struct zwlr_foreign_toplevel_manager_v1 *toplevel_manager;
+static bool toplevel_lite_enabled;
+
+static struct mpvif_pointer_warp_manager_v1 *pointer_warp_manager;
+static struct mpvif_pointer_warp_v1 *pointer_warp;
+
+static struct mpvif_pointer_constraints_manager_v1 *pointer_constraints_manager;
+static struct mpvif_pointer_constraints_v1 *pointer_constraints;
 
 static struct ext_data_control_manager_v1 *data_control_manager;
 static struct ext_data_control_device_v1 *data_control_device;
 
+static struct wl_shm *shm;
+static struct ext_output_image_capture_source_manager_v1 *output_capture_source_manager;
+static struct ext_image_copy_capture_manager_v1 *copy_capture_manager;
+
 static struct wayland_output *remote_output;
 static struct wayland_seat *remote_seat;
 
 static int wakeup_pipe[2] = {-1, -1};
 
+/*
+ * State shared with the mpvif:// stream callbacks, which run on mpv's demuxer
+ * thread. stream_ring is the ring of the current capture session (the plugin
+ * holds the reference), NULL while the buffer constraints aren't known yet.
+ */
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_cond = PTHREAD_COND_INITIALIZER;
+static struct frame_ring *stream_ring;
+static int32_t stream_width;
+static int32_t stream_height;
+static const char *stream_format;
+static int stream_readers;
+static int stream_wakeup_fd = -1;
+/* mpv keeps the protocol registered after the plugin thread has returned and
+ * hmpv is gone, so stream_open fails from then on. stream_open_calls are the
+ * ones which may still use hmpv, which the plugin thread waits for. */
+static bool stream_shutdown;
+static int stream_open_calls;
+/* set by the stream when a reader opens or closes */
+static atomic_bool stream_readers_changed;
+/* late frames the stream skipped, for the capture stats */
+static _Atomic uint64_t stream_late_frames;
+/* the bit depth of YUV444 frames, 0 for passing on the captured XRGB8888.
+ * These are set before the stream is registered. */
+static int stream_yuv_depth;
+static int stream_threads;
+/* frames are sent in Matroska with their presentation times instead of as
+ * rawvideo */
+static bool stream_timestamps;
+/* in microseconds, 0 for no limit */
+static uint64_t stream_max_latency;
+
+/* an open mpvif:// stream */
+struct stream {
+    struct frame_ring_reader reader;
+    /* Matroska header and block header, sent before the frame data */
+    bool matroska;
+    struct matroska_video video;
+    char prefix[MATROSKA_HEADER_MAX + MATROSKA_BLOCK_HEADER_MAX];
+    size_t prefix_size;
+    size_t prefix_offset;
+    bool header_sent;
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+    /* the frame being read, either the acquired ring slot or yuv_frame */
+    const char *payload;
+    size_t payload_size;
+    size_t payload_offset;
+    /* the converted frame, NULL without conversion */
+    char *yuv_frame;
+    struct yuv_coeffs coeffs;
+    yuv_row_fn yuv_row;
+    struct thread_pool *pool;
+    /* the captured frame being converted, split into jobs bands of rows */
+    const void *src;
+    int32_t width;
+    int32_t height;
+    int jobs;
+};
+
+/* how long opening mpvif:// waits for the capture session to start */
+#define STREAM_OPEN_TIMEOUT 5
+
 static uint64_t mouse_pos_reply_userdata = 1;
 static uint64_t clipboard_text_reply_userdata = 2;
 static uint64_t clipboard_text_primary_reply_userdata = 3;
@@ -153,13 +422,340 @@ static char *remote_output_name;
 static char *remote_seat_name;
 static char *remote_swaysock;
 
+/* the title which was last sent to mpv */
 static char media_title[512];
+static char pending_media_title[512];
+static bool media_title_pending;
+static bool media_title_set;
+static int64_t media_title_last_set;
+/* maximum force-media-title updates per second, 0 for no limit */
+static int title_rate_limit = 4;
+static void title_timer_expired(void);
+static struct timer title_timer = { .callback = title_timer_expired };
+static struct wl_list timer_list;
 
 static int input_forwarding_enabled = 1;
 static int force_grab_cursor_enabled = 0;
 
+/* whether absolute motion is being sent on the virtual pointer */
+static bool mouse_pos_observed;
+
+enum auto_grab_mode {
+    AUTO_GRAB_NO,
+    AUTO_GRAB_LOCK,
+    AUTO_GRAB_LOCK_OR_RELATIVE,
+};
+
+static enum auto_grab_mode auto_grab_mode = AUTO_GRAB_LOCK;
+static uint32_t remote_constraint_state;
+static bool auto_grab_wanted;
+/* whether the current grab was enabled by us rather than by the user */
+static bool auto_grabbed;
+
+static bool capture_enabled;
+/* NULL if duplicate frames aren't dropped */
+static tile_hash_fn capture_tile_hash;
+static void capture_retry_expired(void);
+static struct timer capture_retry_timer = { .callback = capture_retry_expired };
+
+/* published as user-data/mpvif/capture */
+static struct capture_stats {
+    int64_t frames;
+    /* frames without damage, which aren't passed on to mpv */
+    int64_t skipped_frames;
+    /* frames with damage but the same contents */
+    int64_t duplicate_frames;
+    int64_t copied_bytes;
+    int64_t last_copied_bytes;
+    /* late frames which the stream replaced with a newer one */
+    int64_t late_frames;
+    /* no frame was published since the previous update */
+    bool idle;
+    int64_t published_frames;
+    bool dirty;
+} capture_stats;
+static void capture_stats_expired(void);
+static struct timer capture_stats_timer = { .callback = capture_stats_expired };
+
+/*
+ * Latency of the input path in ns, published to user-data/mpvif/latency once
+ * a second: from a mouse-pos change reaching the plugin thread until its
+ * motion is flushed to the compositor socket, and the round trip of a
+ * wl_display_sync to the compositor.
+ */
+static bool latency_enabled;
+/* the histograms are also kept for the metrics */
+static bool latency_histograms;
+/* mouse-pos changes are timestamped for the histogram or the overlay */
+static bool latency_sampling;
+static struct histogram input_latency;
+static struct histogram roundtrip_latency;
+/* when the motions which weren't flushed yet were received. mpv coalesces
+ * mouse-pos changes, so there are rarely more than a few per flush, and the
+ * ones beyond this aren't sampled. */
+static int64_t unflushed_motions[64];
+static int unflushed_motion_count;
+static struct wl_callback *latency_sync;
+static int64_t latency_sync_sent;
+static uint64_t latency_published_count;
+static void latency_expired(void);
+static struct timer latency_timer = { .callback = latency_expired };
+
+/*
+ * Time spent in the handlers which do most of the plugin's work, enabled with
+ * mpvif-stats and shown with script-message-to <client> mpvif-stats. When
+ * disabled, all a handler pays for is a predictable branch on entry and exit.
+ */
+enum handler {
+    HANDLER_MOUSE_POS,
+    HANDLER_RECEIVE_OFFER,
+    HANDLER_SOURCE_SEND,
+    HANDLER_I3IPC_DISPATCH,
+    HANDLER_WAYLAND_DISPATCH,
+    HANDLER_MPV_DISPATCH,
+    HANDLER_TITLE,
+    HANDLER_COUNT
+};
+static const char *const handler_names[HANDLER_COUNT] = {
+    "mouse-pos", "receive-offer", "source-send", "i3ipc-dispatch",
+    "wayland-dispatch", "mpv-dispatch", "title",
+};
+/* what the size passed to handler_end counts, for the trace */
+static const char *const handler_size_names[HANDLER_COUNT] = {
+    NULL, "bytes", "bytes", "events", "events", "events", "bytes",
+};
+static bool handler_stats_enabled;
+static struct handler_stats {
+    uint64_t calls;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    /* calls at the start of the current second, and during the last one */
+    uint64_t window_calls;
+    uint64_t per_second;
+} handler_stats[HANDLER_COUNT];
+static void handler_stats_expired(void);
+static struct timer handler_stats_timer = { .callback = handler_stats_expired };
+
+/*
+ * A timeline of the event loop for Perfetto, enabled with mpvif-trace=FILE.
+ * The handlers above, poll wakeups and outgoing motions are recorded into a
+ * ring which is written to FILE at exit or with script-message-to <client>
+ * mpvif-trace [FILE].
+ */
+static struct trace_ring *trace_ring;
+static char *trace_path;
+/* handlers are timed for the stats or the trace */
+static bool handler_timing_enabled;
+
+/* mpv's message levels, without fatal and status */
+enum log_level {
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_V,
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_TRACE,
+};
+
+/*
+ * Messages go through a ring which the plugin thread drains before it polls,
+ * so logging never waits on the mpv core. The level is the one given to the
+ * client's name (or all) in mpv's msg-level, messages above it aren't even
+ * formatted. A message repeated back to back is printed once and counted,
+ * and beyond LOG_BURST messages a second the rest are counted and dropped.
+ */
+#define LOG_BURST 20
+static struct log_ring *_Atomic log_ring;
+static pthread_t plugin_thread;
+/* other threads (mpv's demuxer thread, the conversion pool) may log until the
+ * plugin thread exits, and then their messages are dropped. log_writers are
+ * the ones which are using the ring or hmpv, which the plugin thread waits
+ * for before it destroys the ring. */
+static atomic_bool log_shutdown;
+static atomic_int log_writers;
+static _Atomic int log_level = LOG_LEVEL_INFO;
+static char log_last[LOG_RING_MESSAGE_SIZE];
+static bool log_last_valid;
+static uint64_t log_repeats;
+static int log_budget;
+static int64_t log_window_start;
+static uint64_t log_suppressed;
+static void log_expired(void);
+static struct timer log_timer = { .callback = log_expired };
+
+/*
+ * Every mouse-pos change, the motion it turned into, warps and toggles, kept
+ * in a memfd for external tools when mpvif-journal is enabled. The file's
+ * path is published in user-data/mpvif/journal.
+ */
+static struct journal *journal;
+
+/* counters of the input path, for the overlay */
+static struct input_counters {
+    uint64_t mouse_pos;
+    uint64_t motions;
+    /* socket writes which carried at least one motion */
+    uint64_t motion_flushes;
+    uint64_t clipboard_in;
+    uint64_t clipboard_in_bytes;
+    uint64_t clipboard_out;
+    uint64_t clipboard_out_bytes;
+    uint64_t i3ipc_events;
+    /* ns, the last blocking sway IPC request */
+    int64_t i3ipc_request_time;
+    /* application pointer warps relayed to mpv */
+    uint64_t warps;
+    uint64_t virtual_pointers;
+    uint64_t data_control_devices;
+} counters;
+static bool motions_unflushed;
+
+/*
+ * A text overlay with the state of the input path, toggled with
+ * script-message-to <client> mpvif-overlay and redrawn twice a second.
+ */
+static bool overlay_shown;
+/* the counters at the last redraw */
+static struct input_counters overlay_counters;
+static int64_t overlay_time;
+static struct histogram overlay_input_latency;
+static void overlay_expired(void);
+static struct timer overlay_timer = { .callback = overlay_expired };
+
+/*
+ * The counters above and the latency histograms in the OpenMetrics text
+ * format, written to whoever connects to mpvif-metrics-socket=PATH and to
+ * mpvif-metrics-file=PATH every mpvif-metrics-interval seconds, for
+ * node_exporter's textfile collector. Both are served from the main loop.
+ */
+static char *metrics_socket_path;
+static int metrics_socket_fd = -1;
+static char *metrics_file_path;
+static int metrics_interval = 15;
+static void metrics_file_expired(void);
+static struct timer metrics_file_timer = { .callback = metrics_file_expired };
+
+static struct zwlr_output_manager_v1 *output_manager;
+static uint32_t output_manager_serial;
+static struct wl_list output_head_list;
+static struct zwlr_output_configuration_v1 *output_configuration;
+/* the mode the remote output should be switched to, 0 for keeping the current
+ * value, applied once no other configuration is in flight */
+static struct output_mode_request {
+    int32_t width;
+    int32_t height;
+    int32_t refresh;
+} output_mode_wanted, output_mode_applying;
+static bool output_mode_pending;
+/* the mode of the remote output when the plugin started, restored on exit */
+static struct output_mode_request output_mode_startup;
+
+/*
+ * Sizes the remote output to an integer fraction of the mpv window, so that
+ * the video is scaled by an exact factor. 0 if disabled, -1 for the factor
+ * which comes closest to the startup size.
+ */
+static int integer_scale;
+static void integer_scale_expired(void);
+static struct timer integer_scale_timer = { .callback = integer_scale_expired };
+
+/* mHz the remote output is throttled to while the mpv window is hidden, 0 if
+ * it isn't throttled */
+static int32_t hidden_refresh;
+/* also throttle while the window is unfocused */
+static bool hidden_unfocused;
+static int window_minimized;
+static int window_focused = 1;
+static bool output_throttled;
+/* the refresh rate to go back to */
+static int32_t throttled_refresh;
+
+/*
+ * Steps the refresh rate of the remote output down while mpv misses frames
+ * and back up to the rate it had at startup once the shaders have room for
+ * it again. Evaluated once a second.
+ */
+static bool adaptive_refresh_enabled;
+/* mHz */
+static int32_t adaptive_refresh_min = 30000;
+static struct adaptive_refresh {
+    /* mHz, the refresh rate of the remote output when the plugin started,
+     * 0 until it's known */
+    int32_t max;
+    int32_t rate;
+    /* counters at the start of the current second */
+    int64_t drops;
+    int64_t delayed;
+    uint64_t late;
+    int bad_windows;
+    int good_windows;
+    int good_windows_needed;
+    int64_t last_step_up;
+    /* rates the compositor rejected */
+    int32_t failed[8];
+    int failed_count;
+} adaptive_refresh;
+static void adaptive_refresh_expired(void);
+static struct timer adaptive_refresh_timer = { .callback = adaptive_refresh_expired };
+
+/*
+ * mpv profiles applied while a toplevel with a given app_id is fullscreen on
+ * the remote output, from mpvif-profiles. They're checked against profile-list
+ * at startup, and only profiles which mpv can restore are used, so that they
+ * can be reverted when the window leaves fullscreen.
+ */
+static struct wl_list app_profile_list;
+static struct app_profile *current_app_profile;
+static bool app_profile_pending;
+/* the remote output mode to go back to when the profile is reverted */
+static struct output_mode_request app_profile_saved_mode;
+
+/*
+ * Picks the first chain of mpvif-shader-chains, which go from the best quality
+ * to the cheapest, whose render passes fit in a share of the remote frame
+ * time. Each chain is applied in turn and its cost read from vo-passes once
+ * mpv has rendered with it for a while. The choice is cached per app_id and
+ * resolution of the fullscreen toplevel.
+ */
+static char **shader_chains;
+static int shader_chain_count;
+/* percent of the remote frame time */
+static int shader_budget = 75;
+static struct shader_cache *shader_cache;
+static bool shader_select_pending;
+static struct shader_select {
+    /* what the current chain was picked for, NULL if nothing */
+    char *app_id;
+    int32_t width;
+    int32_t height;
+    /* glsl-shaders before the first chain was applied */
+    char *original;
+    bool original_saved;
+    /* the chain being measured, -1 if none is */
+    int measuring;
+    int tries;
+    int cheapest;
+    int64_t cheapest_cost;
+} shader_select = { .measuring = -1 };
+static void shader_measure_expired(void);
+static struct timer shader_measure_timer = { .callback = shader_measure_expired };
+
+static bool cursor_enabled;
+static bool cursor_overlay_dirty;
+static bool cursor_overlay_shown;
+static struct cursor_image *cursor_overlay_image;
+static int64_t cursor_overlay_x;
+static int64_t cursor_overlay_y;
+static struct mouse_pos_values host_mouse_v;
+
 static int output_layout_x;
 static int output_layout_y;
+static int output_layout_w;
+static int output_layout_h;
+
+static bool auto_crop_enabled;
+static bool auto_crop_pending;
+static char auto_crop[64];
 
 static mpv_handle *hmpv;
 
@@ -167,7 +763,7 @@ static bool is_eligible_toplevel(struct wayland_toplevel_handle *tl);
 static void set_fullscreen_title(void);
 static void set_generic_title(void);
 static void destroy_toplevel_handle(struct wayland_toplevel_handle *tl);
-static void logger(const char *fmt, ...);
+static void log_message(int level, const char *fmt, ...);
 static void destroy_data_control_source(struct wayland_data_control_source *ds);
 static void destroy_data_control_device(void);
 static void handle_selection(struct ext_data_control_offer_v1 *id, bool primary);
@@ -175,16 +771,106 @@ static bool should_create_virtual_pointer(void);
 static void create_virtual_pointer(void);
 static bool should_create_data_control_device(void);
 static void create_data_control_device(void);
+static bool should_create_pointer_warp(void);
+static void create_pointer_warp(void);
+static void relay_pointer_warp(int output_local_x, int output_local_y);
+static bool should_create_pointer_constraints(void);
+static void create_pointer_constraints(void);
+static void update_auto_grab(void);
+static bool should_create_cursor_capture(void);
+static void create_cursor_capture(void);
+static void destroy_cursor_capture(void);
+static void create_cursor_frame(void);
+static void destroy_cursor_frame(void);
+static bool should_create_output_capture(void);
+static void create_output_capture(void);
+static void destroy_output_capture(void);
+static bool allocate_capture_ring(void);
+static bool is_duplicate_frame(int slot);
+static void destroy_capture_ring(void);
+static bool should_create_capture_frame(void);
+static void create_capture_frame(void);
+static void destroy_capture_frame(void);
+static int64_t monotonic_ms(void);
+static int64_t monotonic_ns(void);
+static void timer_arm(struct timer *t, int64_t deadline);
+static void timer_disarm(struct timer *t);
+static bool allocate_cursor_buffer(void);
+static void update_output_throttle(void);
+static struct cursor_image *get_cursor_image(const uint32_t *data,
+        int32_t width, int32_t height);
 static void destroy_output(struct wayland_output *o);
 static void destroy_seat(struct wayland_seat *s);
 
+#define logger_at(level, ...) do { \
+    if ((level) <= log_level) \
+        log_message((level), __VA_ARGS__); \
+} while (0)
+#define logger(...) logger_at(LOG_LEVEL_INFO, __VA_ARGS__)
+
+static inline int64_t handler_begin(void)
+{
+    if (__builtin_expect(handler_timing_enabled, 0))
+        return monotonic_ns();
+    return 0;
+}
+
+/* start is 0 if handlers aren't timed. size is the payload the handler
+ * processed, see handler_size_names. */
+static inline void handler_end(enum handler handler, int64_t start,
+        int64_t size)
+{
+    if (__builtin_expect(start != 0, 0)) {
+        uint64_t ns = monotonic_ns() - start;
+        if (handler_stats_enabled) {
+            struct handler_stats *hs = &handler_stats[handler];
+            hs->calls++;
+            hs->total_ns += ns;
+            if (ns > hs->max_ns)
+                hs->max_ns = ns;
+        }
+        if (trace_ring)
+            trace_ring_add(trace_ring, handler_names[handler], start, ns,
+                    handler_size_names[handler], size);
+    }
+}
+
+static bool toplevel_string_set(struct toplevel_string *ts, const char *value)
+{
+    if (ts->str && strcmp(ts->str, value) == 0)
+        return false;
+
+    size_t len = strlen(value) + 1;
+    if (len > ts->size) {
+        size_t size = MAX(len, 64);
+        char *str = realloc(ts->str, size);
+        if (!str)
+            return false;
+        ts->str = str;
+        ts->size = size;
+    }
+
+    memcpy(ts->str, value, len);
+    return true;
+}
+
+static void toplevel_string_free(struct toplevel_string *ts)
+{
+    free(ts->str);
+    ts->str = NULL;
+    ts->size = 0;
+}
+
 static void toplevel_handle_title(void *data,
         struct zwlr_foreign_toplevel_handle_v1 *zwlr_foreign_toplevel_handle_v1,
         const char *title)
 {
     struct wayland_toplevel_handle *tl = data;
-    free(tl->title);
-    tl->title = strdup(title);
+    if (tl->title_dropped && !tl->visible_on_remote_output && !tl->fullscreen)
+        return;
+    tl->title_dropped = false;
+    if (toplevel_string_set(&tl->title, title))
+        tl->dirty = true;
 }
 
 static void toplevel_handle_app_id(void *data,
@@ -192,8 +878,8 @@ static void toplevel_handle_app_id(void *data,
         const char *app_id)
 {
     struct wayland_toplevel_handle *tl = data;
-    free(tl->app_id);
-    tl->app_id = strdup(app_id);
+    if (toplevel_string_set(&tl->app_id, app_id))
+        tl->dirty = true;
 }
 
 static void toplevel_handle_output_enter(void *data,
@@ -205,8 +891,10 @@ static void toplevel_handle_output_enter(void *data,
     if (!output)
         return;
 
-    if (wl_output_get_user_data(output) == remote_output)
+    if (wl_output_get_user_data(output) == remote_output) {
         tl->visible_on_remote_output = true;
+        tl->dirty = true;
+    }
 }
 
 static void toplevel_handle_output_leave(void *data,
@@ -218,8 +906,10 @@ static void toplevel_handle_output_leave(void *data,
     if (!output)
         return;
 
-    if (wl_output_get_user_data(output) == remote_output)
+    if (wl_output_get_user_data(output) == remote_output) {
         tl->visible_on_remote_output = false;
+        tl->dirty = true;
+    }
 }
 
 static void toplevel_handle_state(void *data,
@@ -228,14 +918,19 @@ static void toplevel_handle_state(void *data,
 {
     struct wayland_toplevel_handle *tl = data;
 
-    tl->fullscreen = false;
+    bool fullscreen = false;
     enum zwlr_foreign_toplevel_handle_v1_state *state_pos;
     wl_array_for_each(state_pos, state) {
         if (*state_pos == ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_FULLSCREEN) {
-            tl->fullscreen = true;
+            fullscreen = true;
             break;
         }
     }
+
+    if (fullscreen != tl->fullscreen) {
+        tl->fullscreen = fullscreen;
+        tl->dirty = true;
+    }
 }
 
 static void toplevel_handle_done(void *data,
@@ -243,13 +938,33 @@ static void toplevel_handle_done(void *data,
 {
     struct wayland_toplevel_handle *tl = data;
 
+    /* e.g. only activated/maximized state changes */
+    if (!tl->dirty)
+        return;
+    tl->dirty = false;
+
+    /* fullscreen toplevels are kept because of the output_leave bug
+     * mentioned in is_eligible_toplevel. The app_id is kept since it's short
+     * and rarely changes, and profiles and shader selection need it. */
+    if (toplevel_lite_enabled && !tl->visible_on_remote_output &&
+            !tl->fullscreen && tl->title.str) {
+        toplevel_string_free(&tl->title);
+        tl->title_dropped = true;
+    }
+
     if (is_eligible_toplevel(tl)) {
         current_eligible_toplevel = tl;
         set_fullscreen_title();
+        auto_crop_pending = true;
+        app_profile_pending = true;
+        shader_select_pending = true;
     } else {
         if (current_eligible_toplevel == tl) {
             current_eligible_toplevel = NULL;
             set_generic_title();
+            auto_crop_pending = true;
+            app_profile_pending = true;
+            shader_select_pending = true;
         }
     }
 }
@@ -308,453 +1023,3705 @@ static const struct zwlr_foreign_toplevel_manager_v1_listener toplevel_manager_l
     toplevel_manager_finished,
 };
 
-static void data_control_source_send(void *data,
-        struct ext_data_control_source_v1 *ext_data_control_source_v1,
-        const char *mime_type, int fd)
+static void destroy_output_head_mode(struct output_head_mode *mode)
 {
-    struct wayland_data_control_source *ds = data;
-    const char *clip_data = NULL;
-    size_t clip_len = 0;
+    if (mode->head->current_mode == mode)
+        mode->head->current_mode = NULL;
 
-    for (size_t i = 0; i < sizeof(utf8_mimes) / sizeof(utf8_mimes[0]); i++) {
-        if (strcmp(mime_type, utf8_mimes[i]) == 0) {
-            clip_data = ds->text;
-            clip_len = ds->len;
-            break;
-        }
-    }
+    if (zwlr_output_mode_v1_get_version(mode->obj) >=
+            ZWLR_OUTPUT_MODE_V1_RELEASE_SINCE_VERSION)
+        zwlr_output_mode_v1_release(mode->obj);
+    else
+        zwlr_output_mode_v1_destroy(mode->obj);
 
-    if (!clip_data) {
-        if (strcmp(mime_type, custom_mime_type_name) == 0) {
-            clip_data = custom_mime_type_data;
-            clip_len = strlen(custom_mime_type_data);
-        }
-    }
+    wl_list_remove(&mode->link);
+    free(mode);
+}
 
-    if (clip_data) {
-        if (write(fd, clip_data, clip_len) == -1)
-               logger("write() failed: %m");
+static void destroy_output_head(struct output_head *head)
+{
+    struct output_head_mode *mode, *mode_tmp;
+    wl_list_for_each_safe(mode, mode_tmp, &head->modes, link)
+        destroy_output_head_mode(mode);
+
+    if (zwlr_output_head_v1_get_version(head->obj) >=
+            ZWLR_OUTPUT_HEAD_V1_RELEASE_SINCE_VERSION)
+        zwlr_output_head_v1_release(head->obj);
+    else
+        zwlr_output_head_v1_destroy(head->obj);
+
+    free(head->name);
+    wl_list_remove(&head->link);
+    free(head);
+}
+
+static struct output_head *remote_output_head(void)
+{
+    struct output_head *head;
+    wl_list_for_each(head, &output_head_list, link) {
+        if (head->name && strcmp(head->name, remote_output_name) == 0)
+            return head;
     }
 
-    close(fd);
+    return NULL;
 }
 
-static void data_control_source_cancelled(void *data,
-        struct ext_data_control_source_v1 *ext_data_control_source_v1)
+static void output_mode_size(void *data,
+        struct zwlr_output_mode_v1 *zwlr_output_mode_v1,
+        int32_t width, int32_t height)
 {
-    struct wayland_data_control_source *ds = data;
+    struct output_head_mode *mode = data;
+    mode->width = width;
+    mode->height = height;
+}
 
-    destroy_data_control_source(ds);
+static void output_mode_refresh(void *data,
+        struct zwlr_output_mode_v1 *zwlr_output_mode_v1, int32_t refresh)
+{
+    struct output_head_mode *mode = data;
+    mode->refresh = refresh;
 }
 
-static const struct ext_data_control_source_v1_listener data_control_source_listener = {
-    data_control_source_send,
-    data_control_source_cancelled,
+static void output_mode_preferred(void *data,
+        struct zwlr_output_mode_v1 *zwlr_output_mode_v1)
+{
+}
+
+static void output_mode_finished(void *data,
+        struct zwlr_output_mode_v1 *zwlr_output_mode_v1)
+{
+    destroy_output_head_mode(data);
+}
+
+static const struct zwlr_output_mode_v1_listener output_mode_listener = {
+    output_mode_size,
+    output_mode_refresh,
+    output_mode_preferred,
+    output_mode_finished,
 };
 
-static void data_control_offer_offer(void *data,
-        struct ext_data_control_offer_v1 *ext_data_control_offer_v1,
-        const char *mime_type)
+static void output_head_name(void *data,
+        struct zwlr_output_head_v1 *zwlr_output_head_v1, const char *name)
 {
-    if (ext_data_control_offer_v1 != dc_offer) {
-        logger("unexpected data offer offer event, shouldn't happen");
-        return;
-    }
+    struct output_head *head = data;
+    free(head->name);
+    head->name = strdup(name);
+}
 
-    if (dc_offer_is_our_own)
-        return;
+static void output_head_description(void *data,
+        struct zwlr_output_head_v1 *zwlr_output_head_v1,
+        const char *description)
+{
+}
 
-    if (strcmp(mime_type, custom_mime_type_name) == 0) {
-        dc_offer_is_our_own = true;
-        return;
-    }
+static void output_head_physical_size(void *data,
+        struct zwlr_output_head_v1 *zwlr_output_head_v1,
+        int32_t width, int32_t height)
+{
+}
 
-    /* prefer to use text/plain;charset=utf-8, applications hopefully offer this
-     * one first */
-    if (dc_offer_mime_idx == 0)
-        return;
+static void output_head_mode(void *data,
+        struct zwlr_output_head_v1 *zwlr_output_head_v1,
+        struct zwlr_output_mode_v1 *obj)
+{
+    struct output_head *head = data;
 
-    for (size_t i = 0; i < sizeof(utf8_mimes) / sizeof(utf8_mimes[0]); i++) {
-        if (strcmp(mime_type, utf8_mimes[i]) == 0) {
-            dc_offer_mime_idx = i;
-            return;
-        }
+    struct output_head_mode *mode = calloc(1, sizeof(*mode));
+    if (!mode) {
+        zwlr_output_mode_v1_destroy(obj);
+        return;
     }
-}
 
-static const struct ext_data_control_offer_v1_listener data_control_offer_listener = {
-    data_control_offer_offer,
-};
+    mode->obj = obj;
+    mode->head = head;
+    wl_list_insert(&head->modes, &mode->link);
+    zwlr_output_mode_v1_add_listener(obj, &output_mode_listener, mode);
+}
 
-static void data_control_device_data_offer(void *data,
-        struct ext_data_control_device_v1 *ext_data_control_device_v1,
-        struct ext_data_control_offer_v1 *id)
+static void output_head_enabled(void *data,
+        struct zwlr_output_head_v1 *zwlr_output_head_v1, int32_t enabled)
 {
-    if (!id)
-        return;
+    struct output_head *head = data;
+    head->enabled = enabled;
+    if (!enabled)
+        head->current_mode = NULL;
+}
 
-    dc_offer = id;
-    ext_data_control_offer_v1_add_listener(id, &data_control_offer_listener,
-            NULL);
+static void output_head_current_mode(void *data,
+        struct zwlr_output_head_v1 *zwlr_output_head_v1,
+        struct zwlr_output_mode_v1 *obj)
+{
+    struct output_head *head = data;
+    /* NULL if the mode couldn't be allocated */
+    head->current_mode = obj ? zwlr_output_mode_v1_get_user_data(obj) : NULL;
 }
 
-static void data_control_device_selection(void *data,
-        struct ext_data_control_device_v1 *ext_data_control_device_v1,
-        struct ext_data_control_offer_v1 *id)
+static void output_head_position(void *data,
+        struct zwlr_output_head_v1 *zwlr_output_head_v1, int32_t x, int32_t y)
 {
-    handle_selection(id, false);
 }
 
-static void data_control_device_finished(void *data,
-        struct ext_data_control_device_v1 *ext_data_control_device_v1)
+static void output_head_transform(void *data,
+        struct zwlr_output_head_v1 *zwlr_output_head_v1, int32_t transform)
 {
-    logger("compositor is finished with our data control device for some reason");
-    destroy_data_control_device();
 }
 
-static void data_control_device_primary_selection(void *data,
-        struct ext_data_control_device_v1 *ext_data_control_device_v1,
-        struct ext_data_control_offer_v1 *id)
+static void output_head_scale(void *data,
+        struct zwlr_output_head_v1 *zwlr_output_head_v1, wl_fixed_t scale)
 {
-    handle_selection(id, true);
 }
 
-static const struct ext_data_control_device_v1_listener data_control_device_listener = {
-    data_control_device_data_offer,
-    data_control_device_selection,
-    data_control_device_finished,
-    data_control_device_primary_selection,
-};
+static void output_head_finished(void *data,
+        struct zwlr_output_head_v1 *zwlr_output_head_v1)
+{
+    destroy_output_head(data);
+}
 
-static void output_geometry(void *data, struct wl_output *wl_output,
-        int32_t x, int32_t y, int32_t physical_width, int32_t physical_height,
-        int32_t subpixel, const char *make, const char *model,
-        int32_t transform)
+static void output_head_make(void *data,
+        struct zwlr_output_head_v1 *zwlr_output_head_v1, const char *make)
 {
 }
 
-static void output_mode(void *data, struct wl_output *wl_output,
-        uint32_t flags, int32_t width, int32_t height, int32_t refresh)
+static void output_head_model(void *data,
+        struct zwlr_output_head_v1 *zwlr_output_head_v1, const char *model)
 {
 }
 
-static void output_done(void *data, struct wl_output *wl_output)
+static void output_head_serial_number(void *data,
+        struct zwlr_output_head_v1 *zwlr_output_head_v1,
+        const char *serial_number)
 {
 }
 
-static void output_scale(void *data, struct wl_output *wl_output,
-        int32_t scale)
+static void output_head_adaptive_sync(void *data,
+        struct zwlr_output_head_v1 *zwlr_output_head_v1, uint32_t state)
 {
 }
 
-static void output_name(void *data, struct wl_output *wl_output,
-        const char *name)
+static const struct zwlr_output_head_v1_listener output_head_listener = {
+    output_head_name,
+    output_head_description,
+    output_head_physical_size,
+    output_head_mode,
+    output_head_enabled,
+    output_head_current_mode,
+    output_head_position,
+    output_head_transform,
+    output_head_scale,
+    output_head_finished,
+    output_head_make,
+    output_head_model,
+    output_head_serial_number,
+    output_head_adaptive_sync,
+};
+
+static void output_manager_head(void *data,
+        struct zwlr_output_manager_v1 *zwlr_output_manager_v1,
+        struct zwlr_output_head_v1 *obj)
 {
-    struct wayland_output *o = data;
+    struct output_head *head = calloc(1, sizeof(*head));
+    if (!head) {
+        zwlr_output_head_v1_destroy(obj);
+        return;
+    }
 
-    if (strcmp(name, remote_output_name) == 0) {
-        remote_output = o;
+    head->obj = obj;
+    wl_list_init(&head->modes);
+    wl_list_insert(&output_head_list, &head->link);
+    zwlr_output_head_v1_add_listener(obj, &output_head_listener, head);
+}
 
-        if (should_create_virtual_pointer())
-            create_virtual_pointer();
+static void output_manager_done(void *data,
+        struct zwlr_output_manager_v1 *zwlr_output_manager_v1, uint32_t serial)
+{
+    output_manager_serial = serial;
+
+    struct output_head *head = remote_output_head();
+    if (!output_mode_startup.width && head && head->current_mode) {
+        output_mode_startup = (struct output_mode_request){
+            .width = head->current_mode->width,
+            .height = head->current_mode->height,
+            .refresh = head->current_mode->refresh,
+        };
+
+        /* the window size may have been known before the output */
+        if (integer_scale)
+            timer_arm(&integer_scale_timer, monotonic_ms());
+        if (hidden_refresh)
+            update_output_throttle();
     }
 }
 
-static void output_description(void *data, struct wl_output *wl_output,
-        const char *description)
+static void output_manager_finished(void *data,
+        struct zwlr_output_manager_v1 *zwlr_output_manager_v1)
 {
+    logger("compositor is finished with our output manager for some reason");
+    zwlr_output_manager_v1_destroy(output_manager);
+    output_manager = NULL;
 }
 
-static const struct wl_output_listener output_listener = {
-    output_geometry,
-    output_mode,
-    output_done,
-    output_scale,
-    output_name,
-    output_description,
+static const struct zwlr_output_manager_v1_listener output_manager_listener = {
+    output_manager_head,
+    output_manager_done,
+    output_manager_finished,
 };
 
-static void seat_capabilities(void *data, struct wl_seat *wl_seat,
-        uint32_t capabilities)
+static void finish_output_configuration(void)
 {
+    zwlr_output_configuration_v1_destroy(output_configuration);
+    output_configuration = NULL;
 }
 
-static void seat_name(void *data, struct wl_seat *wl_seat,
-        const char *name)
+static void output_configuration_succeeded(void *data,
+        struct zwlr_output_configuration_v1 *zwlr_output_configuration_v1)
 {
-    struct wayland_seat *s = data;
+    finish_output_configuration();
+}
+
+static void output_configuration_failed(void *data,
+        struct zwlr_output_configuration_v1 *zwlr_output_configuration_v1)
+{
+    finish_output_configuration();
+
+    logger("the remote compositor rejected the output mode %" PRId32 "x%" PRId32 "@%.3fHz",
+            output_mode_applying.width, output_mode_applying.height,
+            output_mode_applying.refresh / 1000.0);
+
+    /* don't try it again until something asks for a different mode */
+    output_mode_wanted = (struct output_mode_request){0};
+    output_mode_pending = false;
+
+    struct output_head *head = remote_output_head();
+    if (adaptive_refresh.max && head && head->current_mode) {
+        int32_t rate = head->current_mode->refresh;
+        if (abs(output_mode_applying.refresh - rate) >= 500 &&
+                adaptive_refresh.failed_count < 8)
+            adaptive_refresh.failed[adaptive_refresh.failed_count++] =
+                output_mode_applying.refresh;
+        adaptive_refresh.rate = rate;
+        adaptive_refresh.good_windows = 0;
+        adaptive_refresh.bad_windows = 0;
+    }
+}
+
+static void output_configuration_cancelled(void *data,
+        struct zwlr_output_configuration_v1 *zwlr_output_configuration_v1)
+{
+    finish_output_configuration();
+    /* the outputs changed in the meantime, try again with the new serial */
+    output_mode_pending = true;
+}
+
+static const struct zwlr_output_configuration_v1_listener output_configuration_listener = {
+    output_configuration_succeeded,
+    output_configuration_failed,
+    output_configuration_cancelled,
+};
+
+static void request_remote_output_mode(int32_t width, int32_t height,
+        int32_t refresh)
+{
+    if (width)
+        output_mode_wanted.width = width;
+    if (height)
+        output_mode_wanted.height = height;
+    if (refresh)
+        output_mode_wanted.refresh = refresh;
+    output_mode_pending = true;
+}
+
+static struct output_head_mode *find_output_head_mode(struct output_head *head,
+        int32_t width, int32_t height, int32_t refresh)
+{
+    struct output_head_mode *mode;
+    wl_list_for_each(mode, &head->modes, link) {
+        /* e.g. 59940 for "60Hz" */
+        if (mode->width == width && mode->height == height &&
+                abs(mode->refresh - refresh) < 500)
+            return mode;
+    }
+
+    return NULL;
+}
+
+static void apply_remote_output_mode(void)
+{
+    output_mode_pending = false;
+
+    struct output_head *head = remote_output_head();
+    if (!output_manager || !head || !head->enabled || !head->current_mode)
+        return;
+
+    struct output_head_mode *current = head->current_mode;
+    struct output_mode_request req = output_mode_wanted;
+    if (!req.width || !req.height) {
+        req.width = current->width;
+        req.height = current->height;
+    }
+    if (!req.refresh)
+        req.refresh = current->refresh;
+
+    if (req.width == current->width && req.height == current->height &&
+            req.refresh == current->refresh)
+        return;
+
+    output_configuration = zwlr_output_manager_v1_create_configuration(
+            output_manager, output_manager_serial);
+    zwlr_output_configuration_v1_add_listener(output_configuration,
+            &output_configuration_listener, NULL);
+
+    struct output_head *h;
+    wl_list_for_each(h, &output_head_list, link) {
+        if (!h->enabled) {
+            zwlr_output_configuration_v1_disable_head(output_configuration,
+                    h->obj);
+            continue;
+        }
+
+        /* a head which is enabled without setting anything keeps its
+         * current state */
+        struct zwlr_output_configuration_head_v1 *config_head =
+            zwlr_output_configuration_v1_enable_head(output_configuration,
+                    h->obj);
+        if (h == head) {
+            /* headless outputs don't advertise any modes */
+            struct output_head_mode *mode = find_output_head_mode(head,
+                    req.width, req.height, req.refresh);
+            if (mode)
+                zwlr_output_configuration_head_v1_set_mode(config_head,
+                        mode->obj);
+            else
+                zwlr_output_configuration_head_v1_set_custom_mode(config_head,
+                        req.width, req.height, req.refresh);
+        }
+        zwlr_output_configuration_head_v1_destroy(config_head);
+    }
+
+    zwlr_output_configuration_v1_apply(output_configuration);
+    output_mode_applying = req;
+}
+
+static bool adaptive_refresh_usable(int32_t rate)
+{
+    if (rate < adaptive_refresh_min || rate > adaptive_refresh.max)
+        return false;
+
+    for (int i = 0; i < adaptive_refresh.failed_count; i++) {
+        if (abs(adaptive_refresh.failed[i] - rate) < 500)
+            return false;
+    }
+
+    return true;
+}
+
+/* the closest usable rate below or above rate, 0 if there is none. Modes of
+ * the same size which the output advertises are candidates, and so are common
+ * rates as custom modes since headless outputs don't advertise any. */
+static int32_t adaptive_refresh_step(struct output_head *head, int32_t rate,
+        bool up)
+{
+    static const int32_t common_rates[] = {
+        240000, 165000, 144000, 120000, 100000, 90000, 75000, 60000, 50000,
+        48000, 40000, 30000, 24000,
+    };
+
+    int32_t candidates[sizeof(common_rates) / sizeof(common_rates[0]) + 33];
+    int count = 0;
+
+    /* the startup rate is always one */
+    candidates[count++] = adaptive_refresh.max;
+    for (size_t i = 0; i < sizeof(common_rates) / sizeof(common_rates[0]); i++)
+        candidates[count++] = common_rates[i];
+
+    struct output_head_mode *mode;
+    wl_list_for_each(mode, &head->modes, link) {
+        if (count < (int)(sizeof(candidates) / sizeof(candidates[0])) &&
+                mode->width == head->current_mode->width &&
+                mode->height == head->current_mode->height)
+            candidates[count++] = mode->refresh;
+    }
+
+    int32_t best = 0;
+    for (int i = 0; i < count; i++) {
+        int32_t r = candidates[i];
+        if (!adaptive_refresh_usable(r))
+            continue;
+        if (up && r > rate + 500 && (!best || r < best))
+            best = r;
+        else if (!up && r < rate - 500 && r > best)
+            best = r;
+    }
+
+    return best;
+}
+
+static int64_t get_mpv_int64(const char *name)
+{
+    int64_t value = 0;
+    if (mpv_get_property(hmpv, name, MPV_FORMAT_INT64, &value) < 0)
+        return 0;
+    return value;
+}
+
+/* the average time the render passes of a new frame take in nanoseconds,
+ * 0 if the VO doesn't report it */
+static int64_t fresh_frame_render_time(void)
+{
+    mpv_node node;
+    if (mpv_get_property(hmpv, "vo-passes", MPV_FORMAT_NODE, &node) < 0)
+        return 0;
+
+    int64_t total = 0;
+    if (node.format == MPV_FORMAT_NODE_MAP) {
+        mpv_node_list *list = node.u.list;
+        for (int i = 0; i < list->num; i++) {
+            if (strcmp(list->keys[i], "fresh") != 0 ||
+                    list->values[i].format != MPV_FORMAT_NODE_ARRAY)
+                continue;
+
+            mpv_node_list *passes = list->values[i].u.list;
+            for (int j = 0; j < passes->num; j++) {
+                if (passes->values[j].format != MPV_FORMAT_NODE_MAP)
+                    continue;
+
+                mpv_node_list *pass = passes->values[j].u.list;
+                for (int k = 0; k < pass->num; k++) {
+                    if (strcmp(pass->keys[k], "avg") == 0 &&
+                            pass->values[k].format == MPV_FORMAT_INT64)
+                        total += pass->values[k].u.int64;
+                }
+            }
+        }
+    }
+
+    mpv_free_node_contents(&node);
+    return total;
+}
+
+static void set_adaptive_refresh_rate(int32_t rate, int64_t missed)
+{
+    logger("%s the remote refresh rate to %.3fHz (%" PRId64 " late or dropped frames in the last second)",
+            rate > adaptive_refresh.rate ? "raising" : "lowering",
+            rate / 1000.0, missed);
+
+    adaptive_refresh.rate = rate;
+    adaptive_refresh.bad_windows = 0;
+    adaptive_refresh.good_windows = 0;
+    request_remote_output_mode(0, 0, rate);
+}
+
+static void adaptive_refresh_expired(void)
+{
+    timer_arm(&adaptive_refresh_timer, monotonic_ms() + 1000);
+
+    struct output_head *head = remote_output_head();
+    if (!head || !head->current_mode || !head->current_mode->refresh)
+        return;
+
+    int64_t drops = get_mpv_int64("frame-drop-count");
+    int64_t delayed = get_mpv_int64("vo-delayed-frame-count");
+    uint64_t late = atomic_load(&stream_late_frames);
+    int64_t missed = (drops - adaptive_refresh.drops) +
+        (delayed - adaptive_refresh.delayed) +
+        (int64_t)(late - adaptive_refresh.late);
+    adaptive_refresh.drops = drops;
+    adaptive_refresh.delayed = delayed;
+    adaptive_refresh.late = late;
+
+    if (!adaptive_refresh.max) {
+        adaptive_refresh.max = head->current_mode->refresh;
+        adaptive_refresh.rate = adaptive_refresh.max;
+        adaptive_refresh.good_windows_needed = 10;
+        return;
+    }
+
+    /* the second in which the mode changed says nothing about the new one,
+     * and nothing is shown while throttled */
+    if (output_throttled || output_configuration || output_mode_pending ||
+            abs(head->current_mode->refresh - adaptive_refresh.rate) >= 500)
+        return;
+
+    if (missed > 0) {
+        adaptive_refresh.good_windows = 0;
+        /* a single bad second is usually a loading screen or a shader
+         * switch */
+        if (++adaptive_refresh.bad_windows < 2)
+            return;
+
+        int32_t rate = adaptive_refresh_step(head, adaptive_refresh.rate,
+                false);
+        if (!rate)
+            return;
+
+        /* the last step up didn't hold, wait longer before the next one */
+        if (monotonic_ms() - adaptive_refresh.last_step_up < 30000)
+            adaptive_refresh.good_windows_needed =
+                MIN(adaptive_refresh.good_windows_needed * 2, 600);
+
+        set_adaptive_refresh_rate(rate, missed);
+        return;
+    }
+
+    adaptive_refresh.bad_windows = 0;
+    if (++adaptive_refresh.good_windows < adaptive_refresh.good_windows_needed)
+        return;
+
+    int32_t rate = adaptive_refresh_step(head, adaptive_refresh.rate, true);
+    if (!rate)
+        return;
+
+    /* only step up if the render passes would take less than 3/4 of the
+     * frame time at the higher rate */
+    int64_t render_time = fresh_frame_render_time();
+    if (render_time && render_time * rate * 4 >= INT64_C(3000000000000)) {
+        adaptive_refresh.good_windows = 0;
+        return;
+    }
+
+    adaptive_refresh.last_step_up = monotonic_ms();
+    set_adaptive_refresh_rate(rate, 0);
+}
+
+static void integer_scale_expired(void)
+{
+    int32_t width = osd_v.w;
+    int32_t height = osd_v.h;
+    if (width <= 0 || height <= 0 || !output_mode_startup.width)
+        return;
+
+    int factor = integer_scale;
+    if (factor < 0) {
+        /* the factor which comes closest to the startup size, checked on
+         * both axes so that the game doesn't get a smaller resolution than
+         * was configured on either of them */
+        int factor_x = (width + output_mode_startup.width / 2) /
+            output_mode_startup.width;
+        int factor_y = (height + output_mode_startup.height / 2) /
+            output_mode_startup.height;
+        factor = MAX(MIN(factor_x, factor_y), 1);
+    }
+
+    if (width / factor < 1 || height / factor < 1)
+        return;
+
+    request_remote_output_mode(width / factor, height / factor, 0);
+}
+
+static void update_output_throttle(void)
+{
+    bool hidden = window_minimized || (hidden_unfocused && !window_focused);
+    if (hidden == output_throttled)
+        return;
+
+    if (!hidden) {
+        output_throttled = false;
+        request_remote_output_mode(0, 0, throttled_refresh);
+        return;
+    }
+
+    struct output_head *head = remote_output_head();
+    if (!head || !head->current_mode || !head->current_mode->refresh)
+        return;
+
+    /* a mode which is about to be applied counts as the current one */
+    if (adaptive_refresh.max)
+        throttled_refresh = adaptive_refresh.rate;
+    else if (output_mode_pending && output_mode_wanted.refresh)
+        throttled_refresh = output_mode_wanted.refresh;
+    else
+        throttled_refresh = head->current_mode->refresh;
+
+    output_throttled = true;
+    request_remote_output_mode(0, 0, hidden_refresh);
+}
+
+static void apply_shader_chain(int index)
+{
+    if (!shader_select.original_saved) {
+        shader_select.original = mpv_get_property_string(hmpv, "glsl-shaders");
+        shader_select.original_saved = true;
+    }
+
+    mpv_set_property_string(hmpv, "glsl-shaders", shader_chains[index]);
+}
+
+static void restore_shaders(void)
+{
+    timer_disarm(&shader_measure_timer);
+    shader_select.measuring = -1;
+    free(shader_select.app_id);
+    shader_select.app_id = NULL;
+
+    if (shader_select.original_saved) {
+        if (shader_select.original)
+            mpv_set_property_string(hmpv, "glsl-shaders", shader_select.original);
+        mpv_free(shader_select.original);
+        shader_select.original = NULL;
+        shader_select.original_saved = false;
+    }
+}
+
+/* mHz, the rate the game is meant to run at, 0 if unknown. The current rate
+ * may be lowered by adaptive refresh or while hidden. */
+static int32_t shader_budget_refresh(void)
+{
+    if (output_mode_startup.refresh)
+        return output_mode_startup.refresh;
+
+    /* without wlr-output-management, the host display is the next best
+     * thing since mpv has to render every frame within its interval */
+    double fps = 0;
+    if (mpv_get_property(hmpv, "display-fps", MPV_FORMAT_DOUBLE, &fps) < 0)
+        return 0;
+    return fps * 1000;
+}
+
+static void choose_shader_chain(int index, int64_t cost)
+{
+    timer_disarm(&shader_measure_timer);
+    if (shader_select.measuring != index)
+        apply_shader_chain(index);
+    shader_select.measuring = -1;
+
+    logger("using shader chain %d for %s at %" PRId32 "x%" PRId32,
+            index + 1, shader_select.app_id, shader_select.width,
+            shader_select.height);
+
+    if (shader_cache && !shader_cache_set(shader_cache, shader_select.app_id,
+                shader_select.width, shader_select.height,
+                shader_chains[index], cost))
+        logger("failed to store the shader chain in the cache");
+}
+
+static void measure_shader_chain(int index)
+{
+    shader_select.measuring = index;
+    shader_select.tries = 0;
+    apply_shader_chain(index);
+    /* vo-passes averages over the last 64 frames, so wait until they were all
+     * rendered with the new chain */
+    timer_arm(&shader_measure_timer, monotonic_ms() + 2000);
+}
+
+static void shader_measure_expired(void)
+{
+    int index = shader_select.measuring;
+    if (index < 0)
+        return;
+
+    /* nothing is rendered while the window is hidden */
+    if (output_throttled) {
+        timer_arm(&shader_measure_timer, monotonic_ms() + 2000);
+        return;
+    }
+
+    int64_t cost = fresh_frame_render_time();
+    int32_t refresh = shader_budget_refresh();
+    if (!cost || !refresh) {
+        if (++shader_select.tries < 3) {
+            timer_arm(&shader_measure_timer, monotonic_ms() + 2000);
+            return;
+        }
+
+        /* not cached, so it's measured again next time */
+        logger("no render pass timings or refresh rate, keeping the first shader chain");
+        shader_select.measuring = -1;
+        if (index != 0)
+            apply_shader_chain(0);
+        return;
+    }
+
+    int64_t budget = INT64_C(1000000000000) / refresh * shader_budget / 100;
+    logger("shader chain %d costs %.2fms of a %.2fms budget", index + 1,
+            cost / 1e6, budget / 1e6);
+
+    if (cost <= budget) {
+        choose_shader_chain(index, cost);
+        return;
+    }
+
+    if (shader_select.cheapest < 0 || cost < shader_select.cheapest_cost) {
+        shader_select.cheapest = index;
+        shader_select.cheapest_cost = cost;
+    }
+
+    if (index + 1 < shader_chain_count) {
+        measure_shader_chain(index + 1);
+        return;
+    }
+
+    logger("no shader chain fits the budget, using the cheapest one");
+    choose_shader_chain(shader_select.cheapest, shader_select.cheapest_cost);
+}
+
+static void update_shader_selection(void)
+{
+    shader_select_pending = false;
+
+    struct wayland_toplevel_handle *tl = current_eligible_toplevel;
+    if (!tl || !tl->app_id.str || video_v.w <= 0 || video_v.h <= 0 ||
+            (current_app_profile && current_app_profile->sets_shaders)) {
+        if (shader_select.app_id)
+            restore_shaders();
+        return;
+    }
+
+    if (shader_select.app_id && video_v.w == shader_select.width &&
+            video_v.h == shader_select.height &&
+            strcmp(tl->app_id.str, shader_select.app_id) == 0)
+        return;
+
+    timer_disarm(&shader_measure_timer);
+    shader_select.measuring = -1;
+    free(shader_select.app_id);
+    shader_select.app_id = strdup(tl->app_id.str);
+    if (!shader_select.app_id)
+        return;
+    shader_select.width = video_v.w;
+    shader_select.height = video_v.h;
+
+    const char *cached = NULL;
+    if (shader_cache)
+        cached = shader_cache_get(shader_cache, shader_select.app_id,
+                shader_select.width, shader_select.height);
+
+    /* a cached chain which is no longer configured is measured again */
+    for (int i = 0; cached && i < shader_chain_count; i++) {
+        if (strcmp(shader_chains[i], cached) == 0) {
+            logger("using cached shader chain %d for %s at %" PRId32 "x%" PRId32,
+                    i + 1, shader_select.app_id, shader_select.width,
+                    shader_select.height);
+            apply_shader_chain(i);
+            return;
+        }
+    }
+
+    logger("measuring %d shader chains for %s at %" PRId32 "x%" PRId32,
+            shader_chain_count, shader_select.app_id, shader_select.width,
+            shader_select.height);
+    shader_select.cheapest = -1;
+    measure_shader_chain(0);
+}
+
+/* chains are separated by |, since script-opts can't contain commas and the
+ * shaders within a chain are already separated by : */
+static void init_shader_selection(char *chains, const char *cache_path)
+{
+    int count = 1;
+    for (char *c = chains; *c; c++)
+        count += *c == '|';
+
+    shader_chains = calloc(count, sizeof(*shader_chains));
+    if (!shader_chains)
+        return;
+
+    char *chain;
+    while ((chain = strsep(&chains, "|"))) {
+        shader_chains[shader_chain_count] = strdup(chain);
+        if (!shader_chains[shader_chain_count])
+            break;
+        shader_chain_count++;
+    }
+
+    /* an empty path keeps the choices for this session only */
+    if (cache_path) {
+        shader_cache = shader_cache_load(*cache_path != '\0' ?
+                cache_path : NULL);
+        return;
+    }
+
+    const char *dir = getenv("XDG_CACHE_HOME");
+    const char *suffix = "";
+    if (!dir || *dir == '\0') {
+        dir = getenv("HOME");
+        suffix = "/.cache";
+    }
+
+    char *path = NULL;
+    if (dir && *dir != '\0') {
+        if (asprintf(&path, "%s%s/mpvif-shader-cache", dir, suffix) < 0)
+            path = NULL;
+    }
+
+    /* without a cache directory, still don't measure again every time */
+    shader_cache = shader_cache_load(path);
+    free(path);
+}
+
+static void destroy_shader_selection(void)
+{
+    restore_shaders();
+
+    for (int i = 0; i < shader_chain_count; i++)
+        free(shader_chains[i]);
+    free(shader_chains);
+    shader_chains = NULL;
+    shader_chain_count = 0;
+
+    if (shader_cache)
+        shader_cache_destroy(shader_cache);
+    shader_cache = NULL;
+}
+
+static void apply_app_profile(struct app_profile *p)
+{
+    logger("applying profile %s for %s", p->profile, p->app_id);
+
+    /* async, so that a slow option (e.g. a shader which has to be compiled)
+     * doesn't hold up the event loop */
+    if (mpv_command_async(hmpv, 0,
+                (const char *[]){"apply-profile", p->profile, NULL}) < 0)
+        logger("failed to apply profile %s", p->profile);
+
+    if (!p->width && !p->refresh)
+        return;
+
+    /* when switching straight from another profile's mode, the current mode
+     * is that profile's, and the one saved for it is still the user's */
+    if (!app_profile_saved_mode.width) {
+        struct output_head *head = remote_output_head();
+        if (!head || !head->current_mode)
+            return;
+
+        app_profile_saved_mode = (struct output_mode_request){
+            .width = head->current_mode->width,
+            .height = head->current_mode->height,
+            .refresh = head->current_mode->refresh,
+        };
+    }
+    request_remote_output_mode(p->width, p->height, p->refresh);
+}
+
+/* next is the profile applied right after, or NULL */
+static void revert_app_profile(struct app_profile *p, struct app_profile *next)
+{
+    logger("reverting profile %s", p->profile);
+
+    if (mpv_command_async(hmpv, 0,
+                (const char *[]){"apply-profile", p->profile, "restore", NULL}) < 0)
+        logger("failed to revert profile %s", p->profile);
+
+    /* nothing is applied until the end of the loop iteration, so a next
+     * profile which changes the mode only overrides parts of this request,
+     * and keeps the saved mode for when it's reverted itself */
+    if (app_profile_saved_mode.width)
+        request_remote_output_mode(app_profile_saved_mode.width,
+                app_profile_saved_mode.height, app_profile_saved_mode.refresh);
+    if (!next || (!next->width && !next->refresh))
+        app_profile_saved_mode = (struct output_mode_request){0};
+}
+
+static void update_app_profile(void)
+{
+    app_profile_pending = false;
+
+    struct wayland_toplevel_handle *tl = current_eligible_toplevel;
+    struct app_profile *p, *match = NULL;
+    wl_list_for_each(p, &app_profile_list, link) {
+        if (tl && tl->app_id.str && strcmp(tl->app_id.str, p->app_id) == 0) {
+            match = p;
+            break;
+        }
+    }
+
+    if (match == current_app_profile)
+        return;
+
+    if (current_app_profile)
+        revert_app_profile(current_app_profile, match);
+    current_app_profile = match;
+    if (match)
+        apply_app_profile(match);
+}
+
+/* WxH, WxH@HZ or @HZ */
+static bool parse_output_mode(const char *str, struct app_profile *p)
+{
+    int32_t width = 0, height = 0;
+    double refresh = 0;
+    int n = 0;
+
+    if (*str != '@' && (sscanf(str, "%" SCNd32 "x%" SCNd32 "%n", &width,
+                    &height, &n) != 2 || width <= 0 || height <= 0))
+        return false;
+    str += n;
+
+    if (*str == '@') {
+        n = 0;
+        if (sscanf(str, "@%lf%n", &refresh, &n) != 1 || refresh <= 0 ||
+                refresh > 1000)
+            return false;
+        str += n;
+    }
+
+    if (*str != '\0' || (!width && !refresh))
+        return false;
+
+    p->width = width;
+    p->height = height;
+    p->refresh = refresh * 1000 + 0.5;
+    return true;
+}
+
+static mpv_node *node_map_get(mpv_node *node, const char *key)
+{
+    if (node->format != MPV_FORMAT_NODE_MAP)
+        return NULL;
+
+    mpv_node_list *list = node->u.list;
+    for (int i = 0; i < list->num; i++) {
+        if (strcmp(list->keys[i], key) == 0)
+            return &list->values[i];
+    }
+
+    return NULL;
+}
+
+/* checks the profile against profile-list, returns false if it can't be
+ * used */
+static bool check_app_profile(struct app_profile *p, mpv_node *profiles)
+{
+    mpv_node *profile = NULL;
+    for (int i = 0; profiles->format == MPV_FORMAT_NODE_ARRAY &&
+            i < profiles->u.list->num; i++) {
+        mpv_node *name = node_map_get(&profiles->u.list->values[i], "name");
+        if (name && name->format == MPV_FORMAT_STRING &&
+                strcmp(name->u.string, p->profile) == 0) {
+            profile = &profiles->u.list->values[i];
+            break;
+        }
+    }
+
+    if (!profile) {
+        logger("mpvif-profiles: there is no profile named %s", p->profile);
+        return false;
+    }
+
+    mpv_node *restore = node_map_get(profile, "profile-restore");
+    if (!restore || restore->format != MPV_FORMAT_STRING ||
+            (strcmp(restore->u.string, "copy") != 0 &&
+             strcmp(restore->u.string, "copy-equal") != 0)) {
+        logger("mpvif-profiles: profile %s can't be reverted, add profile-restore=copy to it", p->profile);
+        return false;
+    }
+
+    mpv_node *options = node_map_get(profile, "options");
+    for (int i = 0; options && options->format == MPV_FORMAT_NODE_ARRAY &&
+            i < options->u.list->num; i++) {
+        mpv_node *key = node_map_get(&options->u.list->values[i], "key");
+        mpv_node *value = node_map_get(&options->u.list->values[i], "value");
+        if (!key || key->format != MPV_FORMAT_STRING || !value ||
+                value->format != MPV_FORMAT_STRING)
+            continue;
+
+        if (strncmp(key->u.string, "glsl-shader", 11) == 0)
+            p->sets_shaders = true;
+
+        /* the plugin only reads script-opts at startup, so this one is taken
+         * from the profile instead */
+        const char *prefix = "mpvif-output-mode=";
+        if (strncmp(key->u.string, "script-opts", 11) == 0 &&
+                strncmp(value->u.string, prefix, strlen(prefix)) == 0 &&
+                !parse_output_mode(value->u.string + strlen(prefix), p)) {
+            logger("mpvif-profiles: invalid mpvif-output-mode in profile %s: %s (expected WxH, WxH@HZ or @HZ)",
+                    p->profile, value->u.string + strlen(prefix));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void destroy_app_profile(struct app_profile *p)
+{
+    free(p->app_id);
+    free(p->profile);
+    wl_list_remove(&p->link);
+    free(p);
+}
+
+/* APP_ID:PROFILE entries separated by | like the shader chains */
+static void init_app_profiles(char *entries)
+{
+    mpv_node profiles;
+    if (mpv_get_property(hmpv, "profile-list", MPV_FORMAT_NODE, &profiles) < 0) {
+        logger("failed to get the profile-list property, mpvif-profiles won't work");
+        return;
+    }
+
+    char *entry;
+    while ((entry = strsep(&entries, "|"))) {
+        char *sep = strrchr(entry, ':');
+        if (!sep || sep == entry || sep[1] == '\0') {
+            logger("invalid value for mpvif-profiles: %s (expected APP_ID:PROFILE)", entry);
+            continue;
+        }
+        *sep = '\0';
+
+        struct app_profile *p = calloc(1, sizeof(*p));
+        if (!p)
+            break;
+        wl_list_insert(app_profile_list.prev, &p->link);
+        p->app_id = strdup(entry);
+        p->profile = strdup(sep + 1);
+        if (!p->app_id || !p->profile || !check_app_profile(p, &profiles))
+            destroy_app_profile(p);
+    }
+
+    mpv_free_node_contents(&profiles);
+}
+
+static void destroy_app_profiles(void)
+{
+    /* the output mode is restored with the output manager */
+    if (current_app_profile)
+        mpv_command_async(hmpv, 0, (const char *[]){"apply-profile",
+                current_app_profile->profile, "restore", NULL});
+    current_app_profile = NULL;
+
+    struct app_profile *p, *p_tmp;
+    wl_list_for_each_safe(p, p_tmp, &app_profile_list, link)
+        destroy_app_profile(p);
+}
+
+static void destroy_output_manager(void)
+{
+    /* leave the remote output with the mode it had before */
+    struct output_head *head = remote_output_head();
+    if (output_mode_startup.width && head && head->current_mode &&
+            (head->current_mode->width != output_mode_startup.width ||
+             head->current_mode->height != output_mode_startup.height ||
+             abs(head->current_mode->refresh - output_mode_startup.refresh) >= 500)) {
+        if (output_configuration)
+            finish_output_configuration();
+        output_mode_wanted = output_mode_startup;
+        apply_remote_output_mode();
+        wl_display_roundtrip(display);
+        if (output_configuration)
+            finish_output_configuration();
+    }
+
+    struct output_head *h, *h_tmp;
+    wl_list_for_each_safe(h, h_tmp, &output_head_list, link)
+        destroy_output_head(h);
+
+    zwlr_output_manager_v1_stop(output_manager);
+    output_manager = NULL;
+}
+
+static void data_control_source_send(void *data,
+        struct ext_data_control_source_v1 *ext_data_control_source_v1,
+        const char *mime_type, int fd)
+{
+    struct wayland_data_control_source *ds = data;
+    const char *clip_data = NULL;
+    size_t clip_len = 0;
+    int64_t start = handler_begin();
+
+    for (size_t i = 0; i < sizeof(utf8_mimes) / sizeof(utf8_mimes[0]); i++) {
+        if (strcmp(mime_type, utf8_mimes[i]) == 0) {
+            clip_data = ds->text;
+            clip_len = ds->len;
+            break;
+        }
+    }
+
+    if (!clip_data) {
+        if (strcmp(mime_type, custom_mime_type_name) == 0) {
+            clip_data = custom_mime_type_data;
+            clip_len = strlen(custom_mime_type_data);
+        }
+    }
+
+    if (clip_data) {
+        if (write(fd, clip_data, clip_len) == -1)
+               logger("write() failed: %m");
+    }
+
+    /* the custom MIME type is only asked for by ourselves */
+    if (clip_data && clip_data == ds->text) {
+        counters.clipboard_out++;
+        counters.clipboard_out_bytes += clip_len;
+    }
+
+    close(fd);
+    handler_end(HANDLER_SOURCE_SEND, start, clip_len);
+}
+
+static void data_control_source_cancelled(void *data,
+        struct ext_data_control_source_v1 *ext_data_control_source_v1)
+{
+    struct wayland_data_control_source *ds = data;
+
+    destroy_data_control_source(ds);
+}
+
+static const struct ext_data_control_source_v1_listener data_control_source_listener = {
+    data_control_source_send,
+    data_control_source_cancelled,
+};
+
+static void data_control_offer_offer(void *data,
+        struct ext_data_control_offer_v1 *ext_data_control_offer_v1,
+        const char *mime_type)
+{
+    if (ext_data_control_offer_v1 != dc_offer) {
+        logger_at(LOG_LEVEL_WARN, "unexpected data offer offer event, shouldn't happen");
+        return;
+    }
+
+    if (dc_offer_is_our_own)
+        return;
+
+    if (strcmp(mime_type, custom_mime_type_name) == 0) {
+        dc_offer_is_our_own = true;
+        return;
+    }
+
+    /* prefer to use text/plain;charset=utf-8, applications hopefully offer this
+     * one first */
+    if (dc_offer_mime_idx == 0)
+        return;
+
+    for (size_t i = 0; i < sizeof(utf8_mimes) / sizeof(utf8_mimes[0]); i++) {
+        if (strcmp(mime_type, utf8_mimes[i]) == 0) {
+            dc_offer_mime_idx = i;
+            return;
+        }
+    }
+}
+
+static const struct ext_data_control_offer_v1_listener data_control_offer_listener = {
+    data_control_offer_offer,
+};
+
+static void data_control_device_data_offer(void *data,
+        struct ext_data_control_device_v1 *ext_data_control_device_v1,
+        struct ext_data_control_offer_v1 *id)
+{
+    if (!id)
+        return;
+
+    dc_offer = id;
+    ext_data_control_offer_v1_add_listener(id, &data_control_offer_listener,
+            NULL);
+}
+
+static void data_control_device_selection(void *data,
+        struct ext_data_control_device_v1 *ext_data_control_device_v1,
+        struct ext_data_control_offer_v1 *id)
+{
+    handle_selection(id, false);
+}
+
+static void data_control_device_finished(void *data,
+        struct ext_data_control_device_v1 *ext_data_control_device_v1)
+{
+    logger("compositor is finished with our data control device for some reason");
+    destroy_data_control_device();
+}
+
+static void data_control_device_primary_selection(void *data,
+        struct ext_data_control_device_v1 *ext_data_control_device_v1,
+        struct ext_data_control_offer_v1 *id)
+{
+    handle_selection(id, true);
+}
+
+static const struct ext_data_control_device_v1_listener data_control_device_listener = {
+    data_control_device_data_offer,
+    data_control_device_selection,
+    data_control_device_finished,
+    data_control_device_primary_selection,
+};
+
+static void pointer_warp_warp(void *data,
+        struct mpvif_pointer_warp_v1 *mpvif_pointer_warp_v1,
+        uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+        wl_fixed_t x, wl_fixed_t y)
+{
+    relay_pointer_warp(wl_fixed_to_int(x), wl_fixed_to_int(y));
+}
+
+static const struct mpvif_pointer_warp_v1_listener pointer_warp_listener = {
+    pointer_warp_warp,
+};
+
+static void pointer_constraints_state(void *data,
+        struct mpvif_pointer_constraints_v1 *mpvif_pointer_constraints_v1,
+        uint32_t state)
+{
+    remote_constraint_state = state;
+    update_auto_grab();
+}
+
+static const struct mpvif_pointer_constraints_v1_listener pointer_constraints_listener = {
+    pointer_constraints_state,
+};
+
+static void cursor_frame_transform(void *data,
+        struct ext_image_copy_capture_frame_v1 *ext_image_copy_capture_frame_v1,
+        uint32_t transform)
+{
+}
+
+static void cursor_frame_damage(void *data,
+        struct ext_image_copy_capture_frame_v1 *ext_image_copy_capture_frame_v1,
+        int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static void cursor_frame_presentation_time(void *data,
+        struct ext_image_copy_capture_frame_v1 *ext_image_copy_capture_frame_v1,
+        uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec)
+{
+}
+
+static void cursor_frame_ready(void *data,
+        struct ext_image_copy_capture_frame_v1 *ext_image_copy_capture_frame_v1)
+{
+    destroy_cursor_frame();
+
+    /* the hotspot becomes effective with the frame that follows it */
+    cursor.hotspot_x = cursor.pending_hotspot_x;
+    cursor.hotspot_y = cursor.pending_hotspot_y;
+
+    struct cursor_image *image = get_cursor_image(cursor.buffer_data,
+            cursor.buffer_width, cursor.buffer_height);
+    if (image)
+        cursor.image = image;
+    cursor_overlay_dirty = true;
+
+    /* the compositor holds on to this until the cursor changes */
+    create_cursor_frame();
+}
+
+static void cursor_frame_failed(void *data,
+        struct ext_image_copy_capture_frame_v1 *ext_image_copy_capture_frame_v1,
+        uint32_t reason)
+{
+    destroy_cursor_frame();
+
+    /* on buffer_constraints, a new frame is created after the new constraints
+     * are done. on stopped, the session will be stopped right after this. */
+    if (reason == EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_UNKNOWN)
+        logger("cursor capture failed, waiting for new buffer constraints");
+}
+
+static const struct ext_image_copy_capture_frame_v1_listener cursor_frame_listener = {
+    cursor_frame_transform,
+    cursor_frame_damage,
+    cursor_frame_presentation_time,
+    cursor_frame_ready,
+    cursor_frame_failed,
+};
+
+static void cursor_session_buffer_size(void *data,
+        struct ext_image_copy_capture_session_v1 *ext_image_copy_capture_session_v1,
+        uint32_t width, uint32_t height)
+{
+    cursor.width = width;
+    cursor.height = height;
+}
+
+static void cursor_session_shm_format(void *data,
+        struct ext_image_copy_capture_session_v1 *ext_image_copy_capture_session_v1,
+        uint32_t format)
+{
+    /* the same layout as the bgra format of overlay-add */
+    if (format == WL_SHM_FORMAT_ARGB8888)
+        cursor.pending_shm_format_ok = true;
+}
+
+static void cursor_session_dmabuf_device(void *data,
+        struct ext_image_copy_capture_session_v1 *ext_image_copy_capture_session_v1,
+        struct wl_array *device)
+{
+}
+
+static void cursor_session_dmabuf_format(void *data,
+        struct ext_image_copy_capture_session_v1 *ext_image_copy_capture_session_v1,
+        uint32_t format, struct wl_array *modifiers)
+{
+}
+
+static void cursor_session_done(void *data,
+        struct ext_image_copy_capture_session_v1 *ext_image_copy_capture_session_v1)
+{
+    cursor.shm_format_ok = cursor.pending_shm_format_ok;
+    cursor.pending_shm_format_ok = false;
+
+    if (!cursor.shm_format_ok) {
+        logger("compositor doesn't offer ARGB8888 shm buffers for the cursor, cursor image synchronization won't work");
+        return;
+    }
+
+    if (cursor.width <= 0 || cursor.height <= 0)
+        return;
+
+    if (cursor.width != cursor.buffer_width ||
+            cursor.height != cursor.buffer_height) {
+        if (cursor.frame)
+            destroy_cursor_frame();
+        if (!allocate_cursor_buffer())
+            return;
+    }
+
+    if (!cursor.frame)
+        create_cursor_frame();
+}
+
+static void cursor_session_stopped(void *data,
+        struct ext_image_copy_capture_session_v1 *ext_image_copy_capture_session_v1)
+{
+    logger("compositor stopped our cursor capture session");
+    destroy_cursor_capture();
+}
+
+static const struct ext_image_copy_capture_session_v1_listener cursor_session_listener = {
+    cursor_session_buffer_size,
+    cursor_session_shm_format,
+    cursor_session_dmabuf_device,
+    cursor_session_dmabuf_format,
+    cursor_session_done,
+    cursor_session_stopped,
+};
+
+static void cursor_session_enter(void *data,
+        struct ext_image_copy_capture_cursor_session_v1 *ext_image_copy_capture_cursor_session_v1)
+{
+    cursor.entered = true;
+    cursor_overlay_dirty = true;
+}
+
+static void cursor_session_leave(void *data,
+        struct ext_image_copy_capture_cursor_session_v1 *ext_image_copy_capture_cursor_session_v1)
+{
+    cursor.entered = false;
+    cursor_overlay_dirty = true;
+}
+
+static void cursor_session_position(void *data,
+        struct ext_image_copy_capture_cursor_session_v1 *ext_image_copy_capture_cursor_session_v1,
+        int32_t x, int32_t y)
+{
+    /* the host pointer position is used instead, it's what the remote position
+     * will become anyway and it doesn't lag behind */
+}
+
+static void cursor_session_hotspot(void *data,
+        struct ext_image_copy_capture_cursor_session_v1 *ext_image_copy_capture_cursor_session_v1,
+        int32_t x, int32_t y)
+{
+    cursor.pending_hotspot_x = x;
+    cursor.pending_hotspot_y = y;
+}
+
+static const struct ext_image_copy_capture_cursor_session_v1_listener cursor_cursor_session_listener = {
+    cursor_session_enter,
+    cursor_session_leave,
+    cursor_session_position,
+    cursor_session_hotspot,
+};
+
+static void capture_frame_transform(void *data,
+        struct ext_image_copy_capture_frame_v1 *ext_image_copy_capture_frame_v1,
+        uint32_t transform)
+{
+}
+
+static void capture_frame_damage(void *data,
+        struct ext_image_copy_capture_frame_v1 *ext_image_copy_capture_frame_v1,
+        int32_t x, int32_t y, int32_t width, int32_t height)
+{
+    damage_add(&capture.frame_damage, x, y, width, height);
+}
+
+static void capture_frame_presentation_time(void *data,
+        struct ext_image_copy_capture_frame_v1 *ext_image_copy_capture_frame_v1,
+        uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec)
+{
+    uint64_t sec = (uint64_t)tv_sec_hi << 32 | tv_sec_lo;
+    capture.frame_time = sec * 1000000 + tv_nsec / 1000;
+}
+
+static void capture_frame_ready(void *data,
+        struct ext_image_copy_capture_frame_v1 *ext_image_copy_capture_frame_v1)
+{
+    int slot = capture.frame_slot;
+    ext_image_copy_capture_frame_v1_destroy(capture.frame);
+    capture.frame = NULL;
+    capture.frame_slot = -1;
+
+    /* what the compositor had to write into the slot */
+    struct damage written = capture.buffer_damage;
+    damage_add_damage(&written, &capture.frame_damage);
+    capture_stats.last_copied_bytes = damage_area(&written) * 4;
+    capture_stats.copied_bytes += capture_stats.last_copied_bytes;
+    capture_stats.dirty = true;
+
+    /* the slot is up to date now either way */
+    damage_clear(&capture.slot_damage[slot]);
+
+    if (damage_is_empty(&capture.frame_damage)) {
+        /* the same image as the latest published frame */
+        frame_ring_abort_write(capture.ring, slot);
+        capture_stats.skipped_frames++;
+    } else if (is_duplicate_frame(slot)) {
+        /* the damage didn't change anything, so the slot still matches the
+         * latest published frame and the other slots don't need it either */
+        frame_ring_abort_write(capture.ring, slot);
+        capture_stats.duplicate_frames++;
+    } else {
+        for (int i = 0; i < FRAME_RING_SLOTS; i++) {
+            if (i != slot)
+                damage_add_damage(&capture.slot_damage[i],
+                        &capture.frame_damage);
+        }
+        /* the time the frame was copied if the compositor doesn't say */
+        frame_ring_publish(capture.ring, slot, capture.frame_time ?
+                capture.frame_time : (uint64_t)monotonic_ms() * 1000);
+        capture_stats.frames++;
+
+        uint64_t *tmp = capture.tile_hashes;
+        capture.tile_hashes = capture.new_tile_hashes;
+        capture.new_tile_hashes = tmp;
+        capture.tile_hashes_valid = capture.tile_hashes != NULL;
+    }
+
+    if (should_create_capture_frame())
+        create_capture_frame();
+}
+
+static void capture_frame_failed(void *data,
+        struct ext_image_copy_capture_frame_v1 *ext_image_copy_capture_frame_v1,
+        uint32_t reason)
+{
+    destroy_capture_frame();
+
+    /* same as for the cursor, except that an unknown failure is retried later
+     * since frames are captured continuously */
+    if (reason == EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_UNKNOWN) {
+        logger("output capture failed, retrying in a second");
+        timer_arm(&capture_retry_timer, monotonic_ms() + 1000);
+    }
+}
+
+static const struct ext_image_copy_capture_frame_v1_listener capture_frame_listener = {
+    capture_frame_transform,
+    capture_frame_damage,
+    capture_frame_presentation_time,
+    capture_frame_ready,
+    capture_frame_failed,
+};
+
+static void capture_session_buffer_size(void *data,
+        struct ext_image_copy_capture_session_v1 *ext_image_copy_capture_session_v1,
+        uint32_t width, uint32_t height)
+{
+    capture.width = width;
+    capture.height = height;
+}
+
+static void capture_session_shm_format(void *data,
+        struct ext_image_copy_capture_session_v1 *ext_image_copy_capture_session_v1,
+        uint32_t format)
+{
+    if (format == WL_SHM_FORMAT_XRGB8888)
+        capture.pending_xrgb_ok = true;
+    else if (format == WL_SHM_FORMAT_ARGB8888)
+        capture.pending_argb_ok = true;
+}
+
+static void capture_session_dmabuf_device(void *data,
+        struct ext_image_copy_capture_session_v1 *ext_image_copy_capture_session_v1,
+        struct wl_array *device)
+{
+}
+
+static void capture_session_dmabuf_format(void *data,
+        struct ext_image_copy_capture_session_v1 *ext_image_copy_capture_session_v1,
+        uint32_t format, struct wl_array *modifiers)
+{
+}
+
+static void capture_session_done(void *data,
+        struct ext_image_copy_capture_session_v1 *ext_image_copy_capture_session_v1)
+{
+    capture.xrgb_ok = capture.pending_xrgb_ok;
+    capture.argb_ok = capture.pending_argb_ok;
+    capture.pending_xrgb_ok = false;
+    capture.pending_argb_ok = false;
+
+    if (!capture.xrgb_ok && !capture.argb_ok) {
+        logger("compositor doesn't offer XRGB8888 or ARGB8888 shm buffers for the output, the mpvif:// stream won't work");
+        return;
+    }
+
+    if (capture.width <= 0 || capture.height <= 0)
+        return;
+
+    uint32_t format = capture.xrgb_ok ? WL_SHM_FORMAT_XRGB8888 :
+        WL_SHM_FORMAT_ARGB8888;
+
+    if (capture.width != capture.buffer_width ||
+            capture.height != capture.buffer_height ||
+            format != capture.buffer_format) {
+        if (capture.frame)
+            destroy_capture_frame();
+        if (capture.ring)
+            destroy_capture_ring();
+        if (!allocate_capture_ring())
+            return;
+    }
+
+    if (should_create_capture_frame())
+        create_capture_frame();
+}
+
+static void capture_session_stopped(void *data,
+        struct ext_image_copy_capture_session_v1 *ext_image_copy_capture_session_v1)
+{
+    logger("compositor stopped our output capture session");
+    destroy_output_capture();
+}
+
+static const struct ext_image_copy_capture_session_v1_listener capture_session_listener = {
+    capture_session_buffer_size,
+    capture_session_shm_format,
+    capture_session_dmabuf_device,
+    capture_session_dmabuf_format,
+    capture_session_done,
+    capture_session_stopped,
+};
+
+static void output_geometry(void *data, struct wl_output *wl_output,
+        int32_t x, int32_t y, int32_t physical_width, int32_t physical_height,
+        int32_t subpixel, const char *make, const char *model,
+        int32_t transform)
+{
+}
+
+static void output_mode(void *data, struct wl_output *wl_output,
+        uint32_t flags, int32_t width, int32_t height, int32_t refresh)
+{
+}
+
+static void output_done(void *data, struct wl_output *wl_output)
+{
+}
+
+static void output_scale(void *data, struct wl_output *wl_output,
+        int32_t scale)
+{
+}
+
+static void output_name(void *data, struct wl_output *wl_output,
+        const char *name)
+{
+    struct wayland_output *o = data;
+
+    if (strcmp(name, remote_output_name) == 0) {
+        remote_output = o;
+
+        if (should_create_virtual_pointer())
+            create_virtual_pointer();
+
+        if (should_create_pointer_warp())
+            create_pointer_warp();
+
+        if (should_create_cursor_capture())
+            create_cursor_capture();
+
+        if (should_create_output_capture())
+            create_output_capture();
+    }
+}
+
+static void output_description(void *data, struct wl_output *wl_output,
+        const char *description)
+{
+}
+
+static const struct wl_output_listener output_listener = {
+    output_geometry,
+    output_mode,
+    output_done,
+    output_scale,
+    output_name,
+    output_description,
+};
+
+static void seat_capabilities(void *data, struct wl_seat *wl_seat,
+        uint32_t capabilities)
+{
+    struct wayland_seat *s = data;
+
+    s->capabilities = capabilities;
+
+    if (s != remote_seat)
+        return;
+
+    /* on a headless compositor, the pointer capability comes and goes with our
+     * own virtual pointer */
+    if (!(capabilities & WL_SEAT_CAPABILITY_POINTER) && cursor.cursor_session)
+        destroy_cursor_capture();
+
+    if (should_create_cursor_capture())
+        create_cursor_capture();
+}
+
+static void seat_name(void *data, struct wl_seat *wl_seat,
+        const char *name)
+{
+    struct wayland_seat *s = data;
 
     if (strcmp(name, remote_seat_name) == 0) {
         remote_seat = s;
 
-        if (should_create_virtual_pointer())
-            create_virtual_pointer();
+        if (should_create_virtual_pointer())
+            create_virtual_pointer();
+
+        if (should_create_data_control_device())
+            create_data_control_device();
+
+        if (should_create_pointer_warp())
+            create_pointer_warp();
+
+        if (should_create_pointer_constraints())
+            create_pointer_constraints();
+
+        if (should_create_cursor_capture())
+            create_cursor_capture();
+    }
+}
+
+static const struct wl_seat_listener seat_listener = {
+    seat_capabilities,
+    seat_name,
+};
+
+static void registry_global(void *data, struct wl_registry *wl_registry,
+        uint32_t name, const char *interface, uint32_t version)
+{
+    if (strcmp(interface, zwlr_virtual_pointer_manager_v1_interface.name) == 0) {
+        virtual_pointer_manager = wl_registry_bind(registry, name,
+                &zwlr_virtual_pointer_manager_v1_interface, 2);
+    }
+
+    if (strcmp(interface, zwlr_foreign_toplevel_manager_v1_interface.name) == 0) {
+        toplevel_manager = wl_registry_bind(registry, name,
+                &zwlr_foreign_toplevel_manager_v1_interface, 3);
+        zwlr_foreign_toplevel_manager_v1_add_listener(toplevel_manager,
+                &toplevel_manager_listener, NULL);
+    }
+
+    if (strcmp(interface, ext_data_control_manager_v1_interface.name) == 0) {
+        data_control_manager = wl_registry_bind(registry, name,
+                &ext_data_control_manager_v1_interface, 1);
+    }
+
+    if (strcmp(interface, mpvif_pointer_warp_manager_v1_interface.name) == 0) {
+        pointer_warp_manager = wl_registry_bind(registry, name,
+                &mpvif_pointer_warp_manager_v1_interface, 1);
+    }
+
+    if (strcmp(interface, mpvif_pointer_constraints_manager_v1_interface.name) == 0) {
+        pointer_constraints_manager = wl_registry_bind(registry, name,
+                &mpvif_pointer_constraints_manager_v1_interface, 1);
+    }
+
+    if (strcmp(interface, wl_shm_interface.name) == 0)
+        shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+
+    if (strcmp(interface, zwlr_output_manager_v1_interface.name) == 0 &&
+            (adaptive_refresh_enabled || integer_scale || hidden_refresh ||
+             shader_chain_count || !wl_list_empty(&app_profile_list))) {
+        output_manager = wl_registry_bind(registry, name,
+                &zwlr_output_manager_v1_interface, MIN(version, 4));
+        zwlr_output_manager_v1_add_listener(output_manager,
+                &output_manager_listener, NULL);
+    }
+
+    if (strcmp(interface, ext_output_image_capture_source_manager_v1_interface.name) == 0) {
+        output_capture_source_manager = wl_registry_bind(registry, name,
+                &ext_output_image_capture_source_manager_v1_interface, 1);
+    }
+
+    if (strcmp(interface, ext_image_copy_capture_manager_v1_interface.name) == 0) {
+        copy_capture_manager = wl_registry_bind(registry, name,
+                &ext_image_copy_capture_manager_v1_interface, 1);
+    }
+
+    if (strcmp(interface, wl_output_interface.name) == 0) {
+        struct wayland_output *o = calloc(1, sizeof(*o));
+        if (!o)
+            return;
+
+        o->obj = wl_registry_bind(registry, name, &wl_output_interface, 4);
+        o->global_id = name;
+        wl_list_insert(&wayland_output_list, &o->link);
+        wl_output_add_listener(o->obj, &output_listener, o);
+    }
+
+    if (strcmp(interface, wl_seat_interface.name) == 0) {
+        struct wayland_seat *s = calloc(1, sizeof(*s));
+        if (!s)
+            return;
+
+        s->obj = wl_registry_bind(registry, name, &wl_seat_interface, 8);
+        s->global_id = name;
+        wl_list_insert(&wayland_seat_list, &s->link);
+        wl_seat_add_listener(s->obj, &seat_listener, s);
+    }
+}
+
+static void registry_global_remove(void *data, struct wl_registry *wl_registry,
+        uint32_t name)
+{
+    struct wayland_output *o, *o_tmp;
+    wl_list_for_each_safe(o, o_tmp, &wayland_output_list, link) {
+        if (o->global_id == name) {
+            destroy_output(o);
+            return;
+        }
+    }
+
+    struct wayland_seat *s, *s_tmp;
+    wl_list_for_each_safe(s, s_tmp, &wayland_seat_list, link) {
+        if (s->global_id == name) {
+            destroy_seat(s);
+            return;
+        }
+    }
+}
+
+static const struct wl_registry_listener registry_listener = {
+    registry_global,
+    registry_global_remove,
+};
+
+static void print_log_message(const char *text, bool sync)
+{
+    char log_buf[LOG_RING_MESSAGE_SIZE + 64];
+    snprintf(log_buf, sizeof(log_buf), "%s: %s", mpv_client_name(hmpv), text);
+
+    const char *args[] = {"print-text", log_buf, NULL};
+    if (sync)
+        mpv_command(hmpv, args);
+    else
+        mpv_command_async(hmpv, 0, args);
+}
+
+static void log_message_v(int level, const char *fmt, va_list ap,
+        bool plugin)
+{
+    struct log_ring *ring = atomic_load(&log_ring);
+    if (!ring) {
+        char text[LOG_RING_MESSAGE_SIZE];
+        vsnprintf(text, sizeof(text), fmt, ap);
+        print_log_message(text, true);
+        return;
+    }
+
+    bool queued = log_ring_push(ring, level, fmt, ap);
+
+    /* the plugin thread drains the ring before it polls again */
+    if (queued && !plugin)
+        mpv_wakeup(hmpv);
+}
+
+/* use logger() or logger_at(), which skip disabled levels */
+static void log_message(int level, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+
+    if (pthread_equal(pthread_self(), plugin_thread)) {
+        log_message_v(level, fmt, ap, true);
+        va_end(ap);
+        return;
+    }
+
+    /* checked again after announcing the write, so that either the plugin
+     * thread sees this writer or this writer sees the shutdown */
+    atomic_fetch_add(&log_writers, 1);
+    if (!atomic_load(&log_shutdown))
+        log_message_v(level, fmt, ap, false);
+    atomic_fetch_sub(&log_writers, 1);
+    va_end(ap);
+}
+
+static void flush_log_counts(bool sync)
+{
+    char text[64];
+
+    if (log_repeats) {
+        snprintf(text, sizeof(text), "last message repeated %" PRIu64 " times",
+                log_repeats);
+        print_log_message(text, sync);
+        log_repeats = 0;
+    }
+
+    if (log_suppressed) {
+        snprintf(text, sizeof(text), "%" PRIu64 " messages suppressed",
+                log_suppressed);
+        print_log_message(text, sync);
+        log_suppressed = 0;
+    }
+}
+
+static void log_expired(void)
+{
+    flush_log_counts(false);
+}
+
+static void drain_log(bool sync)
+{
+    char text[LOG_RING_MESSAGE_SIZE];
+    int level;
+
+    int64_t now = monotonic_ms();
+    if (now - log_window_start >= 1000) {
+        log_window_start = now;
+        log_budget = LOG_BURST;
+    }
+
+    while (log_ring_pop(log_ring, &level, text)) {
+        if (log_last_valid && strcmp(text, log_last) == 0) {
+            log_repeats++;
+        } else if (log_budget > 0) {
+            if (log_repeats)
+                flush_log_counts(sync);
+            print_log_message(text, sync);
+            memcpy(log_last, text, sizeof(log_last));
+            log_last_valid = true;
+            log_budget--;
+        } else {
+            log_suppressed++;
+        }
+    }
+
+    /* the ring was full */
+    log_suppressed += log_ring_take_dropped(log_ring);
+
+    if (sync)
+        flush_log_counts(true);
+    else if ((log_repeats || log_suppressed) && !log_timer.armed)
+        timer_arm(&log_timer, now + 1000);
+}
+
+/* the client's entry in a msg-level value like "all=v,mpvif_plugin=debug",
+ * falling back to the one for all */
+static void pchg_msg_level(const char *value)
+{
+    static const char *const names[] = {
+        "no", "fatal", "error", "warn", "info", "status", "v", "debug", "trace",
+    };
+    static const int levels[] = {
+        -1, LOG_LEVEL_ERROR, LOG_LEVEL_ERROR, LOG_LEVEL_WARN, LOG_LEVEL_INFO,
+        LOG_LEVEL_INFO, LOG_LEVEL_V, LOG_LEVEL_DEBUG, LOG_LEVEL_TRACE,
+    };
+    const char *client = mpv_client_name(hmpv);
+    int all = LOG_LEVEL_INFO;
+    int own = -2;
+
+    const char *entry = value;
+    while (entry && *entry) {
+        const char *end = strchr(entry, ',');
+        size_t len = end ? (size_t)(end - entry) : strlen(entry);
+        const char *eq = memchr(entry, '=', len);
+
+        if (eq) {
+            size_t key_len = eq - entry;
+            size_t level_len = len - key_len - 1;
+            for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+                if (strlen(names[i]) != level_len ||
+                        strncmp(eq + 1, names[i], level_len) != 0)
+                    continue;
+                if (key_len == 3 && strncmp(entry, "all", 3) == 0)
+                    all = levels[i];
+                else if (key_len == strlen(client) &&
+                        strncmp(entry, client, key_len) == 0)
+                    own = levels[i];
+                break;
+            }
+        }
+
+        entry = end ? end + 1 : NULL;
+    }
+
+    log_level = own != -2 ? own : all;
+}
+
+static int timestamp(void)
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    int ms = 1000 * tp.tv_sec + tp.tv_nsec / 1000000;
+    return ms;
+}
+
+static int64_t monotonic_ms(void)
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (int64_t)tp.tv_sec * 1000 + tp.tv_nsec / 1000000;
+}
+
+static int64_t monotonic_ns(void)
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (int64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
+static void timer_arm(struct timer *t, int64_t deadline)
+{
+    if (t->armed)
+        wl_list_remove(&t->link);
+    t->deadline = deadline;
+    t->armed = true;
+    wl_list_insert(&timer_list, &t->link);
+}
+
+static void timer_disarm(struct timer *t)
+{
+    if (!t->armed)
+        return;
+    wl_list_remove(&t->link);
+    t->armed = false;
+}
+
+static int timer_poll_timeout(void)
+{
+    if (wl_list_empty(&timer_list))
+        return -1;
+
+    int64_t now = monotonic_ms();
+    int64_t timeout = INT32_MAX;
+
+    struct timer *t;
+    wl_list_for_each(t, &timer_list, link)
+        timeout = MIN(timeout, t->deadline - now);
+
+    return MAX(timeout, 0);
+}
+
+static void run_timers(void)
+{
+    int64_t now = monotonic_ms();
+
+    /* callbacks may re-arm their own or other timers, so start over after
+     * each one */
+    bool expired = true;
+    while (expired) {
+        expired = false;
+
+        struct timer *t;
+        wl_list_for_each(t, &timer_list, link) {
+            if (t->deadline <= now) {
+                timer_disarm(t);
+                t->callback();
+                expired = true;
+                break;
+            }
+        }
+    }
+}
+
+static bool str_is_set(const char *str)
+{
+    return str && *str != '\0';
+}
+
+/*
+ * Options specific to the plugin are read from --script-opts with an "mpvif-"
+ * prefix, e.g. --script-opts=mpvif-cursor=yes. They're read once at startup.
+ */
+static char *script_opt(const char *name)
+{
+    char key[128];
+    snprintf(key, sizeof(key), "mpvif-%s", name);
+
+    mpv_node node;
+    if (mpv_get_property(hmpv, "script-opts", MPV_FORMAT_NODE, &node) < 0)
+        return NULL;
+
+    char *value = NULL;
+    if (node.format == MPV_FORMAT_NODE_MAP) {
+        mpv_node_list *list = node.u.list;
+        for (int i = 0; i < list->num; i++) {
+            if (strcmp(list->keys[i], key) == 0 &&
+                    list->values[i].format == MPV_FORMAT_STRING) {
+                value = strdup(list->values[i].u.string);
+                break;
+            }
+        }
+    }
+
+    mpv_free_node_contents(&node);
+    return value;
+}
+
+static int script_opt_int(const char *name, int default_value)
+{
+    char *value = script_opt(name);
+    if (!value)
+        return default_value;
+
+    char *end;
+    long ret = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || ret < INT_MIN || ret > INT_MAX) {
+        logger("invalid value for mpvif-%s: %s (expected an integer)", name, value);
+        ret = default_value;
+    }
+
+    free(value);
+    return ret;
+}
+
+static bool script_opt_flag(const char *name, bool default_value)
+{
+    char *value = script_opt(name);
+    if (!value)
+        return default_value;
+
+    bool ret = default_value;
+    if (strcmp(value, "yes") == 0)
+        ret = true;
+    else if (strcmp(value, "no") == 0)
+        ret = false;
+    else
+        logger("invalid value for mpvif-%s: %s (expected yes or no)", name, value);
+
+    free(value);
+    return ret;
+}
+
+struct mouse_pos_values mouse_node_get_values(mpv_node *node)
+{
+    struct mouse_pos_values mouse_v = {0};
+
+    mpv_node_list *list = node->u.list;
+    for (int i = 0; i < list->num; i++) {
+        char *key = list->keys[i];
+        mpv_node *value = &list->values[i];
+
+        if (value->format == MPV_FORMAT_FLAG && strcmp(key, "hover") == 0)
+            mouse_v.hover = value->u.flag;
+
+        if (value->format != MPV_FORMAT_INT64)
+            continue;
+
+        if (strcmp(key, "x") == 0)
+            mouse_v.x = value->u.int64;
+        else if (strcmp(key, "y") == 0)
+            mouse_v.y = value->u.int64;
+    }
+
+    return mouse_v;
+}
+
+void osd_node_get_values(mpv_node *node)
+{
+    mpv_node_list *list = node->u.list;
+    for (int i = 0; i < list->num; i++) {
+        char *key = list->keys[i];
+        mpv_node *value = &list->values[i];
+
+        if (value->format != MPV_FORMAT_INT64)
+            continue;
+
+        if (strcmp(key, "ml") == 0)
+            osd_v.ml = value->u.int64;
+        else if (strcmp(key, "mr") == 0)
+            osd_v.mr = value->u.int64;
+        else if (strcmp(key, "mt") == 0)
+            osd_v.mt = value->u.int64;
+        else if (strcmp(key, "mb") == 0)
+            osd_v.mb = value->u.int64;
+        else if (strcmp(key, "w") == 0)
+            osd_v.w = value->u.int64;
+        else if (strcmp(key, "h") == 0)
+            osd_v.h = value->u.int64;
+    }
+}
+
+void video_node_get_values(mpv_node *node)
+{
+    video_v.crop_x = video_v.crop_y = video_v.crop_w = video_v.crop_h = 0;
+
+    mpv_node_list *list = node->u.list;
+    for (int i = 0; i < list->num; i++) {
+        char *key = list->keys[i];
+        mpv_node *value = &list->values[i];
+
+        if (value->format != MPV_FORMAT_INT64)
+            continue;
+
+        if (strcmp(key, "w") == 0)
+            video_v.w = value->u.int64;
+        else if (strcmp(key, "h") == 0)
+            video_v.h = value->u.int64;
+        else if (strcmp(key, "crop-x") == 0)
+            video_v.crop_x = value->u.int64;
+        else if (strcmp(key, "crop-y") == 0)
+            video_v.crop_y = value->u.int64;
+        else if (strcmp(key, "crop-w") == 0)
+            video_v.crop_w = value->u.int64;
+        else if (strcmp(key, "crop-h") == 0)
+            video_v.crop_h = value->u.int64;
+    }
+
+    /* older mpv versions don't report the crop */
+    if (video_v.crop_w <= 0 || video_v.crop_h <= 0) {
+        video_v.crop_x = video_v.crop_y = 0;
+        video_v.crop_w = video_v.w;
+        video_v.crop_h = video_v.h;
+    }
+}
+
+static void send_media_title(const char *title)
+{
+    int64_t start = handler_begin();
+
+    if (title != media_title)
+        snprintf(media_title, sizeof(media_title), "%s", title);
+    media_title_set = true;
+    media_title_last_set = monotonic_ms();
+
+    char *title_ptr = media_title;
+    if (mpv_set_property_async(hmpv, 0, "force-media-title",
+                MPV_FORMAT_STRING, &title_ptr) < 0)
+        logger("failed to set the force-media-title property");
+
+    handler_end(HANDLER_TITLE, start, strlen(media_title));
+}
+
+static void title_timer_expired(void)
+{
+    if (!media_title_pending)
+        return;
+    media_title_pending = false;
+    send_media_title(pending_media_title);
+}
+
+/*
+ * The title is only sent when it differs from the one mpv already has, and at
+ * most title_rate_limit times per second. Updates in between are coalesced and
+ * only the latest one is sent when the interval has passed.
+ */
+static void update_media_title(const char *title)
+{
+    if (media_title_set && strcmp(title, media_title) == 0) {
+        /* a pending update would be undone by this one */
+        media_title_pending = false;
+        timer_disarm(&title_timer);
+        return;
+    }
+
+    int64_t next = media_title_last_set +
+        (title_rate_limit > 0 ? 1000 / title_rate_limit : 0);
+
+    if (!media_title_set || title_rate_limit <= 0 || monotonic_ms() >= next) {
+        media_title_pending = false;
+        timer_disarm(&title_timer);
+        send_media_title(title);
+        return;
+    }
+
+    snprintf(pending_media_title, sizeof(pending_media_title), "%s", title);
+    media_title_pending = true;
+    if (!title_timer.armed)
+        timer_arm(&title_timer, next);
+}
+
+static void set_fullscreen_title(void)
+{
+    char title[sizeof(media_title)];
+    /* in lite mode, a window moved onto the remote output has no title until
+     * it sets one again */
+    if (current_eligible_toplevel->title.str)
+        snprintf(title, sizeof(title), "[%s] %s [%s %s %s]",
+                current_eligible_toplevel->app_id.str,
+                current_eligible_toplevel->title.str,
+                remote_display_name, remote_output_name, remote_seat_name);
+    else
+        snprintf(title, sizeof(title), "[%s] [%s %s %s]",
+                current_eligible_toplevel->app_id.str,
+                remote_display_name, remote_output_name, remote_seat_name);
+    update_media_title(title);
+}
+
+static void set_generic_title(void)
+{
+    char title[sizeof(media_title)];
+    snprintf(title, sizeof(title), "Remote desktop [%s %s %s]",
+            remote_display_name, remote_output_name, remote_seat_name);
+    update_media_title(title);
+}
+
+static void unset_title(void)
+{
+    timer_disarm(&title_timer);
+    mpv_set_property_string(hmpv, "force-media-title", "");
+}
+
+static bool is_eligible_toplevel(struct wayland_toplevel_handle *tl)
+{
+    /* FIXME: sway/wlroots bug where output_leave is sent after sending state
+     * with fullscreen enum when the window is also set to floating */
+    return (tl->title.str || tl->title_dropped) && tl->app_id.str &&
+        tl->fullscreen;
+}
+
+static bool should_create_virtual_pointer(void)
+{
+    return !virtual_pointer && remote_output && remote_seat &&
+        input_forwarding_enabled;
+}
+
+static void observe_mouse_pos(void)
+{
+    if (mpv_observe_property(hmpv, mouse_pos_reply_userdata, "mouse-pos", MPV_FORMAT_NODE) != 0)
+        logger("failed to observe the mouse-pos property");
+    mouse_pos_observed = true;
+    cursor_overlay_dirty = true;
+}
+
+static void unobserve_mouse_pos(void)
+{
+    if (mpv_unobserve_property(hmpv, mouse_pos_reply_userdata) < 0)
+        logger("failed to unobserve the mouse-pos property");
+    mouse_pos_observed = false;
+    cursor_overlay_dirty = true;
+}
+
+/*
+ * The virtual pointer is kept while the cursor is grabbed and only the
+ * absolute motion stops, so that it's ready as soon as the grab is released
+ * and the seat doesn't lose its pointer capability in between.
+ */
+static void create_virtual_pointer(void)
+{
+    virtual_pointer =
+        zwlr_virtual_pointer_manager_v1_create_virtual_pointer_with_output(
+                virtual_pointer_manager, remote_seat->obj, remote_output->obj);
+    counters.virtual_pointers++;
+    if (!force_grab_cursor_enabled)
+        observe_mouse_pos();
+}
+
+static void destroy_virtual_pointer(void)
+{
+    zwlr_virtual_pointer_v1_destroy(virtual_pointer);
+    virtual_pointer = NULL;
+    if (mouse_pos_observed)
+        unobserve_mouse_pos();
+}
+
+static void destroy_toplevel_handle(struct wayland_toplevel_handle *tl)
+{
+    if (current_eligible_toplevel == tl) {
+        current_eligible_toplevel = NULL;
+        set_generic_title();
+        app_profile_pending = true;
+        shader_select_pending = true;
+    }
+
+    zwlr_foreign_toplevel_handle_v1_destroy(tl->obj);
+    toplevel_string_free(&tl->title);
+    toplevel_string_free(&tl->app_id);
+    wl_list_remove(&tl->link);
+    free(tl);
+}
+
+static bool should_create_data_control_device(void)
+{
+    return !data_control_device && data_control_manager && remote_seat &&
+        input_forwarding_enabled;
+}
+
+static void create_data_control_device(void)
+{
+    data_control_device = ext_data_control_manager_v1_get_data_device(
+            data_control_manager, remote_seat->obj);
+    ext_data_control_device_v1_add_listener(data_control_device,
+            &data_control_device_listener, NULL);
+    counters.data_control_devices++;
+    if (mpv_observe_property(hmpv, clipboard_text_reply_userdata,
+                "clipboard/text", MPV_FORMAT_STRING) != 0)
+        logger("failed to observe the clipboard/text property");
+    if (mpv_observe_property(hmpv, clipboard_text_primary_reply_userdata,
+                "clipboard/text-primary", MPV_FORMAT_STRING) != 0)
+        logger("failed to observe the clipboard/text-primary property");
+}
+
+static void destroy_data_control_device(void)
+{
+    ext_data_control_device_v1_destroy(data_control_device);
+    data_control_device = NULL;
+    if (mpv_unobserve_property(hmpv, clipboard_text_reply_userdata) < 0)
+        logger("failed to unobserve the clipboard/text property");
+    if (mpv_unobserve_property(hmpv, clipboard_text_primary_reply_userdata) < 0)
+        logger("failed to unobserve the clipboard/text-primary property");
+}
+
+static bool should_create_pointer_warp(void)
+{
+    return !pointer_warp && pointer_warp_manager && remote_output &&
+        remote_seat;
+}
+
+static void create_pointer_warp(void)
+{
+    pointer_warp = mpvif_pointer_warp_manager_v1_get_pointer_warp(
+            pointer_warp_manager, remote_seat->obj, remote_output->obj);
+    mpvif_pointer_warp_v1_add_listener(pointer_warp, &pointer_warp_listener,
+            NULL);
+}
+
+static void destroy_pointer_warp(void)
+{
+    mpvif_pointer_warp_v1_destroy(pointer_warp);
+    pointer_warp = NULL;
+}
+
+static bool should_create_pointer_constraints(void)
+{
+    return !pointer_constraints && pointer_constraints_manager &&
+        remote_seat && auto_grab_mode != AUTO_GRAB_NO;
+}
+
+static void create_pointer_constraints(void)
+{
+    pointer_constraints =
+        mpvif_pointer_constraints_manager_v1_get_pointer_constraints(
+                pointer_constraints_manager, remote_seat->obj);
+    mpvif_pointer_constraints_v1_add_listener(pointer_constraints,
+            &pointer_constraints_listener, NULL);
+}
+
+static void destroy_pointer_constraints(void)
+{
+    mpvif_pointer_constraints_v1_destroy(pointer_constraints);
+    pointer_constraints = NULL;
+    remote_constraint_state = 0;
+    update_auto_grab();
+}
+
+static void set_force_grab_cursor(int value)
+{
+    if (mpv_set_property_async(hmpv, 0, "wayland-remote-force-grab-cursor",
+                MPV_FORMAT_FLAG, &value) < 0)
+        logger("failed to set the wayland-remote-force-grab-cursor property");
+}
+
+/*
+ * Grab the host cursor while the focused remote client has the pointer locked
+ * (or is using relative motion, if configured), and release it afterwards.
+ * This only acts on changes of the remote state, so the user can still toggle
+ * the grab by hand in between. A grab enabled by the user is never released.
+ */
+static void update_auto_grab(void)
+{
+    bool want = false;
+
+    if (input_forwarding_enabled) {
+        if (remote_constraint_state & MPVIF_POINTER_CONSTRAINTS_V1_STATE_LOCKED)
+            want = true;
+        if (auto_grab_mode == AUTO_GRAB_LOCK_OR_RELATIVE &&
+                (remote_constraint_state & MPVIF_POINTER_CONSTRAINTS_V1_STATE_RELATIVE))
+            want = true;
+    }
+
+    if (want == auto_grab_wanted)
+        return;
+    auto_grab_wanted = want;
+
+    if (want && !force_grab_cursor_enabled) {
+        auto_grabbed = true;
+        set_force_grab_cursor(1);
+    } else if (!want && auto_grabbed) {
+        auto_grabbed = false;
+        set_force_grab_cursor(0);
+    }
+}
+
+static bool should_create_cursor_capture(void)
+{
+    return !cursor.cursor_session && cursor_enabled && shm &&
+        output_capture_source_manager && copy_capture_manager &&
+        remote_output && remote_seat &&
+        (remote_seat->capabilities & WL_SEAT_CAPABILITY_POINTER);
+}
+
+static void create_cursor_capture(void)
+{
+    cursor.pointer = wl_seat_get_pointer(remote_seat->obj);
+    cursor.source = ext_output_image_capture_source_manager_v1_create_source(
+            output_capture_source_manager, remote_output->obj);
+    cursor.cursor_session =
+        ext_image_copy_capture_manager_v1_create_pointer_cursor_session(
+                copy_capture_manager, cursor.source, cursor.pointer);
+    ext_image_copy_capture_cursor_session_v1_add_listener(
+            cursor.cursor_session, &cursor_cursor_session_listener, NULL);
+    cursor.session = ext_image_copy_capture_cursor_session_v1_get_capture_session(
+            cursor.cursor_session);
+    ext_image_copy_capture_session_v1_add_listener(cursor.session,
+            &cursor_session_listener, NULL);
+}
+
+static void destroy_cursor_buffer(void)
+{
+    wl_buffer_destroy(cursor.buffer);
+    munmap(cursor.buffer_data, cursor.buffer_size);
+    cursor.buffer = NULL;
+    cursor.buffer_data = NULL;
+    cursor.buffer_size = 0;
+    cursor.buffer_width = 0;
+    cursor.buffer_height = 0;
+}
+
+static bool allocate_cursor_buffer(void)
+{
+    if (cursor.buffer)
+        destroy_cursor_buffer();
+
+    int32_t stride = cursor.width * 4;
+    size_t size = (size_t)stride * cursor.height;
+
+    int fd = memfd_create("mpvif-cursor", MFD_CLOEXEC);
+    if (fd == -1) {
+        logger("memfd_create() failed: %m");
+        return false;
+    }
+
+    if (ftruncate(fd, size) == -1) {
+        logger("ftruncate() failed: %m");
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        logger("mmap() failed: %m");
+        close(fd);
+        return false;
+    }
+
+    struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
+    cursor.buffer = wl_shm_pool_create_buffer(pool, 0, cursor.width,
+            cursor.height, stride, WL_SHM_FORMAT_ARGB8888);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+
+    cursor.buffer_data = data;
+    cursor.buffer_size = size;
+    cursor.buffer_width = cursor.width;
+    cursor.buffer_height = cursor.height;
+    return true;
+}
+
+static void create_cursor_frame(void)
+{
+    if (!cursor.buffer)
+        return;
+
+    cursor.frame = ext_image_copy_capture_session_v1_create_frame(
+            cursor.session);
+    ext_image_copy_capture_frame_v1_add_listener(cursor.frame,
+            &cursor_frame_listener, NULL);
+    ext_image_copy_capture_frame_v1_attach_buffer(cursor.frame, cursor.buffer);
+    ext_image_copy_capture_frame_v1_damage_buffer(cursor.frame, 0, 0,
+            cursor.buffer_width, cursor.buffer_height);
+    ext_image_copy_capture_frame_v1_capture(cursor.frame);
+}
+
+static void destroy_cursor_frame(void)
+{
+    ext_image_copy_capture_frame_v1_destroy(cursor.frame);
+    cursor.frame = NULL;
+}
+
+static void destroy_cursor_capture(void)
+{
+    if (cursor.frame)
+        destroy_cursor_frame();
+    if (cursor.buffer)
+        destroy_cursor_buffer();
+    ext_image_copy_capture_session_v1_destroy(cursor.session);
+    ext_image_copy_capture_cursor_session_v1_destroy(cursor.cursor_session);
+    ext_image_capture_source_v1_destroy(cursor.source);
+    wl_pointer_release(cursor.pointer);
+
+    /* cached images stay around for the next session */
+    cursor = (struct cursor_capture){0};
+    cursor_overlay_dirty = true;
+}
+
+static bool should_create_output_capture(void)
+{
+    return !capture.session && capture_enabled && shm &&
+        output_capture_source_manager && copy_capture_manager && remote_output;
+}
+
+static void create_output_capture(void)
+{
+    /* the cursor is drawn by us when cursor image synchronization is on */
+    uint32_t options = cursor_enabled ? 0 :
+        EXT_IMAGE_COPY_CAPTURE_MANAGER_V1_OPTIONS_PAINT_CURSORS;
+
+    capture.frame_slot = -1;
+    capture_stats.dirty = true;
+    timer_arm(&capture_stats_timer, monotonic_ms());
+    capture.source = ext_output_image_capture_source_manager_v1_create_source(
+            output_capture_source_manager, remote_output->obj);
+    capture.session = ext_image_copy_capture_manager_v1_create_session(
+            copy_capture_manager, capture.source, options);
+    ext_image_copy_capture_session_v1_add_listener(capture.session,
+            &capture_session_listener, NULL);
+}
+
+static void destroy_output_capture(void)
+{
+    timer_disarm(&capture_retry_timer);
+    timer_disarm(&capture_stats_timer);
+    if (capture.frame)
+        destroy_capture_frame();
+    if (capture.ring)
+        destroy_capture_ring();
+    ext_image_copy_capture_session_v1_destroy(capture.session);
+    ext_image_capture_source_v1_destroy(capture.source);
+    capture = (struct output_capture){0};
+}
+
+static bool allocate_capture_ring(void)
+{
+    int32_t stride = capture.width * 4;
+    size_t frame_size = (size_t)stride * capture.height;
+    size_t size = frame_size * FRAME_RING_SLOTS;
+    uint32_t format = capture.xrgb_ok ? WL_SHM_FORMAT_XRGB8888 :
+        WL_SHM_FORMAT_ARGB8888;
+
+    if (size > INT32_MAX) {
+        logger("remote output is too large to capture");
+        return false;
+    }
+
+    int fd = memfd_create("mpvif-capture", MFD_CLOEXEC);
+    if (fd == -1) {
+        logger("memfd_create() failed: %m");
+        return false;
+    }
+
+    if (ftruncate(fd, size) == -1) {
+        logger("ftruncate() failed: %m");
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        logger("mmap() failed: %m");
+        close(fd);
+        return false;
+    }
+
+    capture.ring = frame_ring_create(data, size, frame_size);
+    if (!capture.ring) {
+        munmap(data, size);
+        close(fd);
+        return false;
+    }
+
+    struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
+    for (int i = 0; i < FRAME_RING_SLOTS; i++) {
+        capture.buffers[i] = wl_shm_pool_create_buffer(pool, i * frame_size,
+                capture.width, capture.height, stride, format);
+    }
+    wl_shm_pool_destroy(pool);
+    close(fd);
+
+    capture.buffer_width = capture.width;
+    capture.buffer_height = capture.height;
+    capture.buffer_format = format;
+
+    if (capture_tile_hash) {
+        capture.tiles_x = (capture.width + TILE_SIZE - 1) / TILE_SIZE;
+        capture.tiles_y = (capture.height + TILE_SIZE - 1) / TILE_SIZE;
+        size_t tiles = (size_t)capture.tiles_x * capture.tiles_y;
+        capture.tile_hashes = calloc(tiles, sizeof(uint64_t));
+        capture.new_tile_hashes = calloc(tiles, sizeof(uint64_t));
+        if (!capture.tile_hashes || !capture.new_tile_hashes) {
+            /* not fatal, frames just aren't checked */
+            free(capture.tile_hashes);
+            free(capture.new_tile_hashes);
+            capture.tile_hashes = NULL;
+            capture.new_tile_hashes = NULL;
+        }
+    }
+    capture.tile_hashes_valid = false;
+
+    /* new buffers have to be written in full */
+    for (int i = 0; i < FRAME_RING_SLOTS; i++) {
+        damage_clear(&capture.slot_damage[i]);
+        damage_add(&capture.slot_damage[i], 0, 0, capture.width,
+                capture.height);
+    }
+
+    pthread_mutex_lock(&stream_lock);
+    stream_ring = capture.ring;
+    stream_width = capture.width;
+    stream_height = capture.height;
+    /* little-endian XRGB8888/ARGB8888 as mpv image formats */
+    stream_format = format == WL_SHM_FORMAT_XRGB8888 ? "bgr0" : "bgra";
+    if (stream_yuv_depth)
+        stream_format = stream_yuv_depth == 8 ? "yuv444p" : "yuv444p10";
+    pthread_cond_broadcast(&stream_cond);
+    pthread_mutex_unlock(&stream_lock);
+
+    logger("capturing the remote output at %" PRIi32 "x%" PRIi32,
+            capture.width, capture.height);
+    return true;
+}
+
+static void destroy_capture_ring(void)
+{
+    pthread_mutex_lock(&stream_lock);
+    stream_ring = NULL;
+    pthread_mutex_unlock(&stream_lock);
+
+    /* open streams end after the frame they are on, the frames in mpvif://
+     * can't change size */
+    frame_ring_close(capture.ring);
+    for (int i = 0; i < FRAME_RING_SLOTS; i++)
+        wl_buffer_destroy(capture.buffers[i]);
+    frame_ring_unref(capture.ring);
+
+    free(capture.tile_hashes);
+    free(capture.new_tile_hashes);
+    capture.tile_hashes = NULL;
+    capture.new_tile_hashes = NULL;
+    capture.tile_hashes_valid = false;
+
+    capture.ring = NULL;
+    capture.buffer_width = 0;
+    capture.buffer_height = 0;
+    capture.buffer_format = 0;
+}
+
+static bool stream_has_readers(void)
+{
+    pthread_mutex_lock(&stream_lock);
+    bool ret = stream_readers > 0;
+    pthread_mutex_unlock(&stream_lock);
+    return ret;
+}
+
+/*
+ * Frames are only captured while the stream is open, apart from the first one
+ * so that opening the stream doesn't wait for the remote output to change.
+ */
+static bool should_create_capture_frame(void)
+{
+    return capture.ring && !capture.frame && !capture_retry_timer.armed &&
+        (!frame_ring_has_frame(capture.ring) || stream_has_readers());
+}
+
+static void create_capture_frame(void)
+{
+    int slot = frame_ring_begin_write(capture.ring);
+    if (slot == -1)
+        return;
+
+    capture.frame_slot = slot;
+    capture.frame = ext_image_copy_capture_session_v1_create_frame(
+            capture.session);
+    ext_image_copy_capture_frame_v1_add_listener(capture.frame,
+            &capture_frame_listener, NULL);
+    ext_image_copy_capture_frame_v1_attach_buffer(capture.frame,
+            capture.buffers[slot]);
+
+    /* the slot missed the frames which were captured into the other slots
+     * since it was last captured */
+    capture.buffer_damage = capture.slot_damage[slot];
+    damage_clear(&capture.frame_damage);
+    capture.frame_time = 0;
+    for (int i = 0; i < capture.buffer_damage.count; i++) {
+        struct damage_rect *r = &capture.buffer_damage.rects[i];
+        ext_image_copy_capture_frame_v1_damage_buffer(capture.frame, r->x,
+                r->y, r->width, r->height);
+    }
+
+    ext_image_copy_capture_frame_v1_capture(capture.frame);
+}
 
-        if (should_create_data_control_device())
-            create_data_control_device();
+static void destroy_capture_frame(void)
+{
+    ext_image_copy_capture_frame_v1_destroy(capture.frame);
+    /* the compositor may have written parts of the slot already, so it stays
+     * damaged for the next capture */
+    frame_ring_abort_write(capture.ring, capture.frame_slot);
+    capture.frame = NULL;
+    capture.frame_slot = -1;
+}
+
+static bool tile_is_damaged(struct damage *damage, int32_t x, int32_t y,
+        int32_t width, int32_t height)
+{
+    for (int i = 0; i < damage->count; i++) {
+        struct damage_rect *r = &damage->rects[i];
+        if (r->x < x + width && x < r->x + r->width &&
+                r->y < y + height && y < r->y + r->height)
+            return true;
     }
+    return false;
 }
 
-static const struct wl_seat_listener seat_listener = {
-    seat_capabilities,
-    seat_name,
+/*
+ * Hashes the tiles of the slot which intersect the frame damage into
+ * new_tile_hashes, the other tiles are carried over from the latest published
+ * frame. Without valid hashes of the latest frame, every tile is hashed so the
+ * next frame can be compared, and the frame counts as new.
+ */
+static bool is_duplicate_frame(int slot)
+{
+    if (!capture.tile_hashes)
+        return false;
+
+    bool valid = capture.tile_hashes_valid;
+    bool duplicate = valid;
+    size_t stride = (size_t)capture.buffer_width * 4;
+    const char *data = frame_ring_slot_data(capture.ring, slot);
+
+    for (int32_t ty = 0; ty < capture.tiles_y; ty++) {
+        int32_t y = ty * TILE_SIZE;
+        int32_t height = MIN(TILE_SIZE, capture.buffer_height - y);
+        for (int32_t tx = 0; tx < capture.tiles_x; tx++) {
+            int32_t x = tx * TILE_SIZE;
+            int32_t width = MIN(TILE_SIZE, capture.buffer_width - x);
+            size_t i = (size_t)ty * capture.tiles_x + tx;
+
+            if (valid && !tile_is_damaged(&capture.frame_damage, x, y, width,
+                        height)) {
+                capture.new_tile_hashes[i] = capture.tile_hashes[i];
+                continue;
+            }
+
+            capture.new_tile_hashes[i] = capture_tile_hash(
+                    data + y * stride + x * 4, stride, width, height);
+            if (capture.new_tile_hashes[i] != capture.tile_hashes[i])
+                duplicate = false;
+        }
+    }
+
+    return duplicate;
+}
+
+static void capture_retry_expired(void)
+{
+    if (should_create_capture_frame())
+        create_capture_frame();
+}
+
+static void publish_capture_stats(void)
+{
+    char *keys[] = {"frames", "skipped-frames", "duplicate-frames",
+        "late-frames", "copied-bytes", "last-copied-bytes", "idle"};
+    int64_t values[] = {capture_stats.frames, capture_stats.skipped_frames,
+        capture_stats.duplicate_frames, capture_stats.late_frames,
+        capture_stats.copied_bytes, capture_stats.last_copied_bytes};
+    mpv_node nodes[7];
+    for (int i = 0; i < 6; i++)
+        nodes[i] = (mpv_node){ .format = MPV_FORMAT_INT64, .u.int64 = values[i] };
+    nodes[6] = (mpv_node){ .format = MPV_FORMAT_FLAG,
+        .u.flag = capture_stats.idle };
+    mpv_node_list list = { .num = 7, .values = nodes, .keys = keys };
+    mpv_node node = { .format = MPV_FORMAT_NODE_MAP, .u.list = &list };
+
+    mpv_set_property_async(hmpv, 0, "user-data/mpvif/capture", MPV_FORMAT_NODE,
+            &node);
+    capture_stats.dirty = false;
+}
+
+/* once a second is plenty for a human or a script to look at */
+static void capture_stats_expired(void)
+{
+    bool idle = capture_stats.frames == capture_stats.published_frames;
+    if (idle != capture_stats.idle) {
+        capture_stats.idle = idle;
+        capture_stats.dirty = true;
+    }
+    capture_stats.published_frames = capture_stats.frames;
+
+    int64_t late_frames = atomic_load(&stream_late_frames);
+    if (late_frames != capture_stats.late_frames) {
+        capture_stats.late_frames = late_frames;
+        capture_stats.dirty = true;
+    }
+
+    if (capture_stats.dirty)
+        publish_capture_stats();
+    timer_arm(&capture_stats_timer, monotonic_ms() + 1000);
+}
+
+static void record_flushed_motions(void)
+{
+    int64_t now = monotonic_ns();
+    for (int i = 0; i < unflushed_motion_count; i++) {
+        int64_t latency = now - unflushed_motions[i];
+        if (latency_histograms)
+            histogram_add(&input_latency, latency);
+        if (overlay_shown)
+            histogram_add(&overlay_input_latency, latency);
+    }
+    unflushed_motion_count = 0;
+}
+
+/* every flush goes through here, so motions sent by a flush outside the main
+ * loop (e.g. in receive_offer) get the time they were actually sent */
+static void flush_display(void)
+{
+    /* -1 with EAGAIN if the socket is full, the rest is sent later */
+    if (wl_display_flush(display) != -1 && motions_unflushed) {
+        counters.motion_flushes++;
+        motions_unflushed = false;
+        if (unflushed_motion_count)
+            record_flushed_motions();
+    }
+}
+
+static void latency_sync_done(void *data, struct wl_callback *wl_callback,
+        uint32_t callback_data)
+{
+    histogram_add(&roundtrip_latency, monotonic_ns() - latency_sync_sent);
+    wl_callback_destroy(wl_callback);
+    latency_sync = NULL;
+}
+
+static const struct wl_callback_listener latency_sync_listener = {
+    latency_sync_done,
 };
 
-static void registry_global(void *data, struct wl_registry *wl_registry,
-        uint32_t name, const char *interface, uint32_t version)
+static void set_latency_node(mpv_node *node, mpv_node_list *list,
+        mpv_node values[4], const struct histogram *h)
 {
-    if (strcmp(interface, zwlr_virtual_pointer_manager_v1_interface.name) == 0) {
-        virtual_pointer_manager = wl_registry_bind(registry, name,
-                &zwlr_virtual_pointer_manager_v1_interface, 2);
+    static char *keys[] = {"count", "p50", "p99", "max"};
+    /* in microseconds, which is what the numbers are usually looked at in */
+    int64_t v[] = {h->count, histogram_percentile(h, 0.5) / 1000,
+        histogram_percentile(h, 0.99) / 1000, h->max / 1000};
+    for (int i = 0; i < 4; i++)
+        values[i] = (mpv_node){ .format = MPV_FORMAT_INT64, .u.int64 = v[i] };
+    *list = (mpv_node_list){ .num = 4, .values = values, .keys = keys };
+    *node = (mpv_node){ .format = MPV_FORMAT_NODE_MAP, .u.list = list };
+}
+
+static void publish_latency(void)
+{
+    mpv_node values[2][4];
+    mpv_node_list lists[2];
+    mpv_node nodes[2];
+    set_latency_node(&nodes[0], &lists[0], values[0], &input_latency);
+    set_latency_node(&nodes[1], &lists[1], values[1], &roundtrip_latency);
+
+    char *keys[] = {"input", "roundtrip"};
+    mpv_node_list list = { .num = 2, .values = nodes, .keys = keys };
+    mpv_node node = { .format = MPV_FORMAT_NODE_MAP, .u.list = &list };
+
+    mpv_set_property_async(hmpv, 0, "user-data/mpvif/latency", MPV_FORMAT_NODE,
+            &node);
+}
+
+static void latency_expired(void)
+{
+    /* one sync at a time, a compositor which takes longer than a second to
+     * answer shows up in the max anyway */
+    if (!latency_sync) {
+        latency_sync = wl_display_sync(display);
+        wl_callback_add_listener(latency_sync, &latency_sync_listener, NULL);
+        latency_sync_sent = monotonic_ns();
     }
 
-    if (strcmp(interface, zwlr_foreign_toplevel_manager_v1_interface.name) == 0) {
-        toplevel_manager = wl_registry_bind(registry, name,
-                &zwlr_foreign_toplevel_manager_v1_interface, 3);
-        zwlr_foreign_toplevel_manager_v1_add_listener(toplevel_manager,
-                &toplevel_manager_listener, NULL);
+    uint64_t count = input_latency.count + roundtrip_latency.count;
+    if (latency_enabled && count != latency_published_count) {
+        latency_published_count = count;
+        publish_latency();
     }
+    timer_arm(&latency_timer, monotonic_ms() + 1000);
+}
 
-    if (strcmp(interface, ext_data_control_manager_v1_interface.name) == 0) {
-        data_control_manager = wl_registry_bind(registry, name,
-                &ext_data_control_manager_v1_interface, 1);
+/* a family's HELP and TYPE lines. the text format which node_exporter reads
+ * names counters with their _total suffix, OpenMetrics without */
+static void write_metric_family(FILE *f, bool openmetrics, const char *name,
+        const char *type, const char *help)
+{
+    const char *suffix = "";
+    if (!openmetrics && strcmp(type, "counter") == 0)
+        suffix = "_total";
+    fprintf(f, "# HELP %s%s %s\n", name, suffix, help);
+    fprintf(f, "# TYPE %s%s %s\n", name, suffix, type);
+}
+
+static void write_metric_counter(FILE *f, bool openmetrics, const char *name,
+        const char *help, uint64_t value)
+{
+    write_metric_family(f, openmetrics, name, "counter", help);
+    fprintf(f, "%s_total %" PRIu64 "\n", name, value);
+}
+
+static void write_metric_histogram(FILE *f, bool openmetrics,
+        const char *name, const char *help, const struct histogram *h)
+{
+    /* in ns, a bucket is only counted below a bound if all of it is */
+    static const uint64_t bounds[] = {
+        100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+        25000000, 50000000, 100000000, 250000000,
+    };
+
+    write_metric_family(f, openmetrics, name, "histogram", help);
+    for (size_t i = 0; i < sizeof(bounds) / sizeof(bounds[0]); i++)
+        fprintf(f, "%s_bucket{le=\"%g\"} %" PRIu64 "\n", name, bounds[i] / 1e9,
+                histogram_count_at_most(h, bounds[i]));
+    fprintf(f, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", name, h->count);
+    fprintf(f, "%s_sum %.9f\n", name, h->sum / 1e9);
+    fprintf(f, "%s_count %" PRIu64 "\n", name, h->count);
+}
+
+static void write_metrics(FILE *f, bool openmetrics)
+{
+    struct input_counters *c = &counters;
+
+    write_metric_counter(f, openmetrics, "mpvif_mouse_pos_changes",
+            "mouse-pos changes received from mpv while forwarding input",
+            c->mouse_pos);
+    write_metric_counter(f, openmetrics, "mpvif_mouse_pos_dropped",
+            "mouse-pos changes which weren't sent as a motion",
+            c->mouse_pos - c->motions);
+    write_metric_counter(f, openmetrics, "mpvif_motions",
+            "motions sent to the compositor", c->motions);
+    write_metric_counter(f, openmetrics, "mpvif_motions_coalesced",
+            "motions which went out in the same socket write as an earlier one",
+            c->motions - c->motion_flushes);
+    write_metric_counter(f, openmetrics, "mpvif_warps",
+            "application pointer warps relayed to mpv", c->warps);
+    write_metric_counter(f, openmetrics, "mpvif_sway_ipc_events",
+            "sway IPC events received", c->i3ipc_events);
+
+    write_metric_family(f, openmetrics, "mpvif_clipboard_transfers", "counter",
+            "clipboard transfers between mpv and the compositor");
+    fprintf(f, "mpvif_clipboard_transfers_total{direction=\"in\"} %" PRIu64 "\n",
+            c->clipboard_in);
+    fprintf(f, "mpvif_clipboard_transfers_total{direction=\"out\"} %" PRIu64 "\n",
+            c->clipboard_out);
+    write_metric_family(f, openmetrics, "mpvif_clipboard_bytes", "counter",
+            "bytes of clipboard text transferred");
+    fprintf(f, "mpvif_clipboard_bytes_total{direction=\"in\"} %" PRIu64 "\n",
+            c->clipboard_in_bytes);
+    fprintf(f, "mpvif_clipboard_bytes_total{direction=\"out\"} %" PRIu64 "\n",
+            c->clipboard_out_bytes);
+
+    /* the objects are recreated on seat or output hotplug and when input
+     * forwarding is toggled */
+    write_metric_family(f, openmetrics, "mpvif_reconnects", "counter",
+            "compositor objects which had to be created again");
+    fprintf(f, "mpvif_reconnects_total{object=\"virtual_pointer\"} %" PRIu64 "\n",
+            c->virtual_pointers ? c->virtual_pointers - 1 : 0);
+    fprintf(f, "mpvif_reconnects_total{object=\"data_control_device\"} %" PRIu64 "\n",
+            c->data_control_devices ? c->data_control_devices - 1 : 0);
+
+    write_metric_histogram(f, openmetrics, "mpvif_input_latency_seconds",
+            "from a mouse-pos change until its motion is flushed", &input_latency);
+    write_metric_histogram(f, openmetrics, "mpvif_roundtrip_latency_seconds",
+            "round trip of a wl_display_sync to the compositor",
+            &roundtrip_latency);
+
+    if (openmetrics)
+        fprintf(f, "# EOF\n");
+}
+
+static void serve_metrics(void)
+{
+    int fd = accept4(metrics_socket_fd, NULL, NULL,
+            SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd == -1)
+        return;
+
+    char *text = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&text, &len);
+    if (f) {
+        write_metrics(f, true);
+        fclose(f);
+        /* a client which doesn't read gets cut off, the loop doesn't wait */
+        if (send(fd, text, len, MSG_NOSIGNAL) != (ssize_t)len)
+            logger_at(LOG_LEVEL_DEBUG, "incomplete metrics write: %m");
+        free(text);
     }
+    close(fd);
+}
 
-    if (strcmp(interface, wl_output_interface.name) == 0) {
-        struct wayland_output *o = calloc(1, sizeof(*o));
-        if (!o)
-            return;
+/*
+ * Only a socket which nobody listens on anymore (left behind by an instance
+ * which crashed) is removed, not a file which happens to be at the path or the
+ * socket of another instance which is still running.
+ */
+static bool remove_stale_metrics_socket(const struct sockaddr_un *addr)
+{
+    struct stat st;
+    if (lstat(addr->sun_path, &st) == -1)
+        return errno == ENOENT;
 
-        o->obj = wl_registry_bind(registry, name, &wl_output_interface, 4);
-        o->global_id = name;
-        wl_list_insert(&wayland_output_list, &o->link);
-        wl_output_add_listener(o->obj, &output_listener, o);
+    if (!S_ISSOCK(st.st_mode)) {
+        logger("%s exists and isn't a socket", addr->sun_path);
+        return false;
     }
 
-    if (strcmp(interface, wl_seat_interface.name) == 0) {
-        struct wayland_seat *s = calloc(1, sizeof(*s));
-        if (!s)
-            return;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        logger("socket() failed: %m");
+        return false;
+    }
 
-        s->obj = wl_registry_bind(registry, name, &wl_seat_interface, 8);
-        s->global_id = name;
-        wl_list_insert(&wayland_seat_list, &s->link);
-        wl_seat_add_listener(s->obj, &seat_listener, s);
+    int ret = connect(fd, (const struct sockaddr *)addr, sizeof(*addr));
+    int connect_errno = errno;
+    close(fd);
+    if (ret == 0) {
+        logger("%s is in use by another instance", addr->sun_path);
+        return false;
+    }
+    if (connect_errno == ENOENT)
+        return true;
+    if (connect_errno != ECONNREFUSED) {
+        logger("failed to check %s: %s", addr->sun_path,
+                strerror(connect_errno));
+        return false;
     }
+
+    if (unlink(addr->sun_path) == -1 && errno != ENOENT) {
+        logger("failed to remove stale socket %s: %m", addr->sun_path);
+        return false;
+    }
+
+    return true;
 }
 
-static void registry_global_remove(void *data, struct wl_registry *wl_registry,
-        uint32_t name)
+static bool create_metrics_socket(void)
 {
-    struct wayland_output *o, *o_tmp;
-    wl_list_for_each_safe(o, o_tmp, &wayland_output_list, link) {
-        if (o->global_id == name) {
-            destroy_output(o);
-            return;
-        }
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(metrics_socket_path) >= sizeof(addr.sun_path)) {
+        logger("metrics socket path is too long: %s", metrics_socket_path);
+        return false;
     }
+    strcpy(addr.sun_path, metrics_socket_path);
 
-    struct wayland_seat *s, *s_tmp;
-    wl_list_for_each_safe(s, s_tmp, &wayland_seat_list, link) {
-        if (s->global_id == name) {
-            destroy_seat(s);
-            return;
+    if (!remove_stale_metrics_socket(&addr))
+        return false;
+
+    metrics_socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC |
+            SOCK_NONBLOCK, 0);
+    if (metrics_socket_fd == -1) {
+        logger("socket() failed: %m");
+        return false;
+    }
+
+    if (bind(metrics_socket_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+            listen(metrics_socket_fd, 4) == -1) {
+        logger("failed to listen on %s: %m", metrics_socket_path);
+        close(metrics_socket_fd);
+        metrics_socket_fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+static void metrics_file_expired(void)
+{
+    /* node_exporter must never see a half-written file */
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", metrics_file_path);
+
+    FILE *f = fopen(tmp_path, "we");
+    if (!f) {
+        logger("failed to write the metrics to %s: %m", tmp_path);
+    } else {
+        write_metrics(f, false);
+        if (fclose(f) != 0 || rename(tmp_path, metrics_file_path) != 0) {
+            logger("failed to write the metrics to %s: %m", metrics_file_path);
+            unlink(tmp_path);
         }
     }
+
+    timer_arm(&metrics_file_timer, monotonic_ms() + metrics_interval * 1000);
 }
 
-static const struct wl_registry_listener registry_listener = {
-    registry_global,
-    registry_global_remove,
-};
+static void handler_stats_expired(void)
+{
+    for (int i = 0; i < HANDLER_COUNT; i++) {
+        handler_stats[i].per_second =
+            handler_stats[i].calls - handler_stats[i].window_calls;
+        handler_stats[i].window_calls = handler_stats[i].calls;
+    }
+    timer_arm(&handler_stats_timer, monotonic_ms() + 1000);
+}
+
+static void log_handler_stats(void)
+{
+    logger("%-16s %10s %8s %12s %10s %10s", "handler", "calls", "per sec",
+            "total ms", "avg us", "max us");
+    for (int i = 0; i < HANDLER_COUNT; i++) {
+        struct handler_stats *hs = &handler_stats[i];
+        double avg_us = 0;
+        if (hs->calls)
+            avg_us = hs->total_ns / 1e3 / hs->calls;
+        logger("%-16s %10" PRIu64 " %8" PRIu64 " %12.3f %10.2f %10.2f",
+                handler_names[i], hs->calls, hs->per_second,
+                hs->total_ns / 1e6, avg_us, hs->max_ns / 1e3);
+    }
+}
 
-static void logger(const char *fmt, ...)
+static void dump_handler_stats(const char *path)
 {
-    char log_buf[4096];
-    size_t log_buf_count = 0;
+    FILE *f = fopen(path, "we");
+    if (!f) {
+        logger("failed to open %s: %m", path);
+        return;
+    }
 
-    log_buf_count += snprintf(log_buf + log_buf_count,
-            sizeof(log_buf) - log_buf_count, "%s: ", mpv_client_name(hmpv));
+    fprintf(f, "{");
+    for (int i = 0; i < HANDLER_COUNT; i++) {
+        struct handler_stats *hs = &handler_stats[i];
+        fprintf(f, "%s\n  \"%s\": {\"calls\": %" PRIu64 ", \"per-second\": %" PRIu64
+                ", \"total-ns\": %" PRIu64 ", \"max-ns\": %" PRIu64 "}",
+                i ? "," : "", handler_names[i], hs->calls, hs->per_second,
+                hs->total_ns, hs->max_ns);
+    }
+    fprintf(f, "\n}\n");
+
+    if (fclose(f) != 0)
+        logger("failed to write %s: %m", path);
+}
 
-    if (log_buf_count >= sizeof(log_buf))
+/* mpvif-stats [reset | FILE] */
+static void handle_stats_message(int num_args, const char **args)
+{
+    if (!handler_stats_enabled) {
+        logger("handler stats are disabled, enable them with --script-opts=mpvif-stats=yes");
         return;
+    }
 
-    va_list ap;
-    va_start(ap, fmt);
-    log_buf_count += vsnprintf(log_buf + log_buf_count,
-            sizeof(log_buf) - log_buf_count, fmt, ap);
-    va_end(ap);
+    if (num_args < 2) {
+        log_handler_stats();
+    } else if (strcmp(args[1], "reset") == 0) {
+        memset(handler_stats, 0, sizeof(handler_stats));
+    } else {
+        dump_handler_stats(args[1]);
+    }
+}
+
+static void set_osd_overlay(const char *format, const char *data)
+{
+    char *keys[] = {"name", "id", "format", "data"};
+    mpv_node values[] = {
+        { .format = MPV_FORMAT_STRING, .u.string = "osd-overlay" },
+        { .format = MPV_FORMAT_INT64, .u.int64 = 1 },
+        { .format = MPV_FORMAT_STRING, .u.string = (char *)format },
+        { .format = MPV_FORMAT_STRING, .u.string = (char *)data },
+    };
+    mpv_node_list list = { .num = 4, .values = values, .keys = keys };
+    mpv_node node = { .format = MPV_FORMAT_NODE_MAP, .u.list = &list };
 
-    mpv_command(hmpv, (const char *[]){"print-text", log_buf, NULL});
+    mpv_command_node_async(hmpv, 0, &node);
 }
 
-static int timestamp(void)
+static void overlay_expired(void)
 {
-    struct timespec tp;
-    clock_gettime(CLOCK_MONOTONIC, &tp);
-    int ms = 1000 * tp.tv_sec + tp.tv_nsec / 1000000;
-    return ms;
+    int64_t now = monotonic_ns();
+    double seconds = (now - overlay_time) / 1e9;
+    struct input_counters *c = &counters;
+    struct input_counters *last = &overlay_counters;
+
+    uint64_t motions = c->motions - last->motions;
+    uint64_t flushes = c->motion_flushes - last->motion_flushes;
+    double per_flush = 0;
+    if (flushes)
+        per_flush = (double)motions / flushes;
+
+    /* what the compositor hasn't read from the socket yet */
+    int backlog = 0;
+    if (ioctl(wl_display_get_fd(display), TIOCOUTQ, &backlog) == -1)
+        backlog = -1;
+
+    char latency[64] = "-";
+    if (overlay_input_latency.count)
+        snprintf(latency, sizeof(latency), "p50 %.0fus  p99 %.0fus",
+                histogram_percentile(&overlay_input_latency, 0.5) / 1e3,
+                histogram_percentile(&overlay_input_latency, 0.99) / 1e3);
+
+    char text[1024];
+    snprintf(text, sizeof(text),
+            "{\\an7\\fs16\\bord1.5}mpvif\\N"
+            "motion  in %.0f/s  out %.0f/s  %.1f per write\\N"
+            "input latency  %s\\N"
+            "wayland backlog  %d B\\N"
+            "clipboard  in %" PRIu64 " (%" PRIu64 " B)  out %" PRIu64 " (%" PRIu64 " B)\\N"
+            "sway IPC  %.0f events/s  last request %.2fms",
+            (c->mouse_pos - last->mouse_pos) / seconds, motions / seconds,
+            per_flush, latency, backlog, c->clipboard_in,
+            c->clipboard_in_bytes, c->clipboard_out, c->clipboard_out_bytes,
+            (c->i3ipc_events - last->i3ipc_events) / seconds,
+            c->i3ipc_request_time / 1e6);
+    set_osd_overlay("ass-events", text);
+
+    overlay_counters = counters;
+    overlay_time = now;
+    histogram_reset(&overlay_input_latency);
+    timer_arm(&overlay_timer, monotonic_ms() + 500);
 }
 
-static bool str_is_set(const char *str)
+static void set_overlay_shown(bool shown)
 {
-    return str && *str != '\0';
+    overlay_shown = shown;
+    latency_sampling = latency_histograms || overlay_shown;
+
+    if (shown) {
+        overlay_counters = counters;
+        overlay_time = monotonic_ns();
+        histogram_reset(&overlay_input_latency);
+        timer_arm(&overlay_timer, monotonic_ms() + 500);
+    } else {
+        timer_disarm(&overlay_timer);
+        set_osd_overlay("none", "");
+    }
 }
 
-struct mouse_pos_values mouse_node_get_values(mpv_node *node)
+static void notify_stream_readers_changed(void)
 {
-    struct mouse_pos_values mouse_v = {0};
+    /* called with stream_lock held, which keeps the fd from being closed */
+    atomic_store(&stream_readers_changed, true);
+    if (stream_wakeup_fd != -1)
+        (void)!write(stream_wakeup_fd, &(char){0}, 1);
+}
 
-    mpv_node_list *list = node->u.list;
-    for (int i = 0; i < list->num; i++) {
-        char *key = list->keys[i];
-        mpv_node *value = &list->values[i];
+static void convert_stream_band(void *data, int job)
+{
+    struct stream *stream = data;
+    yuv_convert_rows(stream->yuv_row, &stream->coeffs, stream->src,
+            (size_t)stream->width * 4, stream->yuv_frame, stream->width,
+            stream->height, stream->height * job / stream->jobs,
+            stream->height * (job + 1) / stream->jobs);
+}
 
-        if (value->format != MPV_FORMAT_INT64)
-            continue;
+static bool next_stream_frame(struct stream *stream)
+{
+    uint64_t late_frames = stream->reader.late_frames;
+    const void *src = frame_ring_acquire(&stream->reader, stream_max_latency);
+    atomic_fetch_add(&stream_late_frames,
+            stream->reader.late_frames - late_frames);
+    if (!src)
+        return false;
+
+    /* the slot is only held while converting, not while mpv reads the
+     * converted frame in pieces */
+    if (stream->yuv_frame) {
+        stream->src = src;
+        thread_pool_run(stream->pool, convert_stream_band, stream,
+                stream->jobs);
+        frame_ring_release(&stream->reader);
+        stream->src = NULL;
+        stream->payload = stream->yuv_frame;
+    } else {
+        stream->payload = src;
+    }
+    stream->payload_offset = 0;
+
+    stream->prefix_size = 0;
+    stream->prefix_offset = 0;
+    if (stream->matroska) {
+        if (!stream->header_sent) {
+            stream->prefix_size = matroska_write_header(stream->prefix,
+                    &stream->video);
+            stream->first_timestamp = stream->reader.timestamp;
+            stream->header_sent = true;
+        }
 
-        if (strcmp(key, "x") == 0)
-            mouse_v.x = value->u.int64;
-        else if (strcmp(key, "y") == 0)
-            mouse_v.y = value->u.int64;
+        /* timestamps must not go backwards */
+        uint64_t timestamp = MAX(stream->reader.timestamp,
+                stream->last_timestamp);
+        stream->last_timestamp = timestamp;
+        stream->prefix_size += matroska_write_block_header(
+                stream->prefix + stream->prefix_size,
+                timestamp - stream->first_timestamp, stream->payload_size);
     }
 
-    return mouse_v;
+    return true;
 }
 
-void osd_node_get_values(mpv_node *node)
+static int64_t stream_read(void *cookie, char *buf, uint64_t nbytes)
 {
-    mpv_node_list *list = node->u.list;
-    for (int i = 0; i < list->num; i++) {
-        char *key = list->keys[i];
-        mpv_node *value = &list->values[i];
+    struct stream *stream = cookie;
+
+    if (stream->prefix_offset == stream->prefix_size &&
+            stream->payload_offset == stream->payload_size &&
+            !next_stream_frame(stream))
+        return 0;
+
+    if (stream->prefix_offset < stream->prefix_size) {
+        size_t len = MIN(nbytes, stream->prefix_size - stream->prefix_offset);
+        memcpy(buf, stream->prefix + stream->prefix_offset, len);
+        stream->prefix_offset += len;
+        return len;
+    }
 
-        if (value->format != MPV_FORMAT_INT64)
-            continue;
+    size_t len = MIN(nbytes, stream->payload_size - stream->payload_offset);
+    memcpy(buf, stream->payload + stream->payload_offset, len);
+    stream->payload_offset += len;
 
-        if (strcmp(key, "ml") == 0)
-            osd_v.ml = value->u.int64;
-        else if (strcmp(key, "mr") == 0)
-            osd_v.mr = value->u.int64;
-        else if (strcmp(key, "mt") == 0)
-            osd_v.mt = value->u.int64;
-        else if (strcmp(key, "mb") == 0)
-            osd_v.mb = value->u.int64;
-        else if (strcmp(key, "w") == 0)
-            osd_v.w = value->u.int64;
-        else if (strcmp(key, "h") == 0)
-            osd_v.h = value->u.int64;
+    if (stream->payload_offset == stream->payload_size && !stream->yuv_frame)
+        frame_ring_release(&stream->reader);
+    return len;
+}
+
+static void stream_cancel(void *cookie)
+{
+    struct stream *stream = cookie;
+    frame_ring_cancel(&stream->reader);
+}
+
+static void stream_close(void *cookie)
+{
+    struct stream *stream = cookie;
+    frame_ring_reader_finish(&stream->reader);
+    if (stream->pool)
+        thread_pool_destroy(stream->pool);
+    free(stream->yuv_frame);
+    free(stream);
+
+    pthread_mutex_lock(&stream_lock);
+    stream_readers--;
+    notify_stream_readers_changed();
+    pthread_mutex_unlock(&stream_lock);
+}
+
+/* converting on mpv's demuxer thread (and the pool) takes it off the filter
+ * chain, and only frames mpv actually reads get converted */
+static bool init_stream_conversion(struct stream *stream)
+{
+    stream->payload_size = yuv_frame_size(stream->width, stream->height,
+            stream_yuv_depth);
+    stream->payload_offset = stream->payload_size;
+    stream->yuv_frame = malloc(stream->payload_size);
+    if (!stream->yuv_frame)
+        return false;
+
+    stream->pool = thread_pool_create(stream_threads);
+    if (!stream->pool)
+        return false;
+
+    yuv_coeffs_init(&stream->coeffs,
+            yuv_guess_matrix(stream->width, stream->height),
+            stream_yuv_depth);
+    stream->yuv_row = yuv_row_best();
+    /* a few bands per thread even out threads which get scheduled late */
+    stream->jobs = MIN(thread_pool_threads(stream->pool) * 4,
+            stream->height);
+    return true;
+}
+
+/* libavcodec's raw video FourCCs of the stream formats */
+static const struct {
+    const char *format;
+    char fourcc[4];
+} stream_fourccs[] = {
+    {"bgr0", {'B', 'G', 'R', 0}},
+    {"bgra", {'B', 'G', 'R', 'A'}},
+    {"yuv444p", {'4', '4', '4', 'P'}},
+    {"yuv444p10", {'Y', '3', 0, 10}},
+};
+
+static void init_stream_matroska(struct stream *stream, const char *format)
+{
+    stream->matroska = true;
+    stream->video.width = stream->width;
+    stream->video.height = stream->height;
+    for (size_t i = 0; i < sizeof(stream_fourccs) / sizeof(stream_fourccs[0]);
+            i++) {
+        if (strcmp(stream_fourccs[i].format, format) == 0)
+            memcpy(stream->video.fourcc, stream_fourccs[i].fourcc, 4);
+    }
+
+    /* tag the matrix the frames are converted with, BT.709 or BT.601 */
+    if (stream_yuv_depth) {
+        stream->video.matrix = yuv_guess_matrix(stream->width,
+                stream->height) == YUV_BT709 ? 1 : 6;
     }
 }
 
-void video_node_get_values(mpv_node *node)
+static void set_stream_option(const char *name, const char *value)
 {
-    mpv_node_list *list = node->u.list;
-    for (int i = 0; i < list->num; i++) {
-        char *key = list->keys[i];
-        mpv_node *value = &list->values[i];
+    char prop[128];
+    snprintf(prop, sizeof(prop), "file-local-options/%s", name);
+    if (mpv_set_property_string(hmpv, prop, value) < 0)
+        logger("failed to set %s", prop);
+}
 
-        if (value->format != MPV_FORMAT_INT64)
-            continue;
+/*
+ * Runs on mpv's demuxer thread. Waits for the capture session to get its
+ * buffer constraints, then sets the rawvideo demuxer options for this file to
+ * the size and format of the frames. Only the rawvideo w/h/format options
+ * take effect from here, the demuxer itself was already chosen by then.
+ */
+static int stream_open(void *user_data, char *uri,
+        mpv_stream_cb_info *info)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += STREAM_OPEN_TIMEOUT;
 
-        if (strcmp(key, "w") == 0)
-            video_v.w = value->u.int64;
-        else if (strcmp(key, "h") == 0)
-            video_v.h = value->u.int64;
+    pthread_mutex_lock(&stream_lock);
+
+    if (stream_shutdown) {
+        pthread_mutex_unlock(&stream_lock);
+        return MPV_ERROR_LOADING_FAILED;
+    }
+
+    /* the ring has enough slots for one reader */
+    if (stream_readers > 0) {
+        pthread_mutex_unlock(&stream_lock);
+        logger("mpvif:// can only be opened once at a time");
+        return MPV_ERROR_LOADING_FAILED;
+    }
+
+    while (!stream_ring && !stream_shutdown) {
+        if (pthread_cond_timedwait(&stream_cond, &stream_lock,
+                    &deadline) == ETIMEDOUT)
+            break;
+    }
+
+    if (stream_shutdown) {
+        pthread_mutex_unlock(&stream_lock);
+        return MPV_ERROR_LOADING_FAILED;
+    }
+
+    if (!stream_ring) {
+        pthread_mutex_unlock(&stream_lock);
+        logger("no output capture session for mpvif://, check that mpvif-capture is enabled and the compositor supports ext-image-copy-capture");
+        return MPV_ERROR_LOADING_FAILED;
+    }
+
+    struct stream *stream = calloc(1, sizeof(*stream));
+    if (!stream) {
+        pthread_mutex_unlock(&stream_lock);
+        return MPV_ERROR_NOMEM;
+    }
+    frame_ring_reader_init(&stream->reader, stream_ring);
+    stream->width = stream_width;
+    stream->height = stream_height;
+    stream->payload_size = frame_ring_frame_size(stream_ring);
+    stream->payload_offset = stream->payload_size;
+
+    char width[16], height[16];
+    snprintf(width, sizeof(width), "%" PRIi32, stream_width);
+    snprintf(height, sizeof(height), "%" PRIi32, stream_height);
+    const char *format = stream_format;
+
+    stream_readers++;
+    stream_open_calls++;
+    notify_stream_readers_changed();
+    pthread_mutex_unlock(&stream_lock);
+
+    if (stream_timestamps) {
+        init_stream_matroska(stream, format);
+        /* --demuxer was read before the stream was opened, and demux_mkv
+         * only gets to probe the stream if it isn't forced to rawvideo */
+        char *demuxer = mpv_get_property_string(hmpv, "demuxer");
+        if (demuxer && strcmp(demuxer, "rawvideo") == 0)
+            logger("--demuxer=rawvideo can't read the Matroska stream of mpvif-capture-timestamps, drop it");
+        mpv_free(demuxer);
+    } else {
+        set_stream_option("demuxer-rawvideo-w", width);
+        set_stream_option("demuxer-rawvideo-h", height);
+        set_stream_option("demuxer-rawvideo-mp-format", format);
     }
-}
 
-static void set_fullscreen_title(void)
-{
-    snprintf(media_title, sizeof(media_title), "[%s] %s [%s %s %s]",
-            current_eligible_toplevel->app_id, current_eligible_toplevel->title,
-            remote_display_name, remote_output_name, remote_seat_name);
-    mpv_set_property_string(hmpv, "force-media-title", media_title);
-}
+    pthread_mutex_lock(&stream_lock);
+    stream_open_calls--;
+    pthread_cond_broadcast(&stream_cond);
+    pthread_mutex_unlock(&stream_lock);
 
-static void set_generic_title(void)
-{
-    snprintf(media_title, sizeof(media_title), "Remote desktop [%s %s %s]",
-            remote_display_name, remote_output_name, remote_seat_name);
-    mpv_set_property_string(hmpv, "force-media-title", media_title);
-}
+    if (stream_yuv_depth && !init_stream_conversion(stream)) {
+        stream_close(stream);
+        return MPV_ERROR_NOMEM;
+    }
 
-static void unset_title(void)
-{
-    mpv_set_property_string(hmpv, "force-media-title", "");
+    info->cookie = stream;
+    info->read_fn = stream_read;
+    info->close_fn = stream_close;
+    info->cancel_fn = stream_cancel;
+    return 0;
 }
 
-static bool is_eligible_toplevel(struct wayland_toplevel_handle *tl)
+static uint64_t hash_cursor_image(const uint32_t *data, int32_t width,
+        int32_t height)
 {
-    /* FIXME: sway/wlroots bug where output_leave is sent after sending state
-     * with fullscreen enum when the window is also set to floating */
-    return tl->title && tl->app_id && tl->fullscreen;
-}
+    /* FNV-1a */
+    uint64_t hash = 0xcbf29ce484222325;
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t len = (size_t)width * height * 4;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
 
-static bool should_create_virtual_pointer(void)
-{
-    return !virtual_pointer && remote_output && remote_seat &&
-        input_forwarding_enabled && !force_grab_cursor_enabled;
+    hash ^= (uint64_t)width << 32 | (uint32_t)height;
+    hash *= 0x100000001b3;
+    return hash;
 }
 
-static void create_virtual_pointer(void)
+static void destroy_cursor_image(struct cursor_image *image)
 {
-    virtual_pointer =
-        zwlr_virtual_pointer_manager_v1_create_virtual_pointer_with_output(
-                virtual_pointer_manager, remote_seat->obj, remote_output->obj);
-    if (mpv_observe_property(hmpv, mouse_pos_reply_userdata, "mouse-pos", MPV_FORMAT_NODE) != 0)
-        logger("failed to observe the mouse-pos property");
+    wl_list_remove(&image->link);
+    cursor_image_count--;
+    free(image->data);
+    free(image);
 }
 
-static void destroy_virtual_pointer(void)
+static void evict_cursor_images(void)
 {
-    zwlr_virtual_pointer_v1_destroy(virtual_pointer);
-    virtual_pointer = NULL;
-    if (mpv_unobserve_property(hmpv, mouse_pos_reply_userdata) < 0)
-        logger("failed to unobserve the mouse-pos property");
+    /* the list is kept in most recently used order */
+    struct cursor_image *image, *image_tmp;
+    wl_list_for_each_reverse_safe(image, image_tmp, &cursor_image_list, link) {
+        if (cursor_image_count <= CURSOR_IMAGE_CACHE_SIZE)
+            return;
+        if (image->pending_commands || image == cursor.image ||
+                image == cursor_overlay_image)
+            continue;
+        destroy_cursor_image(image);
+    }
 }
 
-static void destroy_toplevel_handle(struct wayland_toplevel_handle *tl)
+static struct cursor_image *get_cursor_image(const uint32_t *data,
+        int32_t width, int32_t height)
 {
-    if (current_eligible_toplevel == tl) {
-        current_eligible_toplevel = NULL;
-        set_generic_title();
+    uint64_t hash = hash_cursor_image(data, width, height);
+
+    struct cursor_image *image;
+    wl_list_for_each(image, &cursor_image_list, link) {
+        if (image->hash == hash && image->width == width &&
+                image->height == height) {
+            wl_list_remove(&image->link);
+            wl_list_insert(&cursor_image_list, &image->link);
+            return image;
+        }
     }
 
-    zwlr_foreign_toplevel_handle_v1_destroy(tl->obj);
-    free(tl->title);
-    free(tl->app_id);
-    wl_list_remove(&tl->link);
-    free(tl);
+    image = calloc(1, sizeof(*image));
+    if (!image)
+        return NULL;
+
+    size_t size = (size_t)width * height * 4;
+    image->data = malloc(size);
+    if (!image->data) {
+        free(image);
+        return NULL;
+    }
+
+    memcpy(image->data, data, size);
+    image->hash = hash;
+    image->width = width;
+    image->height = height;
+    wl_list_insert(&cursor_image_list, &image->link);
+    cursor_image_count++;
+
+    evict_cursor_images();
+    return image;
 }
 
-static bool should_create_data_control_device(void)
+static void hide_cursor_overlay(void)
 {
-    return !data_control_device && remote_seat && input_forwarding_enabled;
+    mpv_command_async(hmpv, 0, (const char *[]){"overlay-remove",
+            CURSOR_OVERLAY_ID, NULL});
+    cursor_overlay_shown = false;
+    cursor_overlay_image = NULL;
 }
 
-static void create_data_control_device(void)
+/*
+ * The remote cursor is drawn as an overlay at the host pointer position, so it
+ * moves at the rate mpv receives pointer motion and redraws the OSD, instead of
+ * being baked into the captured frames. It's drawn unscaled. Called at most
+ * once per loop iteration, so a burst of motion results in one command.
+ */
+static void update_cursor_overlay(void)
 {
-    data_control_device = ext_data_control_manager_v1_get_data_device(
-            data_control_manager, remote_seat->obj);
-    ext_data_control_device_v1_add_listener(data_control_device,
-            &data_control_device_listener, NULL);
-    if (mpv_observe_property(hmpv, clipboard_text_reply_userdata,
-                "clipboard/text", MPV_FORMAT_STRING) != 0)
-        logger("failed to observe the clipboard/text property");
-    if (mpv_observe_property(hmpv, clipboard_text_primary_reply_userdata,
-                "clipboard/text-primary", MPV_FORMAT_STRING) != 0)
-        logger("failed to observe the clipboard/text-primary property");
+    cursor_overlay_dirty = false;
+
+    struct cursor_image *image = cursor.image;
+    if (!image || !cursor.entered || !mouse_pos_observed || !host_mouse_v.hover) {
+        if (cursor_overlay_shown)
+            hide_cursor_overlay();
+        return;
+    }
+
+    int64_t x = host_mouse_v.x - cursor.hotspot_x;
+    int64_t y = host_mouse_v.y - cursor.hotspot_y;
+
+    if (cursor_overlay_shown && cursor_overlay_image == image &&
+            cursor_overlay_x == x && cursor_overlay_y == y)
+        return;
+
+    /* overlay-add doesn't take negative positions, crop instead */
+    int32_t crop_x = x < 0 ? -x : 0;
+    int32_t crop_y = y < 0 ? -y : 0;
+    if (crop_x >= image->width || crop_y >= image->height) {
+        if (cursor_overlay_shown)
+            hide_cursor_overlay();
+        return;
+    }
+
+    char x_str[24], y_str[24], addr_str[32], w_str[16], h_str[16], stride_str[16];
+    snprintf(x_str, sizeof(x_str), "%" PRId64, x + crop_x);
+    snprintf(y_str, sizeof(y_str), "%" PRId64, y + crop_y);
+    snprintf(addr_str, sizeof(addr_str), "&%" PRIuPTR,
+            (uintptr_t)(image->data + crop_y * image->width + crop_x));
+    snprintf(w_str, sizeof(w_str), "%" PRId32, image->width - crop_x);
+    snprintf(h_str, sizeof(h_str), "%" PRId32, image->height - crop_y);
+    snprintf(stride_str, sizeof(stride_str), "%" PRId32, image->width * 4);
+
+    const char *args[] = {"overlay-add", CURSOR_OVERLAY_ID,
+        x_str, y_str, addr_str, "0", "bgra", w_str, h_str, stride_str, NULL};
+
+    /* mpv reads the image when it runs the command, the reply tells us when
+     * the image may be evicted */
+    if (mpv_command_async(hmpv, (uint64_t)(uintptr_t)image, args) < 0) {
+        logger("failed to add the cursor overlay");
+        return;
+    }
+
+    image->pending_commands++;
+    cursor_overlay_shown = true;
+    cursor_overlay_image = image;
+    cursor_overlay_x = x;
+    cursor_overlay_y = y;
 }
 
-static void destroy_data_control_device(void)
+static void destroy_cursor_images(void)
 {
-    ext_data_control_device_v1_destroy(data_control_device);
-    data_control_device = NULL;
-    if (mpv_unobserve_property(hmpv, clipboard_text_reply_userdata) < 0)
-        logger("failed to unobserve the clipboard/text property");
-    if (mpv_unobserve_property(hmpv, clipboard_text_primary_reply_userdata) < 0)
-        logger("failed to unobserve the clipboard/text-primary property");
+    if (wl_list_empty(&cursor_image_list))
+        return;
+
+    /* a synchronous command runs after the queued asynchronous ones, so
+     * nothing will read the images after this returns */
+    mpv_command(hmpv, (const char *[]){"overlay-remove",
+            CURSOR_OVERLAY_ID, NULL});
+    cursor_overlay_shown = false;
+    cursor_overlay_image = NULL;
+
+    struct cursor_image *image, *image_tmp;
+    wl_list_for_each_safe(image, image_tmp, &cursor_image_list, link)
+        destroy_cursor_image(image);
 }
 
 static void destroy_data_control_source(struct wayland_data_control_source *ds)
@@ -779,6 +4746,12 @@ static void destroy_output(struct wayland_output *o)
     if (o == remote_output) {
         if (virtual_pointer)
             destroy_virtual_pointer();
+        if (pointer_warp)
+            destroy_pointer_warp();
+        if (cursor.cursor_session)
+            destroy_cursor_capture();
+        if (capture.session)
+            destroy_output_capture();
         remote_output = NULL;
     }
 
@@ -794,6 +4767,12 @@ static void destroy_seat(struct wayland_seat *s)
             destroy_virtual_pointer();
         if (data_control_device)
             destroy_data_control_device();
+        if (pointer_warp)
+            destroy_pointer_warp();
+        if (pointer_constraints)
+            destroy_pointer_constraints();
+        if (cursor.cursor_session)
+            destroy_cursor_capture();
         remote_seat = NULL;
     }
 
@@ -802,7 +4781,8 @@ static void destroy_seat(struct wayland_seat *s)
     free(s);
 }
 
-static void receive_offer(bool primary)
+/* returns the number of bytes received */
+static size_t receive_offer(bool primary)
 {
     char read_buf[4096];
     FILE *mem_fp;
@@ -812,19 +4792,19 @@ static void receive_offer(bool primary)
 
     if (pipe2(receive_pipe, O_CLOEXEC) == -1) {
         logger("pipe2() failed: %m");
-        return;
+        return 0;
     }
 
     if (!(mem_fp = open_memstream(&mem_data, &mem_size))) {
         logger("open_memstream() failed: %m");
         close(receive_pipe[0]);
         close(receive_pipe[1]);
-        return;
+        return 0;
     }
 
     ext_data_control_offer_v1_receive(dc_offer, utf8_mimes[dc_offer_mime_idx],
             receive_pipe[1]);
-    wl_display_flush(display);
+    flush_display();
     close(receive_pipe[1]);
 
     while (true) {
@@ -834,7 +4814,7 @@ static void receive_offer(bool primary)
             fclose(mem_fp);
             close(receive_pipe[0]);
             free(mem_data);
-            return;
+            return 0;
         }
 
         if (ret == 0)
@@ -852,6 +4832,8 @@ static void receive_offer(bool primary)
         mpv_set_property_string(hmpv, prop, mem_data);
 
     free(mem_data);
+    /* without the terminator */
+    return mem_size ? mem_size - 1 : 0;
 }
 
 static void handle_selection(struct ext_data_control_offer_v1 *id, bool primary)
@@ -863,12 +4845,17 @@ static void handle_selection(struct ext_data_control_offer_v1 *id, bool primary)
     }
 
     if (id != dc_offer) {
-        logger("unexpected data offer offer event, shouldn't happen");
+        logger_at(LOG_LEVEL_WARN, "unexpected data offer offer event, shouldn't happen");
         return;
     }
 
-    if (!dc_offer_is_our_own && dc_offer_mime_idx != -1)
-        receive_offer(primary);
+    if (!dc_offer_is_our_own && dc_offer_mime_idx != -1) {
+        int64_t start = handler_begin();
+        size_t size = receive_offer(primary);
+        handler_end(HANDLER_RECEIVE_OFFER, start, size);
+        counters.clipboard_in++;
+        counters.clipboard_in_bytes += size;
+    }
 
     destroy_dc_offer();
 }
@@ -930,29 +4917,60 @@ set_null:
 
 static void pchg_mouse_pos(mpv_node *node)
 {
-    if (!virtual_pointer)
+    if (!virtual_pointer || !mouse_pos_observed)
         return;
 
+    int64_t received = latency_sampling || journal ? monotonic_ns() : 0;
+    counters.mouse_pos++;
     struct mouse_pos_values mouse_v = mouse_node_get_values(node);
 
+    host_mouse_v = mouse_v;
+    cursor_overlay_dirty = true;
+
     int32_t denominator_x = osd_v.w - osd_v.ml - osd_v.mr;
     int32_t denominator_y = osd_v.h - osd_v.mt - osd_v.mb;
 
-    if ((denominator_x == 0) || (denominator_y == 0))
+    if ((denominator_x == 0) || (denominator_y == 0)) {
+        if (journal)
+            journal_add(journal, JOURNAL_MOUSE_POS, received,
+                    (int32_t[]){mouse_v.x, mouse_v.y, mouse_v.hover}, 3);
         return;
+    }
 
-    int32_t video_pos_x = (mouse_v.x - osd_v.ml) * video_v.w / denominator_x;
-    int32_t video_pos_y = (mouse_v.y - osd_v.mt) * video_v.h / denominator_y;
+    /* the OSD margins surround the cropped part of the video */
+    int32_t video_pos_x = video_v.crop_x +
+        (mouse_v.x - osd_v.ml) * video_v.crop_w / denominator_x;
+    int32_t video_pos_y = video_v.crop_y +
+        (mouse_v.y - osd_v.mt) * video_v.crop_h / denominator_y;
 
-    video_pos_x = MAX(video_pos_x, 0);
-    video_pos_y = MAX(video_pos_y, 0);
+    video_pos_x = MAX(video_pos_x, video_v.crop_x);
+    video_pos_y = MAX(video_pos_y, video_v.crop_y);
 
-    video_pos_x = MIN(video_pos_x, video_v.w);
-    video_pos_y = MIN(video_pos_y, video_v.h);
+    video_pos_x = MIN(video_pos_x, video_v.crop_x + video_v.crop_w);
+    video_pos_y = MIN(video_pos_y, video_v.crop_y + video_v.crop_h);
 
-    zwlr_virtual_pointer_v1_motion_absolute(virtual_pointer, timestamp(),
+    int time = timestamp();
+    zwlr_virtual_pointer_v1_motion_absolute(virtual_pointer, time,
             video_pos_x, video_pos_y, video_v.w, video_v.h);
     zwlr_virtual_pointer_v1_frame(virtual_pointer);
+    /* one record (cache line) per event */
+    if (journal)
+        journal_add(journal, JOURNAL_MOTION, received,
+                (int32_t[]){mouse_v.x, mouse_v.y, mouse_v.hover, time,
+                video_pos_x, video_pos_y, video_v.w, video_v.h}, 8);
+    logger_at(LOG_LEVEL_TRACE, "motion to %d,%d", video_pos_x, video_pos_y);
+
+    /* the motion_absolute and frame requests */
+    if (trace_ring)
+        trace_ring_add(trace_ring, "motion", monotonic_ns(), -1, "bytes", 36);
+
+    counters.motions++;
+    motions_unflushed = true;
+
+    if (latency_sampling &&
+            unflushed_motion_count < (int)(sizeof(unflushed_motions) /
+                sizeof(unflushed_motions[0])))
+        unflushed_motions[unflushed_motion_count++] = received;
 }
 
 static void pchg_clipboard_text(char **string)
@@ -968,27 +4986,61 @@ static void pchg_clipboard_text_primary(char **string)
 static void pchg_osd_dimensions(mpv_node *node)
 {
     osd_node_get_values(node);
+
+    /* wait until the window has settled, e.g. while it is being resized */
+    if (integer_scale)
+        timer_arm(&integer_scale_timer, monotonic_ms() + 500);
 }
 
 static void pchg_video_params(mpv_node *node)
 {
     video_node_get_values(node);
+    /* the crop is in video pixels */
+    auto_crop_pending = true;
+    shader_select_pending = true;
+}
+
+static void pchg_window_minimized(int *value)
+{
+    window_minimized = *value;
+    update_output_throttle();
+}
+
+static void pchg_focused(int *value)
+{
+    window_focused = *value;
+    update_output_throttle();
 }
 
 static void pchg_wayland_remote_input_forwarding(int *value)
 {
     input_forwarding_enabled = *value;
+    if (journal)
+        journal_add(journal, JOURNAL_TOGGLE, monotonic_ns(),
+                (int32_t[]){JOURNAL_TOGGLE_INPUT_FORWARDING, *value}, 2);
     if (!input_forwarding_enabled && virtual_pointer)
         destroy_virtual_pointer();
     if (should_create_virtual_pointer())
         create_virtual_pointer();
+    update_auto_grab();
 }
 
 static void pchg_wayland_remote_force_grab_cursor(int *value)
 {
     force_grab_cursor_enabled = *value;
-    if (force_grab_cursor_enabled && virtual_pointer)
-        destroy_virtual_pointer();
+    if (journal)
+        journal_add(journal, JOURNAL_TOGGLE, monotonic_ns(),
+                (int32_t[]){JOURNAL_TOGGLE_FORCE_GRAB_CURSOR, *value}, 2);
+    if (!force_grab_cursor_enabled)
+        auto_grabbed = false;
+
+    if (virtual_pointer) {
+        if (force_grab_cursor_enabled && mouse_pos_observed)
+            unobserve_mouse_pos();
+        else if (!force_grab_cursor_enabled && !mouse_pos_observed)
+            observe_mouse_pos();
+    }
+
     if (should_create_virtual_pointer())
         create_virtual_pointer();
 }
@@ -1003,15 +5055,17 @@ static void property_change_event(mpv_event *event)
     mpv_event_property *event_prop = event->data;
 
     if (strcmp(event_prop->name, "mouse-pos") == 0) {
-        if (event_prop->format == MPV_FORMAT_NODE)
+        if (event_prop->format == MPV_FORMAT_NODE) {
+            int64_t start = handler_begin();
             pchg_mouse_pos(event_prop->data);
-        else
-            logger("mouse-pos property unavailable/error");
+            handler_end(HANDLER_MOUSE_POS, start, 0);
+        } else
+            logger_at(LOG_LEVEL_ERROR, "mouse-pos property unavailable/error");
     } else if (strcmp(event_prop->name, "osd-dimensions") == 0) {
         if (event_prop->format == MPV_FORMAT_NODE)
             pchg_osd_dimensions(event_prop->data);
         else
-            logger("osd-dimensions property unavailable/error");
+            logger_at(LOG_LEVEL_ERROR, "osd-dimensions property unavailable/error");
     } else if (strcmp(event_prop->name, "video-params") == 0) {
         if (event_prop->format == MPV_FORMAT_NODE)
             pchg_video_params(event_prop->data);
@@ -1025,13 +5079,60 @@ static void property_change_event(mpv_event *event)
         if (event_prop->format == MPV_FORMAT_FLAG)
             pchg_wayland_remote_input_forwarding(event_prop->data);
         else
-            logger("wayland-remote-input-forwarding property unavailable/error");
+            logger_at(LOG_LEVEL_ERROR, "wayland-remote-input-forwarding property unavailable/error");
     } else if (strcmp(event_prop->name, "wayland-remote-force-grab-cursor") == 0) {
         if (event_prop->format == MPV_FORMAT_FLAG)
             pchg_wayland_remote_force_grab_cursor(event_prop->data);
         else
-            logger("wayland-remote-force-grab-cursor property unavailable/error");
+            logger_at(LOG_LEVEL_ERROR, "wayland-remote-force-grab-cursor property unavailable/error");
+    } else if (strcmp(event_prop->name, "window-minimized") == 0) {
+        if (event_prop->format == MPV_FORMAT_FLAG)
+            pchg_window_minimized(event_prop->data);
+    } else if (strcmp(event_prop->name, "focused") == 0) {
+        if (event_prop->format == MPV_FORMAT_FLAG)
+            pchg_focused(event_prop->data);
+    } else if (strcmp(event_prop->name, "msg-level") == 0) {
+        if (event_prop->format == MPV_FORMAT_STRING)
+            pchg_msg_level(*(char **)event_prop->data);
+    }
+}
+
+static void command_reply_event(mpv_event *event)
+{
+    /* overlay-add replies carry the image they read from */
+    if (event->reply_userdata) {
+        struct cursor_image *image =
+            (struct cursor_image *)(uintptr_t)event->reply_userdata;
+        image->pending_commands--;
+    }
+}
+
+static void write_trace(const char *path)
+{
+    if (!trace_ring) {
+        logger("tracing is disabled, enable it with --script-opts=mpvif-trace=FILE");
+        return;
     }
+
+    /* on mpv's clock, like the timestamps of --dump-stats */
+    int64_t clock_offset = mpv_get_time_ns(hmpv) - monotonic_ns();
+    if (trace_ring_write(trace_ring, path, clock_offset))
+        logger("wrote the trace to %s", path);
+    else
+        logger("failed to write the trace to %s: %m", path);
+}
+
+static void client_message_event(mpv_event *event)
+{
+    mpv_event_client_message *msg = event->data;
+
+    if (msg->num_args > 0 && strcmp(msg->args[0], "mpvif-stats") == 0)
+        handle_stats_message(msg->num_args, msg->args);
+    else if (msg->num_args > 0 && strcmp(msg->args[0], "mpvif-trace") == 0)
+        write_trace(msg->num_args > 1 ? msg->args[1] : trace_path);
+    else if (msg->num_args > 0 && strcmp(msg->args[0], "mpvif-overlay") == 0)
+        set_overlay_shown(msg->num_args > 1 ?
+                strcmp(msg->args[1], "yes") == 0 : !overlay_shown);
 }
 
 static int dispatch_mpv_events(void)
@@ -1039,25 +5140,38 @@ static int dispatch_mpv_events(void)
     char drain[4096];
     (void)!read(wakeup_pipe[0], drain, sizeof(drain));
 
+    int64_t start = handler_begin();
+    int events = 0;
+
     while (true) {
         mpv_event *event = mpv_wait_event(hmpv, 0);
         switch (event->event_id) {
             case MPV_EVENT_SHUTDOWN:
                 return -1;
             case MPV_EVENT_NONE:
+                handler_end(HANDLER_MPV_DISPATCH, start, events);
                 return 0;
             case MPV_EVENT_PROPERTY_CHANGE:
                 property_change_event(event);
                 break;
+            case MPV_EVENT_COMMAND_REPLY:
+                command_reply_event(event);
+                break;
+            case MPV_EVENT_CLIENT_MESSAGE:
+                client_message_event(event);
+                break;
             default:
                 break;
         }
+        events++;
     }
 }
 
 static void update_output_layout_pos(void)
 {
+    int64_t start = monotonic_ns();
     I3ipc_reply_outputs *reply = i3ipc_get_outputs();
+    counters.i3ipc_request_time = monotonic_ns() - start;
     /* During the main loop, poll would just fail. This is for the first call in
      * mpv_open_cplugin. */
     if (i3ipc_error_code() == I3IPC_ERROR_CLOSED)
@@ -1071,6 +5185,8 @@ static void update_output_layout_pos(void)
         if (strcmp(output->name, remote_output_name) == 0) {
             output_layout_x = output->rect.x;
             output_layout_y = output->rect.y;
+            output_layout_w = output->rect.width;
+            output_layout_h = output->rect.height;
             break;
         }
     }
@@ -1081,6 +5197,152 @@ static void update_output_layout_pos(void)
 static void i3e_output(I3ipc_event *ev_any)
 {
     update_output_layout_pos();
+    auto_crop_pending = true;
+}
+
+static void i3e_window(I3ipc_event *ev_any)
+{
+    I3ipc_event_window *ev = &ev_any->window;
+
+    switch (ev->change_enum) {
+        case I3IPC_WINDOW_CHANGE_NEW:
+        case I3IPC_WINDOW_CHANGE_CLOSE:
+        case I3IPC_WINDOW_CHANGE_FOCUS:
+        case I3IPC_WINDOW_CHANGE_FULLSCREEN_MODE:
+        case I3IPC_WINDOW_CHANGE_MOVE:
+            auto_crop_pending = true;
+            break;
+        default:
+            break;
+    }
+}
+
+static I3ipc_node *find_node_by_id(I3ipc_node *parent, size_t id)
+{
+    for (int i = 0; i < parent->nodes_size; i++) {
+        if (parent->nodes[i].id == id)
+            return &parent->nodes[i];
+    }
+
+    return NULL;
+}
+
+static I3ipc_node *find_fullscreen_node(I3ipc_node *node)
+{
+    if (node->fullscreen_mode == 1)
+        return node;
+
+    for (int i = 0; i < node->nodes_size; i++) {
+        I3ipc_node *found = find_fullscreen_node(&node->nodes[i]);
+        if (found)
+            return found;
+    }
+
+    for (int i = 0; i < node->floating_nodes_size; i++) {
+        I3ipc_node *found = find_fullscreen_node(&node->floating_nodes[i]);
+        if (found)
+            return found;
+    }
+
+    return NULL;
+}
+
+/* finds the part of the remote output the fullscreen view actually draws to,
+ * in output-local layout coordinates. returns false if it covers the whole
+ * output or isn't known. */
+static bool get_content_rect(I3ipc_rect *content)
+{
+    int64_t start = monotonic_ns();
+    I3ipc_reply_tree *reply = i3ipc_get_tree();
+    counters.i3ipc_request_time = monotonic_ns() - start;
+    if (!reply)
+        return false;
+
+    bool ret = false;
+    I3ipc_node *output = NULL;
+    for (int i = 0; i < reply->root.nodes_size; i++) {
+        I3ipc_node *node = &reply->root.nodes[i];
+        if (node->name && strcmp(node->name, remote_output_name) == 0) {
+            output = node;
+            break;
+        }
+    }
+
+    /* the first focus entry of an output is its visible workspace */
+    I3ipc_node *workspace = NULL;
+    if (output && output->focus_size > 0)
+        workspace = find_node_by_id(output, output->focus[0]);
+
+    I3ipc_node *view = NULL;
+    if (workspace)
+        view = find_fullscreen_node(workspace);
+
+    /* a fullscreened split container doesn't have a single content rect */
+    if (!view || view->nodes_size > 0 || view->window_rect.width <= 0 ||
+            view->window_rect.height <= 0)
+        goto out;
+
+    int32_t x = view->rect.x - output_layout_x + view->window_rect.x;
+    int32_t y = view->rect.y - output_layout_y + view->window_rect.y;
+    int32_t w = view->window_rect.width;
+    int32_t h = view->window_rect.height;
+
+    /* sway centers a surface smaller than its fullscreen container and
+     * leaves the rest black */
+    if (view->geometry.width > 0 && view->geometry.width < w) {
+        x += (w - view->geometry.width) / 2;
+        w = view->geometry.width;
+    }
+    if (view->geometry.height > 0 && view->geometry.height < h) {
+        y += (h - view->geometry.height) / 2;
+        h = view->geometry.height;
+    }
+
+    x = MAX(x, 0);
+    y = MAX(y, 0);
+    w = MIN(w, output_layout_w - x);
+    h = MIN(h, output_layout_h - y);
+
+    if (w <= 0 || h <= 0 ||
+            (x == 0 && y == 0 && w == output_layout_w && h == output_layout_h))
+        goto out;
+
+    *content = (I3ipc_rect){ .x = x, .y = y, .width = w, .height = h };
+    ret = true;
+
+out:
+    free(reply);
+    return ret;
+}
+
+static void update_auto_crop(void)
+{
+    auto_crop_pending = false;
+
+    if (!auto_crop_enabled || !video_v.w || !video_v.h)
+        return;
+
+    char crop[sizeof(auto_crop)] = "";
+    I3ipc_rect content;
+    if (current_eligible_toplevel && output_layout_w > 0 &&
+            output_layout_h > 0 && get_content_rect(&content)) {
+        /* the layout is in logical coordinates, the video in buffer pixels */
+        int64_t x = (int64_t)content.x * video_v.w / output_layout_w;
+        int64_t y = (int64_t)content.y * video_v.h / output_layout_h;
+        int64_t w = (int64_t)content.width * video_v.w / output_layout_w;
+        int64_t h = (int64_t)content.height * video_v.h / output_layout_h;
+        snprintf(crop, sizeof(crop), "%" PRId64 "x%" PRId64 "+%" PRId64
+                "+%" PRId64, w, h, x, y);
+    }
+
+    if (strcmp(crop, auto_crop) == 0)
+        return;
+    memcpy(auto_crop, crop, sizeof(auto_crop));
+
+    char *crop_ptr = auto_crop;
+    if (mpv_set_property_async(hmpv, 0, "video-crop",
+                MPV_FORMAT_STRING, &crop_ptr) < 0)
+        logger("failed to set the video-crop property");
 }
 
 static void set_mpv_mouse_pos(int64_t x, int64_t y)
@@ -1105,15 +5367,16 @@ static void set_mpv_mouse_pos(int64_t x, int64_t y)
     mpv_set_property(hmpv, "mouse-pos", MPV_FORMAT_NODE, &mouse_pos_node);
 }
 
-static void i3e_cursor_warp(I3ipc_event *ev_any)
+static void relay_pointer_warp(int output_local_x, int output_local_y)
 {
-    I3ipc_event_cursor_warp *ev = (I3ipc_event_cursor_warp *)ev_any;
+    if ((video_v.w == 0) || (video_v.h == 0))
+        return;
 
-    int output_local_x = ev->lx - output_layout_x;
-    int output_local_y = ev->ly - output_layout_y;
+    if ((video_v.crop_w == 0) || (video_v.crop_h == 0))
+        return;
 
-    int64_t mouse_pos_x = (output_local_x * (osd_v.w - osd_v.ml - osd_v.mr) / video_v.w) + osd_v.ml;
-    int64_t mouse_pos_y = (output_local_y * (osd_v.h - osd_v.mt - osd_v.mb) / video_v.h) + osd_v.mt;
+    int64_t mouse_pos_x = ((output_local_x - video_v.crop_x) * (osd_v.w - osd_v.ml - osd_v.mr) / video_v.crop_w) + osd_v.ml;
+    int64_t mouse_pos_y = ((output_local_y - video_v.crop_y) * (osd_v.h - osd_v.mt - osd_v.mb) / video_v.crop_h) + osd_v.mt;
 
     mouse_pos_x = MAX(mouse_pos_x, 0);
     mouse_pos_x = MIN(mouse_pos_x, osd_v.w);
@@ -1121,15 +5384,41 @@ static void i3e_cursor_warp(I3ipc_event *ev_any)
     mouse_pos_y = MAX(mouse_pos_y, 0);
     mouse_pos_y = MIN(mouse_pos_y, osd_v.h);
 
+    logger_at(LOG_LEVEL_TRACE, "warp to %d,%d, mouse-pos %" PRId64 ",%" PRId64,
+            output_local_x, output_local_y, mouse_pos_x, mouse_pos_y);
+    counters.warps++;
+    if (journal)
+        journal_add(journal, JOURNAL_WARP, monotonic_ns(),
+                (int32_t[]){output_local_x, output_local_y, mouse_pos_x,
+                mouse_pos_y}, 4);
     set_mpv_mouse_pos(mouse_pos_x, mouse_pos_y);
 }
 
+static void i3e_cursor_warp(I3ipc_event *ev_any)
+{
+    I3ipc_event_cursor_warp *ev = (I3ipc_event_cursor_warp *)ev_any;
+
+    /* the compositor also tells us through mpvif-pointer-warp-v1, which is
+     * already output-local */
+    if (pointer_warp)
+        return;
+
+    relay_pointer_warp(ev->lx - output_layout_x, ev->ly - output_layout_y);
+}
+
 static int dispatch_i3ipc_events(void)
 {
+    int64_t start = handler_begin();
+    int events = 0;
+
     while (true) {
         I3ipc_event *ev_any = i3ipc_event_next(0);
-        if (!ev_any)
+        if (!ev_any) {
+            handler_end(HANDLER_I3IPC_DISPATCH, start, events);
             return 0;
+        }
+        events++;
+        counters.i3ipc_events++;
 
         switch (ev_any->type) {
             case I3IPC_EVENT_SHUTDOWN:
@@ -1141,6 +5430,9 @@ static int dispatch_i3ipc_events(void)
             case I3IPC_EVENT_CURSOR_WARP:
                 i3e_cursor_warp(ev_any);
                 break;
+            case I3IPC_EVENT_WINDOW:
+                i3e_window(ev_any);
+                break;
             default:
                 break;
         }
@@ -1153,9 +5445,20 @@ int mpv_open_cplugin(mpv_handle *mpv)
 {
     int rc = -1;
     hmpv = mpv;
+    plugin_thread = pthread_self();
+    log_ring = log_ring_create(256);
     wl_list_init(&wayland_output_list);
     wl_list_init(&wayland_seat_list);
     wl_list_init(&wayland_toplevel_handle_list);
+    wl_list_init(&cursor_image_list);
+    wl_list_init(&timer_list);
+    wl_list_init(&output_head_list);
+    wl_list_init(&app_profile_list);
+
+    char *msg_level = mpv_get_property_string(hmpv, "msg-level");
+    pchg_msg_level(msg_level);
+    mpv_free(msg_level);
+    mpv_observe_property(hmpv, 0, "msg-level", MPV_FORMAT_STRING);
 
     remote_display_name = mpv_get_property_string(hmpv, "wayland-remote-display-name");
     if (!str_is_set(remote_display_name)) {
@@ -1176,8 +5479,154 @@ int mpv_open_cplugin(mpv_handle *mpv)
     }
 
     remote_swaysock = mpv_get_property_string(hmpv, "wayland-remote-swaysock");
-    if (!str_is_set(remote_swaysock))
-        logger("no remote swaysock set, will not relay application pointer warps to the host");
+
+    cursor_enabled = script_opt_flag("cursor", false);
+    title_rate_limit = script_opt_int("title-rate-limit", title_rate_limit);
+    toplevel_lite_enabled = script_opt_flag("toplevel-lite", false);
+    auto_crop_enabled = script_opt_flag("auto-crop", false);
+    adaptive_refresh_enabled = script_opt_flag("adaptive-refresh", false);
+    int refresh_min = script_opt_int("adaptive-refresh-min", 30);
+    if (refresh_min < 1) {
+        logger("invalid value for mpvif-adaptive-refresh-min: %d (expected at least 1)", refresh_min);
+        refresh_min = 30;
+    }
+    adaptive_refresh_min = refresh_min * 1000;
+
+    int hidden_refresh_hz = script_opt_int("hidden-refresh", 0);
+    if (hidden_refresh_hz < 0) {
+        logger("invalid value for mpvif-hidden-refresh: %d (expected 0 or more)", hidden_refresh_hz);
+        hidden_refresh_hz = 0;
+    }
+    hidden_refresh = hidden_refresh_hz * 1000;
+    hidden_unfocused = script_opt_flag("hidden-unfocused", false);
+
+    char *profiles_opt = script_opt("profiles");
+    if (profiles_opt) {
+        init_app_profiles(profiles_opt);
+        free(profiles_opt);
+    }
+
+    char *shader_chains_opt = script_opt("shader-chains");
+    if (shader_chains_opt) {
+        char *shader_cache_opt = script_opt("shader-cache");
+        init_shader_selection(shader_chains_opt, shader_cache_opt);
+        free(shader_cache_opt);
+        free(shader_chains_opt);
+    }
+    shader_budget = script_opt_int("shader-budget", shader_budget);
+    if (shader_budget < 1 || shader_budget > 100) {
+        logger("invalid value for mpvif-shader-budget: %d (expected 1 to 100)", shader_budget);
+        shader_budget = 75;
+    }
+
+    char *integer_scale_opt = script_opt("integer-scale");
+    if (integer_scale_opt) {
+        char *end;
+        long factor = strtol(integer_scale_opt, &end, 10);
+        if (strcmp(integer_scale_opt, "auto") == 0 ||
+                strcmp(integer_scale_opt, "yes") == 0)
+            integer_scale = -1;
+        else if (*end == '\0' && factor >= 1 && factor <= 16)
+            integer_scale = factor;
+        else if (strcmp(integer_scale_opt, "no") != 0)
+            logger("invalid value for mpvif-integer-scale: %s (expected no, auto or a factor from 1 to 16)", integer_scale_opt);
+        free(integer_scale_opt);
+    }
+    latency_enabled = script_opt_flag("latency", false);
+
+    metrics_socket_path = script_opt("metrics-socket");
+    if (!str_is_set(metrics_socket_path)) {
+        free(metrics_socket_path);
+        metrics_socket_path = NULL;
+    }
+    metrics_file_path = script_opt("metrics-file");
+    if (!str_is_set(metrics_file_path)) {
+        free(metrics_file_path);
+        metrics_file_path = NULL;
+    }
+    metrics_interval = script_opt_int("metrics-interval", metrics_interval);
+    if (metrics_interval < 1) {
+        logger("invalid value for mpvif-metrics-interval: %d (expected at least 1)", metrics_interval);
+        metrics_interval = 15;
+    }
+    if (metrics_socket_path && !create_metrics_socket()) {
+        free(metrics_socket_path);
+        metrics_socket_path = NULL;
+    }
+
+    if (script_opt_flag("journal", false)) {
+        int journal_size = script_opt_int("journal-size", 65536);
+        if (journal_size < 1) {
+            logger("invalid value for mpvif-journal-size: %d (expected at least 1)", journal_size);
+            journal_size = 65536;
+        }
+        journal = journal_create(journal_size);
+        if (journal) {
+            /* readers open it through our fd table */
+            char path[64];
+            snprintf(path, sizeof(path), "/proc/%d/fd/%d", (int)getpid(),
+                    journal_fd(journal));
+            mpv_set_property_async(hmpv, 0, "user-data/mpvif/journal",
+                    MPV_FORMAT_STRING, &(char *){path});
+        } else {
+            logger("failed to create the input journal: %m");
+        }
+    }
+
+    latency_histograms = latency_enabled || metrics_socket_path ||
+        metrics_file_path;
+    latency_sampling = latency_histograms;
+    handler_stats_enabled = script_opt_flag("stats", false);
+
+    trace_path = script_opt("trace");
+    if (str_is_set(trace_path)) {
+        int trace_size = script_opt_int("trace-size", 65536);
+        if (trace_size < 1) {
+            logger("invalid value for mpvif-trace-size: %d (expected at least 1)", trace_size);
+            trace_size = 65536;
+        }
+        trace_ring = trace_ring_create(trace_size);
+    }
+    handler_timing_enabled = handler_stats_enabled || trace_ring;
+    capture_enabled = script_opt_flag("capture", false);
+    if (script_opt_flag("capture-dedup", true))
+        capture_tile_hash = tile_hash_best();
+
+    char *capture_format = script_opt("capture-format");
+    if (capture_format) {
+        if (strcmp(capture_format, "yuv444p") == 0)
+            stream_yuv_depth = 8;
+        else if (strcmp(capture_format, "yuv444p10") == 0)
+            stream_yuv_depth = 10;
+        else if (strcmp(capture_format, "rgb") != 0)
+            logger("invalid value for mpvif-capture-format: %s (expected rgb, yuv444p or yuv444p10)", capture_format);
+        free(capture_format);
+    }
+
+    stream_timestamps = script_opt_flag("capture-timestamps", false);
+    int max_latency = script_opt_int("capture-max-latency", 50);
+    stream_max_latency = MAX(max_latency, 0) * UINT64_C(1000);
+
+    /* the conversion is memory bound, more threads than this rarely help */
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    stream_threads = script_opt_int("capture-threads", MAX(MIN(cpus, 4), 1));
+    if (stream_threads < 1) {
+        logger("invalid value for mpvif-capture-threads: %d (expected at least 1)", stream_threads);
+        stream_threads = 1;
+    }
+
+    char *auto_grab = script_opt("auto-grab");
+    if (auto_grab) {
+        if (strcmp(auto_grab, "no") == 0)
+            auto_grab_mode = AUTO_GRAB_NO;
+        else if (strcmp(auto_grab, "lock") == 0 || strcmp(auto_grab, "yes") == 0)
+            auto_grab_mode = AUTO_GRAB_LOCK;
+        else if (strcmp(auto_grab, "lock-or-relative") == 0)
+            auto_grab_mode = AUTO_GRAB_LOCK_OR_RELATIVE;
+        else
+            logger("invalid value for mpvif-auto-grab: %s (expected no, lock or lock-or-relative)", auto_grab);
+        free(auto_grab);
+    }
 
     display = wl_display_connect(remote_display_name);
     if (!display) {
@@ -1205,13 +5654,40 @@ int mpv_open_cplugin(mpv_handle *mpv)
     if (!data_control_manager)
         logger("failed to get the optional data control manager object, clipboard synchronization won't work");
 
+    if (!pointer_warp_manager && !str_is_set(remote_swaysock))
+        logger("no pointer warp manager object and no remote swaysock set, will not relay application pointer warps to the host");
+
+    if (cursor_enabled && (!shm || !output_capture_source_manager || !copy_capture_manager))
+        logger("mpvif-cursor is enabled but the compositor doesn't support ext-image-copy-capture, cursor image synchronization won't work");
+
+    if (capture_enabled && (!shm || !output_capture_source_manager || !copy_capture_manager))
+        logger("mpvif-capture is enabled but the compositor doesn't support ext-image-copy-capture, the mpvif:// stream won't work");
+
+    if (adaptive_refresh_enabled && !output_manager)
+        logger("mpvif-adaptive-refresh is enabled but the compositor doesn't support wlr-output-management, the refresh rate won't be adjusted");
+    if (integer_scale && !output_manager)
+        logger("mpvif-integer-scale is enabled but the compositor doesn't support wlr-output-management, the output size won't be adjusted");
+    if (hidden_refresh && !output_manager)
+        logger("mpvif-hidden-refresh is set but the compositor doesn't support wlr-output-management, the output won't be throttled");
+
+    if (adaptive_refresh_enabled && output_manager)
+        timer_arm(&adaptive_refresh_timer, monotonic_ms() + 1000);
+
+    if (auto_crop_enabled && !str_is_set(remote_swaysock))
+        logger("mpvif-auto-crop is enabled but --wayland-remote-swaysock isn't set, the video won't be cropped");
+
     /* i3ipc_init_try calls free() on your string.
      * also, what if the plugin exits and is loaded again? */
     int i3ipc_event[] = {
         I3IPC_EVENT_SHUTDOWN,
         I3IPC_EVENT_OUTPUT,
-        I3IPC_EVENT_CURSOR_WARP
+        I3IPC_EVENT_CURSOR_WARP,
+        /* only needed for auto-crop, it's the last one so it can be left out */
+        I3IPC_EVENT_WINDOW
     };
+    int i3ipc_event_count = sizeof(i3ipc_event) / sizeof(i3ipc_event[0]);
+    if (!auto_crop_enabled)
+        i3ipc_event_count--;
     if (str_is_set(remote_swaysock)) {
         char *remote_swaysock_dup = strdup(remote_swaysock);
         if (!remote_swaysock_dup) {
@@ -1220,7 +5696,7 @@ int mpv_open_cplugin(mpv_handle *mpv)
         } else {
             i3ipc_init_try(remote_swaysock_dup);
             i3ipc_set_nopanic(true);
-            i3ipc_subscribe(i3ipc_event, sizeof(i3ipc_event) / sizeof(i3ipc_event[0]));
+            i3ipc_subscribe(i3ipc_event, i3ipc_event_count);
         }
     }
 
@@ -1247,6 +5723,12 @@ int mpv_open_cplugin(mpv_handle *mpv)
         logger("failed to observe the wayland-remote-force-grab-cursor property");
         goto done;
     }
+    /* optional, the output just isn't throttled if these don't work */
+    if (hidden_refresh) {
+        mpv_observe_property(hmpv, 0, "window-minimized", MPV_FORMAT_FLAG);
+        if (hidden_unfocused)
+            mpv_observe_property(hmpv, 0, "focused", MPV_FORMAT_FLAG);
+    }
     mpv_get_property(hmpv, "wayland-remote-input-forwarding", MPV_FORMAT_FLAG,
             &input_forwarding_enabled);
     mpv_get_property(hmpv, "wayland-remote-force-grab-cursor", MPV_FORMAT_FLAG,
@@ -1262,28 +5744,57 @@ int mpv_open_cplugin(mpv_handle *mpv)
 
     mpv_set_wakeup_callback(hmpv, wakeup_mpv_events, NULL);
 
+    if (capture_enabled) {
+        stream_wakeup_fd = wakeup_pipe[1];
+        if (mpv_stream_cb_add_ro(hmpv, "mpvif", NULL, stream_open) < 0)
+            logger("failed to register the mpvif:// stream protocol");
+    }
+
     int i3ipc_fd = str_is_set(remote_swaysock) ? i3ipc_event_fd() : -1;
     /* seems to return 0 if i3ipc is in a failure state, which we obviously
      * don't want to add to poll */
     if (i3ipc_fd == 0)
         i3ipc_fd = -1;
 
-    struct pollfd pfd[3] = {
+    struct pollfd pfd[4] = {
         {.fd = wl_display_get_fd(display),  .events = POLLIN },
         {.fd = wakeup_pipe[0],              .events = POLLIN },
         {.fd = i3ipc_fd,                    .events = POLLIN },
+        {.fd = metrics_socket_fd,           .events = POLLIN },
     };
 
+    if (latency_histograms)
+        timer_arm(&latency_timer, monotonic_ms());
+    if (metrics_file_path)
+        timer_arm(&metrics_file_timer, monotonic_ms() + metrics_interval * 1000);
+    if (handler_stats_enabled)
+        timer_arm(&handler_stats_timer, monotonic_ms() + 1000);
+    if (script_opt_flag("overlay", false))
+        set_overlay_shown(true);
+
     while (true) {
-        wl_display_flush(display);
+        flush_display();
+
+        if (log_ring)
+            drain_log(false);
 
-        if (poll(pfd, 3, -1) == -1) {
+        int64_t poll_start = trace_ring ? monotonic_ns() : 0;
+        int ready = poll(pfd, 4, timer_poll_timeout());
+        if (ready == -1) {
             logger("poll() failed: %m");
             break;
         }
+        if (trace_ring)
+            trace_ring_add(trace_ring, "poll", poll_start,
+                    monotonic_ns() - poll_start, "ready", ready);
 
-        if (pfd[0].revents & POLLIN)
-            wl_display_dispatch(display);
+        run_timers();
+
+        if (pfd[0].revents & POLLIN) {
+            int64_t start = handler_begin();
+            int events = wl_display_dispatch(display);
+            handler_end(HANDLER_WAYLAND_DISPATCH, start, MAX(events, 0));
+        }
 
         if (pfd[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
             logger("error or hangup on display fd");
@@ -1313,9 +5824,39 @@ int mpv_open_cplugin(mpv_handle *mpv)
             logger("error or hangup on i3ipc read fd");
             break;
         }
+
+        if (pfd[3].revents & POLLIN)
+            serve_metrics();
+
+        if (atomic_exchange(&stream_readers_changed, false) &&
+                should_create_capture_frame())
+            create_capture_frame();
+
+        if (cursor_overlay_dirty)
+            update_cursor_overlay();
+
+        if (auto_crop_pending && str_is_set(remote_swaysock))
+            update_auto_crop();
+
+        if (app_profile_pending && !wl_list_empty(&app_profile_list))
+            update_app_profile();
+
+        if (shader_select_pending && shader_chain_count)
+            update_shader_selection();
+
+        if (output_mode_pending && !output_configuration)
+            apply_remote_output_mode();
     }
 
 done:
+    pthread_mutex_lock(&stream_lock);
+    stream_shutdown = true;
+    stream_wakeup_fd = -1;
+    pthread_cond_broadcast(&stream_cond);
+    while (stream_open_calls > 0)
+        pthread_cond_wait(&stream_cond, &stream_lock);
+    pthread_mutex_unlock(&stream_lock);
+
     for (int i = 0; i < 2; i++) {
         if (wakeup_pipe[i] != -1)
             close(wakeup_pipe[i]);
@@ -1348,22 +5889,89 @@ done:
     if (toplevel_manager)
         zwlr_foreign_toplevel_manager_v1_stop(toplevel_manager);
 
+    destroy_app_profiles();
+
+    if (shader_chains)
+        destroy_shader_selection();
+
+    if (output_manager)
+        destroy_output_manager();
+
+    if (latency_sync)
+        wl_callback_destroy(latency_sync);
+
     if (virtual_pointer)
         destroy_virtual_pointer();
 
     if (virtual_pointer_manager)
         zwlr_virtual_pointer_manager_v1_destroy(virtual_pointer_manager);
 
+    if (pointer_warp)
+        destroy_pointer_warp();
+
+    if (pointer_warp_manager)
+        mpvif_pointer_warp_manager_v1_destroy(pointer_warp_manager);
+
+    if (pointer_constraints)
+        destroy_pointer_constraints();
+
+    if (pointer_constraints_manager)
+        mpvif_pointer_constraints_manager_v1_destroy(pointer_constraints_manager);
+
+    if (cursor.cursor_session)
+        destroy_cursor_capture();
+
+    destroy_cursor_images();
+
+    if (capture.session)
+        destroy_output_capture();
+
+    if (copy_capture_manager)
+        ext_image_copy_capture_manager_v1_destroy(copy_capture_manager);
+
+    if (output_capture_source_manager)
+        ext_output_image_capture_source_manager_v1_destroy(output_capture_source_manager);
+
+    if (shm)
+        wl_shm_destroy(shm);
+
     if (display)
         wl_display_disconnect(display);
 
     unset_title();
 
+    if (trace_ring) {
+        write_trace(trace_path);
+        trace_ring_destroy(trace_ring);
+    }
+    free(trace_path);
+
+    if (metrics_socket_fd != -1) {
+        close(metrics_socket_fd);
+        unlink(metrics_socket_path);
+    }
+    free(metrics_socket_path);
+    free(metrics_file_path);
+
+    if (journal)
+        journal_destroy(journal);
+
     mpv_free(remote_display_name);
     mpv_free(remote_output_name);
     mpv_free(remote_seat_name);
     if (remote_swaysock)
         mpv_free(remote_swaysock);
 
+    atomic_store(&log_shutdown, true);
+    while (atomic_load(&log_writers) > 0)
+        sched_yield();
+
+    if (log_ring) {
+        drain_log(true);
+        struct log_ring *ring = log_ring;
+        log_ring = NULL;
+        log_ring_destroy(ring);
+    }
+
     return rc;
 }
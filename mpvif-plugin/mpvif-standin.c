@@ -0,0 +1,2481 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A stand-in for the remote compositor, so that the plugin can be run on a
+ * machine without sway. It has no renderer (captured frames are a test
+ * pattern) and no real clients; it only advertises the globals the plugin
+ * binds, prints what the plugin sends, and emits events which are requested on
+ * stdin.
+ *
+ * Commands (one per line on stdin):
+ *   warp X Y                   send a pointer warp to output-local X,Y
+ *   cursor W H HX HY [RRGGBB]  set the cursor image to a WxH square with the
+ *                              hotspot at HX,HY
+ *   cursor hide                hide the cursor
+ *   cursor show                show the cursor
+ *   constraint none|locked|confined
+ *                              set the pointer constraint of the focused client
+ *   relative yes|no            set whether the focused client uses relative
+ *                              pointer motion
+ *   toplevel ID APP_ID [TITLE] add a toplevel on the output
+ *   title ID [TITLE]           change the title of a toplevel
+ *   titlestorm ID N            change the title of a toplevel N times
+ *   fullscreen ID yes|no       change the fullscreen state of a toplevel
+ *   output ID yes|no           move a toplevel on or off the output
+ *   close ID                   close a toplevel
+ *   redraw                     draw one new frame on the output
+ *   redraw same                damage the box without changing it
+ *   redraw still               commit a frame without changing anything
+ *   animate FPS                keep drawing new frames at FPS, 0 to stop
+ *   mode W H [mHz]             change the output size and refresh rate
+ *   modeset fail|ok            make wlr-output-management configurations
+ *                              fail or succeed
+ *   selection [TEXT]           take the selection with TEXT, or clear it
+ *   primary [TEXT]             the same for the primary selection
+ *   selection-size BYTES       take the selection with BYTES of generated
+ *                              text, e.g. to measure clipboard throughput
+ *   selectionstorm N           take the selection N times in a row
+ *   quiet yes|no               stop or resume printing every motion
+ *   stats                      print the motions received and their rate and
+ *                              latency since the last stats
+ *   quit                       exit
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <wayland-server.h>
+
+#include "damage.h"
+#include "ext-data-control-server-protocol.h"
+#include "ext-image-capture-source-server-protocol.h"
+#include "ext-image-copy-capture-server-protocol.h"
+#include "foreign-toplevel-management-server-protocol.h"
+#include "output-management-server-protocol.h"
+#include "pointer-constraints-server-protocol.h"
+#include "pointer-warp-server-protocol.h"
+#include "virtual-pointer-server-protocol.h"
+
+static struct wl_display *display;
+
+static const char *output_name = "HEADLESS-1";
+static const char *seat_name = "seat0";
+static int output_width = 1280;
+static int output_height = 720;
+static int output_refresh = 60000;
+
+static struct wl_list output_resources;
+static struct wl_list toplevel_manager_resources;
+static struct wl_list toplevels;
+static struct wl_list pointer_warp_resources;
+static struct wl_list pointer_constraints_resources;
+static uint32_t pointer_constraint_state;
+static struct wl_list cursor_sessions;
+static struct wl_list output_sessions;
+static struct wl_list output_managers;
+static uint32_t output_manager_serial = 1;
+static bool output_modeset_fails;
+static struct wl_list data_devices;
+static struct wl_list transfers;
+
+enum selection_kind {
+    SELECTION_REGULAR,
+    SELECTION_PRIMARY,
+};
+static const char *const selection_names[] = { "selection", "primary" };
+
+/* a ext_data_control_source_v1 of the plugin */
+struct data_source {
+    struct wl_resource *resource;
+    /* char * */
+    struct wl_array mime_types;
+};
+
+static struct {
+    /* the plugin's source, or NULL with the text set by a command */
+    struct data_source *source;
+    char *text;
+    size_t len;
+    /* bumped on every change, offers of an older one are stale */
+    uint32_t serial;
+} selections[2];
+
+struct data_offer {
+    enum selection_kind kind;
+    uint32_t serial;
+};
+
+/* a selection being sent to or read from the plugin through a pipe */
+struct transfer {
+    enum selection_kind kind;
+    int fd;
+    /* NULL when reading */
+    char *data;
+    size_t len;
+    size_t done;
+    /* the start of the text read */
+    char preview[33];
+    struct timespec start;
+    struct wl_event_source *source;
+    struct wl_list link;
+};
+
+/* what the virtual pointer received, for the stats command */
+static struct {
+    bool quiet;
+    uint64_t motions;
+    uint64_t window_motions;
+    struct timespec window_start;
+    /* in ms, between the motion's time and its arrival */
+    int64_t window_latency_sum;
+    int64_t window_latency_max;
+} pointer_stats;
+
+struct toplevel {
+    int id;
+    char *app_id;
+    char *title;
+    bool fullscreen;
+    bool on_output;
+    struct wl_list resources;
+    struct wl_list link;
+};
+
+struct cursor_session {
+    struct wl_resource *resource;
+    struct wl_resource *session;
+    struct wl_resource *frame;
+    struct wl_resource *buffer;
+    struct wl_listener buffer_destroy;
+    bool capture_requested;
+    uint32_t copied_serial;
+    struct wl_list link;
+};
+
+/* an output capture session, frames are served from the test pattern */
+struct output_session {
+    struct wl_resource *session;
+    struct wl_resource *frame;
+    struct wl_resource *buffer;
+    struct wl_listener buffer_destroy;
+    bool capture_requested;
+    uint32_t copied_serial;
+    /* damage requested by the client for the attached buffer */
+    struct damage buffer_damage;
+    /* what changed on the output since the last copy */
+    struct damage output_damage;
+    struct wl_list link;
+};
+
+/* a bound wlr-output-management manager with the head of the output */
+struct output_manager {
+    struct wl_resource *resource;
+    struct wl_resource *head;
+    /* the current mode, the only one which is advertised */
+    struct wl_resource *mode;
+    struct wl_list link;
+};
+
+/* the mode which a wlr-output-management configuration sets, 0 for keeping
+ * the current value */
+struct output_configuration {
+    uint32_t serial;
+    bool head_configured;
+    bool head_disabled;
+    bool used;
+    int32_t width;
+    int32_t height;
+    int32_t refresh;
+};
+
+static struct {
+    /* bumped for every committed frame */
+    uint32_t serial;
+    /* position of the moving box, in steps */
+    uint32_t box_pos;
+    int fps;
+    uint32_t frames_copied;
+    uint64_t bytes_copied;
+    struct wl_event_source *timer;
+    /* when the last frame was committed, sent as its presentation time */
+    struct timespec commit_time;
+} output_state = { 1, 0, 0, 0, 0, NULL, {0, 0} };
+
+static struct {
+    int32_t width;
+    int32_t height;
+    int32_t hotspot_x;
+    int32_t hotspot_y;
+    uint32_t color;
+    bool visible;
+    /* bumped whenever the image changes */
+    uint32_t serial;
+} cursor_state = { 24, 24, 0, 0, 0xffffff, true, 1 };
+
+static char stdin_buf[4096];
+static size_t stdin_buf_len;
+
+static void print_event(const char *fmt, ...)
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    printf("%lld.%09ld ", (long long)tp.tv_sec, tp.tv_nsec);
+
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+
+    putchar('\n');
+    fflush(stdout);
+}
+
+static void resource_destroy(struct wl_client *client,
+        struct wl_resource *resource)
+{
+    wl_resource_destroy(resource);
+}
+
+static void unlink_resource(struct wl_resource *resource)
+{
+    wl_list_remove(wl_resource_get_link(resource));
+}
+
+static const struct wl_output_interface output_impl = {
+    resource_destroy,
+};
+
+static void output_bind(struct wl_client *client, void *data,
+        uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client,
+            &wl_output_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &output_impl, NULL,
+            unlink_resource);
+    wl_list_insert(&output_resources, wl_resource_get_link(resource));
+
+    wl_output_send_geometry(resource, 0, 0, 0, 0, 0, "mpvif", "stand-in",
+            WL_OUTPUT_TRANSFORM_NORMAL);
+    wl_output_send_mode(resource,
+            WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED,
+            output_width, output_height, output_refresh);
+    if (version >= WL_OUTPUT_SCALE_SINCE_VERSION)
+        wl_output_send_scale(resource, 1);
+    if (version >= WL_OUTPUT_NAME_SINCE_VERSION)
+        wl_output_send_name(resource, output_name);
+    if (version >= WL_OUTPUT_DESCRIPTION_SINCE_VERSION)
+        wl_output_send_description(resource, "mpvif stand-in output");
+    if (version >= WL_OUTPUT_DONE_SINCE_VERSION)
+        wl_output_send_done(resource);
+}
+
+static void pointer_set_cursor(struct wl_client *client,
+        struct wl_resource *resource, uint32_t serial,
+        struct wl_resource *surface, int32_t hotspot_x, int32_t hotspot_y)
+{
+}
+
+static const struct wl_pointer_interface pointer_impl = {
+    pointer_set_cursor,
+    resource_destroy,
+};
+
+static const struct wl_keyboard_interface keyboard_impl = {
+    resource_destroy,
+};
+
+static const struct wl_touch_interface touch_impl = {
+    resource_destroy,
+};
+
+static void seat_get_pointer(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id)
+{
+    struct wl_resource *pointer = wl_resource_create(client,
+            &wl_pointer_interface, wl_resource_get_version(resource), id);
+    if (!pointer) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(pointer, &pointer_impl, NULL, NULL);
+}
+
+static void seat_get_keyboard(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id)
+{
+    struct wl_resource *keyboard = wl_resource_create(client,
+            &wl_keyboard_interface, wl_resource_get_version(resource), id);
+    if (!keyboard) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(keyboard, &keyboard_impl, NULL, NULL);
+}
+
+static void seat_get_touch(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id)
+{
+    struct wl_resource *touch = wl_resource_create(client,
+            &wl_touch_interface, wl_resource_get_version(resource), id);
+    if (!touch) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(touch, &touch_impl, NULL, NULL);
+}
+
+static const struct wl_seat_interface seat_impl = {
+    seat_get_pointer,
+    seat_get_keyboard,
+    seat_get_touch,
+    resource_destroy,
+};
+
+static void seat_bind(struct wl_client *client, void *data,
+        uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client,
+            &wl_seat_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &seat_impl, NULL, NULL);
+
+    wl_seat_send_capabilities(resource, WL_SEAT_CAPABILITY_POINTER);
+    if (version >= WL_SEAT_NAME_SINCE_VERSION)
+        wl_seat_send_name(resource, seat_name);
+}
+
+static void virtual_pointer_motion(struct wl_client *client,
+        struct wl_resource *resource, uint32_t time, wl_fixed_t dx,
+        wl_fixed_t dy)
+{
+    print_event("motion %u %f %f", time, wl_fixed_to_double(dx),
+            wl_fixed_to_double(dy));
+}
+
+static void virtual_pointer_motion_absolute(struct wl_client *client,
+        struct wl_resource *resource, uint32_t time, uint32_t x, uint32_t y,
+        uint32_t x_extent, uint32_t y_extent)
+{
+    /* the plugin stamps motions with CLOCK_MONOTONIC in ms */
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    uint32_t now = tp.tv_sec * 1000 + tp.tv_nsec / 1000000;
+    int64_t latency = (int32_t)(now - time);
+
+    pointer_stats.motions++;
+    pointer_stats.window_motions++;
+    pointer_stats.window_latency_sum += latency;
+    pointer_stats.window_latency_max =
+        MAX(pointer_stats.window_latency_max, latency);
+
+    if (!pointer_stats.quiet)
+        print_event("motion_absolute %u %u %u %u %u", time, x, y, x_extent,
+                y_extent);
+}
+
+static void print_pointer_stats(void)
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    double seconds = (tp.tv_sec - pointer_stats.window_start.tv_sec) +
+        (tp.tv_nsec - pointer_stats.window_start.tv_nsec) / 1e9;
+    uint64_t n = pointer_stats.window_motions;
+
+    print_event("stats motions %" PRIu64 " (%" PRIu64 " in %.3f s, %.0f/s) "
+            "latency avg %.2f ms max %" PRId64 " ms", pointer_stats.motions, n,
+            seconds, n / seconds,
+            n ? (double)pointer_stats.window_latency_sum / n : 0.0,
+            pointer_stats.window_latency_max);
+
+    pointer_stats.window_motions = 0;
+    pointer_stats.window_latency_sum = 0;
+    pointer_stats.window_latency_max = 0;
+    pointer_stats.window_start = tp;
+}
+
+static void virtual_pointer_button(struct wl_client *client,
+        struct wl_resource *resource, uint32_t time, uint32_t button,
+        uint32_t state)
+{
+    print_event("button %u %u %u", time, button, state);
+}
+
+static void virtual_pointer_axis(struct wl_client *client,
+        struct wl_resource *resource, uint32_t time, uint32_t axis,
+        wl_fixed_t value)
+{
+    print_event("axis %u %u %f", time, axis, wl_fixed_to_double(value));
+}
+
+static void virtual_pointer_frame(struct wl_client *client,
+        struct wl_resource *resource)
+{
+}
+
+static void virtual_pointer_axis_source(struct wl_client *client,
+        struct wl_resource *resource, uint32_t axis_source)
+{
+}
+
+static void virtual_pointer_axis_stop(struct wl_client *client,
+        struct wl_resource *resource, uint32_t time, uint32_t axis)
+{
+}
+
+static void virtual_pointer_axis_discrete(struct wl_client *client,
+        struct wl_resource *resource, uint32_t time, uint32_t axis,
+        wl_fixed_t value, int32_t discrete)
+{
+    print_event("axis_discrete %u %u %f %d", time, axis,
+            wl_fixed_to_double(value), discrete);
+}
+
+static const struct zwlr_virtual_pointer_v1_interface virtual_pointer_impl = {
+    virtual_pointer_motion,
+    virtual_pointer_motion_absolute,
+    virtual_pointer_button,
+    virtual_pointer_axis,
+    virtual_pointer_frame,
+    virtual_pointer_axis_source,
+    virtual_pointer_axis_stop,
+    virtual_pointer_axis_discrete,
+    resource_destroy,
+};
+
+static void virtual_pointer_resource_destroy(struct wl_resource *resource)
+{
+    print_event("virtual_pointer destroyed");
+}
+
+static void create_virtual_pointer(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id)
+{
+    struct wl_resource *vp = wl_resource_create(client,
+            &zwlr_virtual_pointer_v1_interface,
+            wl_resource_get_version(resource), id);
+    if (!vp) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(vp, &virtual_pointer_impl, NULL,
+            virtual_pointer_resource_destroy);
+    print_event("virtual_pointer created");
+}
+
+static void virtual_pointer_manager_create_virtual_pointer(
+        struct wl_client *client, struct wl_resource *resource,
+        struct wl_resource *seat, uint32_t id)
+{
+    create_virtual_pointer(client, resource, id);
+}
+
+static void virtual_pointer_manager_create_virtual_pointer_with_output(
+        struct wl_client *client, struct wl_resource *resource,
+        struct wl_resource *seat, struct wl_resource *output, uint32_t id)
+{
+    create_virtual_pointer(client, resource, id);
+}
+
+static const struct zwlr_virtual_pointer_manager_v1_interface virtual_pointer_manager_impl = {
+    virtual_pointer_manager_create_virtual_pointer,
+    resource_destroy,
+    virtual_pointer_manager_create_virtual_pointer_with_output,
+};
+
+static void virtual_pointer_manager_bind(struct wl_client *client, void *data,
+        uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client,
+            &zwlr_virtual_pointer_manager_v1_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &virtual_pointer_manager_impl,
+            NULL, NULL);
+}
+
+static const struct mpvif_pointer_warp_v1_interface pointer_warp_impl = {
+    resource_destroy,
+};
+
+static void pointer_warp_manager_get_pointer_warp(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id, struct wl_resource *seat,
+        struct wl_resource *output)
+{
+    struct wl_resource *pw = wl_resource_create(client,
+            &mpvif_pointer_warp_v1_interface,
+            wl_resource_get_version(resource), id);
+    if (!pw) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(pw, &pointer_warp_impl, NULL,
+            unlink_resource);
+    wl_list_insert(&pointer_warp_resources, wl_resource_get_link(pw));
+}
+
+static const struct mpvif_pointer_warp_manager_v1_interface pointer_warp_manager_impl = {
+    pointer_warp_manager_get_pointer_warp,
+    resource_destroy,
+};
+
+static void pointer_warp_manager_bind(struct wl_client *client, void *data,
+        uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client,
+            &mpvif_pointer_warp_manager_v1_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &pointer_warp_manager_impl,
+            NULL, NULL);
+}
+
+static void finish_transfer(struct transfer *t)
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    double ms = (tp.tv_sec - t->start.tv_sec) * 1e3 +
+        (tp.tv_nsec - t->start.tv_nsec) / 1e6;
+
+    if (t->data)
+        print_event("%s sent %zu of %zu bytes in %.3f ms (%.1f MB/s)",
+                selection_names[t->kind], t->done, t->len, ms,
+                t->done / ms / 1e3);
+    else
+        print_event("%s received %zu bytes in %.3f ms (%.1f MB/s): %s",
+                selection_names[t->kind], t->done, ms, t->done / ms / 1e3,
+                t->preview);
+
+    wl_event_source_remove(t->source);
+    close(t->fd);
+    free(t->data);
+    wl_list_remove(&t->link);
+    free(t);
+}
+
+static int handle_transfer(int fd, uint32_t mask, void *data)
+{
+    struct transfer *t = data;
+    char buf[65536];
+    ssize_t ret;
+
+    if (t->data)
+        ret = write(fd, t->data + t->done, t->len - t->done);
+    else
+        ret = read(fd, buf, sizeof(buf));
+
+    if (ret == -1 && (errno == EAGAIN || errno == EINTR))
+        return 0;
+
+    if (ret > 0) {
+        if (!t->data && t->done < sizeof(t->preview) - 1) {
+            size_t n = MIN((size_t)ret, sizeof(t->preview) - 1 - t->done);
+            memcpy(t->preview + t->done, buf, n);
+        }
+        t->done += ret;
+    }
+
+    /* EOF, an error, or everything was written */
+    if (ret <= 0 || (t->data && t->done == t->len))
+        finish_transfer(t);
+
+    return 0;
+}
+
+/* data is the text to send and is taken over, or NULL to read */
+static void start_transfer(enum selection_kind kind, int fd, char *data,
+        size_t len)
+{
+    struct transfer *t = calloc(1, sizeof(*t));
+    if (!t) {
+        close(fd);
+        free(data);
+        return;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    t->kind = kind;
+    t->fd = fd;
+    t->data = data;
+    t->len = len;
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
+    t->source = wl_event_loop_add_fd(wl_display_get_event_loop(display), fd,
+            data ? WL_EVENT_WRITABLE : WL_EVENT_READABLE, handle_transfer, t);
+    wl_list_insert(&transfers, &t->link);
+}
+
+static const struct ext_data_control_offer_v1_interface data_offer_impl;
+
+static void data_offer_resource_destroy(struct wl_resource *resource)
+{
+    free(wl_resource_get_user_data(resource));
+}
+
+static void send_selection(struct wl_resource *device, enum selection_kind kind)
+{
+    struct wl_resource *offer = NULL;
+
+    if (selections[kind].source || selections[kind].text) {
+        struct data_offer *o = calloc(1, sizeof(*o));
+        offer = wl_resource_create(wl_resource_get_client(device),
+                &ext_data_control_offer_v1_interface,
+                wl_resource_get_version(device), 0);
+        if (!o || !offer) {
+            free(o);
+            if (offer)
+                wl_resource_destroy(offer);
+            wl_client_post_no_memory(wl_resource_get_client(device));
+            return;
+        }
+        o->kind = kind;
+        o->serial = selections[kind].serial;
+        wl_resource_set_implementation(offer, &data_offer_impl, o,
+                data_offer_resource_destroy);
+
+        ext_data_control_device_v1_send_data_offer(device, offer);
+        if (selections[kind].source) {
+            char **mime_type;
+            wl_array_for_each(mime_type,
+                    &selections[kind].source->mime_types)
+                ext_data_control_offer_v1_send_offer(offer, *mime_type);
+        } else {
+            ext_data_control_offer_v1_send_offer(offer,
+                    "text/plain;charset=utf-8");
+            ext_data_control_offer_v1_send_offer(offer, "text/plain");
+        }
+    }
+
+    if (kind == SELECTION_PRIMARY)
+        ext_data_control_device_v1_send_primary_selection(device, offer);
+    else
+        ext_data_control_device_v1_send_selection(device, offer);
+}
+
+/* reads a new selection of the plugin, like a clipboard manager would */
+static void read_selection(enum selection_kind kind)
+{
+    const char *mime = NULL;
+    char **mime_type;
+    wl_array_for_each(mime_type, &selections[kind].source->mime_types) {
+        if (strcmp(*mime_type, "text/plain;charset=utf-8") == 0 ||
+                (!mime && strcmp(*mime_type, "text/plain") == 0))
+            mime = *mime_type;
+    }
+    if (!mime)
+        return;
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        fprintf(stderr, "pipe2() failed: %s\n", strerror(errno));
+        return;
+    }
+
+    ext_data_control_source_v1_send_send(selections[kind].source->resource,
+            mime, fds[1]);
+    close(fds[1]);
+    start_transfer(kind, fds[0], NULL, 0);
+}
+
+static void set_selection(enum selection_kind kind, struct data_source *source,
+        char *text, size_t len)
+{
+    struct data_source *old = selections[kind].source;
+    if (old && old != source)
+        ext_data_control_source_v1_send_cancelled(old->resource);
+
+    free(selections[kind].text);
+    selections[kind].source = source;
+    selections[kind].text = text;
+    selections[kind].len = len;
+    selections[kind].serial++;
+
+    struct wl_resource *device;
+    wl_resource_for_each(device, &data_devices)
+        send_selection(device, kind);
+
+    if (source)
+        read_selection(kind);
+    else
+        print_event("%s set to %zu bytes", selection_names[kind], len);
+}
+
+static void data_offer_receive(struct wl_client *client,
+        struct wl_resource *resource, const char *mime_type, int32_t fd)
+{
+    struct data_offer *o = wl_resource_get_user_data(resource);
+    enum selection_kind kind = o->kind;
+
+    if (o->serial != selections[kind].serial) {
+        close(fd);
+    } else if (selections[kind].source) {
+        ext_data_control_source_v1_send_send(
+                selections[kind].source->resource, mime_type, fd);
+        close(fd);
+    } else {
+        char *copy = malloc(selections[kind].len);
+        if (!copy) {
+            close(fd);
+            return;
+        }
+        memcpy(copy, selections[kind].text, selections[kind].len);
+        start_transfer(kind, fd, copy, selections[kind].len);
+    }
+}
+
+static const struct ext_data_control_offer_v1_interface data_offer_impl = {
+    data_offer_receive,
+    resource_destroy,
+};
+
+static void data_source_offer(struct wl_client *client,
+        struct wl_resource *resource, const char *mime_type)
+{
+    struct data_source *ds = wl_resource_get_user_data(resource);
+    char **slot = wl_array_add(&ds->mime_types, sizeof(*slot));
+    if (!slot || !(*slot = strdup(mime_type))) {
+        if (slot)
+            ds->mime_types.size -= sizeof(*slot);
+        wl_client_post_no_memory(client);
+    }
+}
+
+static const struct ext_data_control_source_v1_interface data_source_impl = {
+    data_source_offer,
+    resource_destroy,
+};
+
+static void data_source_resource_destroy(struct wl_resource *resource)
+{
+    struct data_source *ds = wl_resource_get_user_data(resource);
+
+    /* the selection goes away with its source */
+    for (int kind = 0; kind < 2; kind++) {
+        if (selections[kind].source == ds)
+            set_selection(kind, NULL, NULL, 0);
+    }
+
+    char **mime_type;
+    wl_array_for_each(mime_type, &ds->mime_types)
+        free(*mime_type);
+    wl_array_release(&ds->mime_types);
+    free(ds);
+}
+
+static void data_device_set_selection(struct wl_client *client,
+        struct wl_resource *resource, struct wl_resource *source)
+{
+    set_selection(SELECTION_REGULAR,
+            source ? wl_resource_get_user_data(source) : NULL, NULL, 0);
+}
+
+static void data_device_set_primary_selection(struct wl_client *client,
+        struct wl_resource *resource, struct wl_resource *source)
+{
+    set_selection(SELECTION_PRIMARY,
+            source ? wl_resource_get_user_data(source) : NULL, NULL, 0);
+}
+
+static const struct ext_data_control_device_v1_interface data_device_impl = {
+    data_device_set_selection,
+    resource_destroy,
+    data_device_set_primary_selection,
+};
+
+static void data_control_manager_create_data_source(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id)
+{
+    struct data_source *ds = calloc(1, sizeof(*ds));
+    if (!ds) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    ds->resource = wl_resource_create(client,
+            &ext_data_control_source_v1_interface,
+            wl_resource_get_version(resource), id);
+    if (!ds->resource) {
+        free(ds);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_array_init(&ds->mime_types);
+    wl_resource_set_implementation(ds->resource, &data_source_impl, ds,
+            data_source_resource_destroy);
+}
+
+static void data_control_manager_get_data_device(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id, struct wl_resource *seat)
+{
+    struct wl_resource *device = wl_resource_create(client,
+            &ext_data_control_device_v1_interface,
+            wl_resource_get_version(resource), id);
+    if (!device) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(device, &data_device_impl, NULL,
+            unlink_resource);
+    wl_list_insert(&data_devices, wl_resource_get_link(device));
+
+    send_selection(device, SELECTION_REGULAR);
+    send_selection(device, SELECTION_PRIMARY);
+}
+
+static const struct ext_data_control_manager_v1_interface data_control_manager_impl = {
+    data_control_manager_create_data_source,
+    data_control_manager_get_data_device,
+    resource_destroy,
+};
+
+static void data_control_manager_bind(struct wl_client *client, void *data,
+        uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client,
+            &ext_data_control_manager_v1_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &data_control_manager_impl,
+            NULL, NULL);
+}
+
+/* text of the given size, in lines so that it looks like something */
+static char *generate_text(size_t len)
+{
+    char *text = malloc(len + 1);
+    if (!text)
+        return NULL;
+
+    for (size_t i = 0; i < len; i++)
+        text[i] = i % 64 == 63 ? '\n' : 'a' + i % 26;
+    text[len] = '\0';
+
+    return text;
+}
+
+static void toplevel_handle_set_maximized(struct wl_client *client,
+        struct wl_resource *resource)
+{
+}
+
+static void toplevel_handle_unset_maximized(struct wl_client *client,
+        struct wl_resource *resource)
+{
+}
+
+static void toplevel_handle_set_minimized(struct wl_client *client,
+        struct wl_resource *resource)
+{
+}
+
+static void toplevel_handle_unset_minimized(struct wl_client *client,
+        struct wl_resource *resource)
+{
+}
+
+static void toplevel_handle_activate(struct wl_client *client,
+        struct wl_resource *resource, struct wl_resource *seat)
+{
+}
+
+static void toplevel_handle_close(struct wl_client *client,
+        struct wl_resource *resource)
+{
+}
+
+static void toplevel_handle_set_rectangle(struct wl_client *client,
+        struct wl_resource *resource, struct wl_resource *surface,
+        int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static void toplevel_handle_set_fullscreen(struct wl_client *client,
+        struct wl_resource *resource, struct wl_resource *output)
+{
+}
+
+static void toplevel_handle_unset_fullscreen(struct wl_client *client,
+        struct wl_resource *resource)
+{
+}
+
+static const struct zwlr_foreign_toplevel_handle_v1_interface toplevel_handle_impl = {
+    toplevel_handle_set_maximized,
+    toplevel_handle_unset_maximized,
+    toplevel_handle_set_minimized,
+    toplevel_handle_unset_minimized,
+    toplevel_handle_activate,
+    toplevel_handle_close,
+    toplevel_handle_set_rectangle,
+    resource_destroy,
+    toplevel_handle_set_fullscreen,
+    toplevel_handle_unset_fullscreen,
+};
+
+static void send_toplevel_output(struct toplevel *tl,
+        struct wl_resource *handle, bool enter)
+{
+    struct wl_client *client = wl_resource_get_client(handle);
+
+    struct wl_resource *output;
+    wl_resource_for_each(output, &output_resources) {
+        if (wl_resource_get_client(output) != client)
+            continue;
+        if (enter)
+            zwlr_foreign_toplevel_handle_v1_send_output_enter(handle, output);
+        else
+            zwlr_foreign_toplevel_handle_v1_send_output_leave(handle, output);
+    }
+}
+
+static void send_toplevel_state(struct toplevel *tl,
+        struct wl_resource *handle)
+{
+    struct wl_array state;
+    wl_array_init(&state);
+
+    if (tl->fullscreen &&
+            wl_resource_get_version(handle) >= ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_FULLSCREEN_SINCE_VERSION) {
+        uint32_t *entry = wl_array_add(&state, sizeof(*entry));
+        if (entry)
+            *entry = ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_FULLSCREEN;
+    }
+
+    zwlr_foreign_toplevel_handle_v1_send_state(handle, &state);
+    wl_array_release(&state);
+}
+
+static void send_toplevel(struct toplevel *tl,
+        struct wl_resource *manager)
+{
+    struct wl_resource *handle = wl_resource_create(
+            wl_resource_get_client(manager),
+            &zwlr_foreign_toplevel_handle_v1_interface,
+            wl_resource_get_version(manager), 0);
+    if (!handle) {
+        wl_client_post_no_memory(wl_resource_get_client(manager));
+        return;
+    }
+    wl_resource_set_implementation(handle, &toplevel_handle_impl, tl,
+            unlink_resource);
+    wl_list_insert(&tl->resources, wl_resource_get_link(handle));
+
+    zwlr_foreign_toplevel_manager_v1_send_toplevel(manager, handle);
+    zwlr_foreign_toplevel_handle_v1_send_app_id(handle, tl->app_id);
+    zwlr_foreign_toplevel_handle_v1_send_title(handle, tl->title);
+    if (tl->on_output)
+        send_toplevel_output(tl, handle, true);
+    send_toplevel_state(tl, handle);
+    zwlr_foreign_toplevel_handle_v1_send_done(handle);
+}
+
+static void toplevel_manager_stop(struct wl_client *client,
+        struct wl_resource *resource)
+{
+    zwlr_foreign_toplevel_manager_v1_send_finished(resource);
+    wl_resource_destroy(resource);
+}
+
+static const struct zwlr_foreign_toplevel_manager_v1_interface toplevel_manager_impl = {
+    toplevel_manager_stop,
+};
+
+static void toplevel_manager_bind(struct wl_client *client, void *data,
+        uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client,
+            &zwlr_foreign_toplevel_manager_v1_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &toplevel_manager_impl, NULL,
+            unlink_resource);
+    wl_list_insert(&toplevel_manager_resources,
+            wl_resource_get_link(resource));
+
+    struct toplevel *tl;
+    wl_list_for_each_reverse(tl, &toplevels, link)
+        send_toplevel(tl, resource);
+}
+
+static struct toplevel *find_toplevel(int id)
+{
+    struct toplevel *tl;
+    wl_list_for_each(tl, &toplevels, link) {
+        if (tl->id == id)
+            return tl;
+    }
+    return NULL;
+}
+
+static void add_toplevel(int id, const char *app_id, const char *title)
+{
+    if (find_toplevel(id)) {
+        fprintf(stderr, "toplevel %d already exists\n", id);
+        return;
+    }
+
+    struct toplevel *tl = calloc(1, sizeof(*tl));
+    if (!tl)
+        return;
+    tl->id = id;
+    tl->app_id = strdup(app_id);
+    tl->title = strdup(title);
+    tl->on_output = true;
+    wl_list_init(&tl->resources);
+    wl_list_insert(&toplevels, &tl->link);
+
+    struct wl_resource *manager;
+    wl_resource_for_each(manager, &toplevel_manager_resources)
+        send_toplevel(tl, manager);
+    print_event("toplevel %d added", id);
+}
+
+static void set_toplevel_title(struct toplevel *tl, const char *title)
+{
+    free(tl->title);
+    tl->title = strdup(title);
+
+    struct wl_resource *handle;
+    wl_resource_for_each(handle, &tl->resources) {
+        zwlr_foreign_toplevel_handle_v1_send_title(handle, tl->title);
+        zwlr_foreign_toplevel_handle_v1_send_done(handle);
+    }
+}
+
+static void set_toplevel_fullscreen(struct toplevel *tl, bool fullscreen)
+{
+    tl->fullscreen = fullscreen;
+
+    struct wl_resource *handle;
+    wl_resource_for_each(handle, &tl->resources) {
+        send_toplevel_state(tl, handle);
+        zwlr_foreign_toplevel_handle_v1_send_done(handle);
+    }
+    print_event("toplevel %d fullscreen %s", tl->id, fullscreen ? "yes" : "no");
+}
+
+static void set_toplevel_on_output(struct toplevel *tl, bool on_output)
+{
+    if (on_output == tl->on_output)
+        return;
+    tl->on_output = on_output;
+
+    struct wl_resource *handle;
+    wl_resource_for_each(handle, &tl->resources) {
+        send_toplevel_output(tl, handle, on_output);
+        zwlr_foreign_toplevel_handle_v1_send_done(handle);
+    }
+    print_event("toplevel %d output %s", tl->id, on_output ? "yes" : "no");
+}
+
+static void close_toplevel(struct toplevel *tl)
+{
+    struct wl_resource *handle, *tmp;
+    wl_resource_for_each_safe(handle, tmp, &tl->resources) {
+        zwlr_foreign_toplevel_handle_v1_send_closed(handle);
+        /* the handle becomes inert, the client destroys it */
+        wl_list_remove(wl_resource_get_link(handle));
+        wl_list_init(wl_resource_get_link(handle));
+        wl_resource_set_user_data(handle, NULL);
+    }
+
+    print_event("toplevel %d closed", tl->id);
+    wl_list_remove(&tl->link);
+    free(tl->app_id);
+    free(tl->title);
+    free(tl);
+}
+
+static const struct ext_image_capture_source_v1_interface capture_source_impl = {
+    resource_destroy,
+};
+
+static void output_capture_source_manager_create_source(
+        struct wl_client *client, struct wl_resource *resource, uint32_t id,
+        struct wl_resource *output)
+{
+    struct wl_resource *source = wl_resource_create(client,
+            &ext_image_capture_source_v1_interface,
+            wl_resource_get_version(resource), id);
+    if (!source) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(source, &capture_source_impl, NULL, NULL);
+}
+
+static const struct ext_output_image_capture_source_manager_v1_interface output_capture_source_manager_impl = {
+    output_capture_source_manager_create_source,
+    resource_destroy,
+};
+
+static void output_capture_source_manager_bind(struct wl_client *client,
+        void *data, uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client,
+            &ext_output_image_capture_source_manager_v1_interface, version,
+            id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource,
+            &output_capture_source_manager_impl, NULL, NULL);
+}
+
+static void cursor_session_detach_buffer(struct cursor_session *cs)
+{
+    if (!cs->buffer)
+        return;
+    wl_list_remove(&cs->buffer_destroy.link);
+    wl_list_init(&cs->buffer_destroy.link);
+    cs->buffer = NULL;
+}
+
+static void cursor_session_buffer_destroy(struct wl_listener *listener,
+        void *data)
+{
+    struct cursor_session *cs = wl_container_of(listener, cs, buffer_destroy);
+    cursor_session_detach_buffer(cs);
+}
+
+static void fill_cursor_image(uint32_t *pixels, int32_t stride)
+{
+    /* a square with a black border, in premultiplied ARGB */
+    for (int32_t y = 0; y < cursor_state.height; y++) {
+        uint32_t *row = (uint32_t *)((char *)pixels + y * stride);
+        for (int32_t x = 0; x < cursor_state.width; x++) {
+            bool border = x == 0 || y == 0 || x == cursor_state.width - 1 ||
+                y == cursor_state.height - 1;
+            row[x] = 0xff000000 | (border ? 0 : cursor_state.color);
+        }
+    }
+}
+
+static void complete_cursor_frame(struct cursor_session *cs)
+{
+    struct wl_resource *frame = cs->frame;
+    struct wl_shm_buffer *shm_buffer =
+        cs->buffer ? wl_shm_buffer_get(cs->buffer) : NULL;
+
+    cs->capture_requested = false;
+
+    if (!shm_buffer ||
+            wl_shm_buffer_get_format(shm_buffer) != WL_SHM_FORMAT_ARGB8888 ||
+            wl_shm_buffer_get_width(shm_buffer) != cursor_state.width ||
+            wl_shm_buffer_get_height(shm_buffer) != cursor_state.height) {
+        ext_image_copy_capture_frame_v1_send_failed(frame,
+                EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_BUFFER_CONSTRAINTS);
+        print_event("cursor frame failed (buffer constraints)");
+        return;
+    }
+
+    wl_shm_buffer_begin_access(shm_buffer);
+    fill_cursor_image(wl_shm_buffer_get_data(shm_buffer),
+            wl_shm_buffer_get_stride(shm_buffer));
+    wl_shm_buffer_end_access(shm_buffer);
+
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    uint64_t sec = tp.tv_sec;
+
+    ext_image_copy_capture_frame_v1_send_transform(frame,
+            WL_OUTPUT_TRANSFORM_NORMAL);
+    ext_image_copy_capture_frame_v1_send_damage(frame, 0, 0,
+            cursor_state.width, cursor_state.height);
+    ext_image_copy_capture_frame_v1_send_presentation_time(frame, sec >> 32,
+            sec & 0xffffffff, tp.tv_nsec);
+    ext_image_copy_capture_frame_v1_send_ready(frame);
+    cs->copied_serial = cursor_state.serial;
+    print_event("cursor frame copied %dx%d", cursor_state.width,
+            cursor_state.height);
+}
+
+static void frame_attach_buffer(struct wl_client *client,
+        struct wl_resource *resource, struct wl_resource *buffer)
+{
+    struct cursor_session *cs = wl_resource_get_user_data(resource);
+    if (!cs)
+        return;
+
+    cursor_session_detach_buffer(cs);
+    cs->buffer = buffer;
+    wl_resource_add_destroy_listener(buffer, &cs->buffer_destroy);
+}
+
+static void frame_damage_buffer(struct wl_client *client,
+        struct wl_resource *resource, int32_t x, int32_t y, int32_t width,
+        int32_t height)
+{
+}
+
+static void frame_capture(struct wl_client *client,
+        struct wl_resource *resource)
+{
+    struct cursor_session *cs = wl_resource_get_user_data(resource);
+    if (!cs) {
+        ext_image_copy_capture_frame_v1_send_failed(resource,
+                EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_STOPPED);
+        return;
+    }
+
+    cs->capture_requested = true;
+
+    /* like a real compositor, only copy when the image changed since the last
+     * copy */
+    if (cs->copied_serial != cursor_state.serial)
+        complete_cursor_frame(cs);
+}
+
+static const struct ext_image_copy_capture_frame_v1_interface frame_impl = {
+    resource_destroy,
+    frame_attach_buffer,
+    frame_damage_buffer,
+    frame_capture,
+};
+
+static void frame_resource_destroy(struct wl_resource *resource)
+{
+    struct cursor_session *cs = wl_resource_get_user_data(resource);
+    if (!cs)
+        return;
+
+    cs->frame = NULL;
+    cs->capture_requested = false;
+    cursor_session_detach_buffer(cs);
+}
+
+static void session_create_frame(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id)
+{
+    struct cursor_session *cs = wl_resource_get_user_data(resource);
+
+    if (cs && cs->frame) {
+        wl_resource_post_error(resource,
+                EXT_IMAGE_COPY_CAPTURE_SESSION_V1_ERROR_DUPLICATE_FRAME,
+                "a frame already exists");
+        return;
+    }
+
+    struct wl_resource *frame = wl_resource_create(client,
+            &ext_image_copy_capture_frame_v1_interface,
+            wl_resource_get_version(resource), id);
+    if (!frame) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(frame, &frame_impl, cs,
+            frame_resource_destroy);
+
+    if (cs)
+        cs->frame = frame;
+}
+
+static const struct ext_image_copy_capture_session_v1_interface session_impl = {
+    session_create_frame,
+    resource_destroy,
+};
+
+static void session_resource_destroy(struct wl_resource *resource)
+{
+    struct cursor_session *cs = wl_resource_get_user_data(resource);
+    if (cs)
+        cs->session = NULL;
+}
+
+static void send_cursor_constraints(struct cursor_session *cs)
+{
+    ext_image_copy_capture_session_v1_send_buffer_size(cs->session,
+            cursor_state.width, cursor_state.height);
+    ext_image_copy_capture_session_v1_send_shm_format(cs->session,
+            WL_SHM_FORMAT_ARGB8888);
+    ext_image_copy_capture_session_v1_send_done(cs->session);
+}
+
+static void send_cursor_enter(struct cursor_session *cs)
+{
+    ext_image_copy_capture_cursor_session_v1_send_enter(cs->resource);
+    ext_image_copy_capture_cursor_session_v1_send_position(cs->resource, 0, 0);
+    ext_image_copy_capture_cursor_session_v1_send_hotspot(cs->resource,
+            cursor_state.hotspot_x, cursor_state.hotspot_y);
+}
+
+static void cursor_session_get_capture_session(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id)
+{
+    struct cursor_session *cs = wl_resource_get_user_data(resource);
+
+    if (cs->session) {
+        wl_resource_post_error(resource,
+                EXT_IMAGE_COPY_CAPTURE_CURSOR_SESSION_V1_ERROR_DUPLICATE_SESSION,
+                "a capture session already exists");
+        return;
+    }
+
+    cs->session = wl_resource_create(client,
+            &ext_image_copy_capture_session_v1_interface,
+            wl_resource_get_version(resource), id);
+    if (!cs->session) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(cs->session, &session_impl, cs,
+            session_resource_destroy);
+
+    send_cursor_constraints(cs);
+    if (cursor_state.visible)
+        send_cursor_enter(cs);
+}
+
+static const struct ext_image_copy_capture_cursor_session_v1_interface cursor_session_impl = {
+    resource_destroy,
+    cursor_session_get_capture_session,
+};
+
+static void cursor_session_resource_destroy(struct wl_resource *resource)
+{
+    struct cursor_session *cs = wl_resource_get_user_data(resource);
+
+    /* the capture session and frame may outlive this */
+    if (cs->session)
+        wl_resource_set_user_data(cs->session, NULL);
+    if (cs->frame)
+        wl_resource_set_user_data(cs->frame, NULL);
+    cursor_session_detach_buffer(cs);
+    wl_list_remove(&cs->link);
+    free(cs);
+    print_event("cursor session destroyed");
+}
+
+static void output_session_detach_buffer(struct output_session *os)
+{
+    if (!os->buffer)
+        return;
+    wl_list_remove(&os->buffer_destroy.link);
+    wl_list_init(&os->buffer_destroy.link);
+    os->buffer = NULL;
+}
+
+static void output_session_buffer_destroy(struct wl_listener *listener,
+        void *data)
+{
+    struct output_session *os = wl_container_of(listener, os, buffer_destroy);
+    output_session_detach_buffer(os);
+}
+
+/* a gradient with a box moving across it, so that consecutive frames differ
+ * in a small region */
+static struct damage_rect output_box(uint32_t pos)
+{
+    int32_t size = MIN(64, MIN(output_width, output_height));
+    return (struct damage_rect){
+        .x = (pos * 8) % MAX(output_width - size, 1),
+        .y = (output_height - size) / 2,
+        .width = size,
+        .height = size,
+    };
+}
+
+static void fill_output_rect(uint32_t *pixels, int32_t stride,
+        const struct damage_rect *rect)
+{
+    struct damage_rect box = output_box(output_state.box_pos);
+    int32_t x2 = MIN(rect->x + rect->width, output_width);
+    int32_t y2 = MIN(rect->y + rect->height, output_height);
+
+    for (int32_t y = MAX(rect->y, 0); y < y2; y++) {
+        uint32_t *row = (uint32_t *)((char *)pixels + y * stride);
+        for (int32_t x = MAX(rect->x, 0); x < x2; x++) {
+            bool in_box = x >= box.x && x < box.x + box.width &&
+                y >= box.y && y < box.y + box.height;
+            row[x] = in_box ? 0xffffffff : 0xff000000 |
+                (x * 255 / output_width) << 16 |
+                (y * 255 / output_height) << 8 | 0x40;
+        }
+    }
+}
+
+static void complete_output_frame(struct output_session *os)
+{
+    struct wl_resource *frame = os->frame;
+    struct wl_shm_buffer *shm_buffer =
+        os->buffer ? wl_shm_buffer_get(os->buffer) : NULL;
+
+    os->capture_requested = false;
+
+    if (!shm_buffer ||
+            (wl_shm_buffer_get_format(shm_buffer) != WL_SHM_FORMAT_XRGB8888 &&
+             wl_shm_buffer_get_format(shm_buffer) != WL_SHM_FORMAT_ARGB8888) ||
+            wl_shm_buffer_get_width(shm_buffer) != output_width ||
+            wl_shm_buffer_get_height(shm_buffer) != output_height) {
+        ext_image_copy_capture_frame_v1_send_failed(frame,
+                EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_BUFFER_CONSTRAINTS);
+        print_event("output frame failed (buffer constraints)");
+        return;
+    }
+
+    /* like a real compositor, only write what the client is missing */
+    struct damage written = os->buffer_damage;
+    damage_add_damage(&written, &os->output_damage);
+    uint64_t bytes = damage_area(&written) * 4;
+
+    wl_shm_buffer_begin_access(shm_buffer);
+    for (int i = 0; i < written.count; i++)
+        fill_output_rect(wl_shm_buffer_get_data(shm_buffer),
+                wl_shm_buffer_get_stride(shm_buffer), &written.rects[i]);
+    wl_shm_buffer_end_access(shm_buffer);
+
+    /* nothing was committed yet for the first frame */
+    struct timespec tp = output_state.commit_time;
+    if (tp.tv_sec == 0 && tp.tv_nsec == 0)
+        clock_gettime(CLOCK_MONOTONIC, &tp);
+    uint64_t sec = tp.tv_sec;
+
+    ext_image_copy_capture_frame_v1_send_transform(frame,
+            WL_OUTPUT_TRANSFORM_NORMAL);
+    for (int i = 0; i < os->output_damage.count; i++) {
+        struct damage_rect *r = &os->output_damage.rects[i];
+        ext_image_copy_capture_frame_v1_send_damage(frame, r->x, r->y,
+                r->width, r->height);
+    }
+    ext_image_copy_capture_frame_v1_send_presentation_time(frame, sec >> 32,
+            sec & 0xffffffff, tp.tv_nsec);
+    ext_image_copy_capture_frame_v1_send_ready(frame);
+    os->copied_serial = output_state.serial;
+    damage_clear(&os->output_damage);
+    output_state.frames_copied++;
+    output_state.bytes_copied += bytes;
+
+    /* too noisy while animating */
+    if (!output_state.fps)
+        print_event("output frame %u copied (%" PRIu64 " bytes)",
+                output_state.serial, bytes);
+}
+
+static void output_frame_attach_buffer(struct wl_client *client,
+        struct wl_resource *resource, struct wl_resource *buffer)
+{
+    struct output_session *os = wl_resource_get_user_data(resource);
+    if (!os)
+        return;
+
+    output_session_detach_buffer(os);
+    os->buffer = buffer;
+    wl_resource_add_destroy_listener(buffer, &os->buffer_destroy);
+}
+
+static void output_frame_damage_buffer(struct wl_client *client,
+        struct wl_resource *resource, int32_t x, int32_t y, int32_t width,
+        int32_t height)
+{
+    struct output_session *os = wl_resource_get_user_data(resource);
+    if (!os)
+        return;
+
+    if (x < 0 || y < 0 || width <= 0 || height <= 0) {
+        wl_resource_post_error(resource,
+                EXT_IMAGE_COPY_CAPTURE_FRAME_V1_ERROR_INVALID_BUFFER_DAMAGE,
+                "invalid buffer damage");
+        return;
+    }
+
+    damage_add(&os->buffer_damage, x, y, width, height);
+}
+
+static void output_frame_capture(struct wl_client *client,
+        struct wl_resource *resource)
+{
+    struct output_session *os = wl_resource_get_user_data(resource);
+    if (!os) {
+        ext_image_copy_capture_frame_v1_send_failed(resource,
+                EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_STOPPED);
+        return;
+    }
+
+    os->capture_requested = true;
+
+    /* copy right away if something was drawn since the last copy, otherwise
+     * wait for the next redraw */
+    if (os->copied_serial != output_state.serial)
+        complete_output_frame(os);
+}
+
+static const struct ext_image_copy_capture_frame_v1_interface output_frame_impl = {
+    resource_destroy,
+    output_frame_attach_buffer,
+    output_frame_damage_buffer,
+    output_frame_capture,
+};
+
+static void output_frame_resource_destroy(struct wl_resource *resource)
+{
+    struct output_session *os = wl_resource_get_user_data(resource);
+    if (!os)
+        return;
+
+    os->frame = NULL;
+    os->capture_requested = false;
+    output_session_detach_buffer(os);
+}
+
+static void output_session_create_frame(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id)
+{
+    struct output_session *os = wl_resource_get_user_data(resource);
+
+    if (os->frame) {
+        wl_resource_post_error(resource,
+                EXT_IMAGE_COPY_CAPTURE_SESSION_V1_ERROR_DUPLICATE_FRAME,
+                "a frame already exists");
+        return;
+    }
+
+    os->frame = wl_resource_create(client,
+            &ext_image_copy_capture_frame_v1_interface,
+            wl_resource_get_version(resource), id);
+    if (!os->frame) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    damage_clear(&os->buffer_damage);
+    wl_resource_set_implementation(os->frame, &output_frame_impl, os,
+            output_frame_resource_destroy);
+}
+
+static const struct ext_image_copy_capture_session_v1_interface output_session_impl = {
+    output_session_create_frame,
+    resource_destroy,
+};
+
+static void output_session_resource_destroy(struct wl_resource *resource)
+{
+    struct output_session *os = wl_resource_get_user_data(resource);
+
+    /* the frame may outlive this */
+    if (os->frame)
+        wl_resource_set_user_data(os->frame, NULL);
+    output_session_detach_buffer(os);
+    wl_list_remove(&os->link);
+    free(os);
+    print_event("output session destroyed");
+}
+
+static void send_output_constraints(struct output_session *os)
+{
+    ext_image_copy_capture_session_v1_send_buffer_size(os->session,
+            output_width, output_height);
+    ext_image_copy_capture_session_v1_send_shm_format(os->session,
+            WL_SHM_FORMAT_XRGB8888);
+    ext_image_copy_capture_session_v1_send_shm_format(os->session,
+            WL_SHM_FORMAT_ARGB8888);
+    ext_image_copy_capture_session_v1_send_done(os->session);
+}
+
+static void copy_capture_manager_create_session(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id,
+        struct wl_resource *source, uint32_t options)
+{
+    struct output_session *os = calloc(1, sizeof(*os));
+    if (!os) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    os->session = wl_resource_create(client,
+            &ext_image_copy_capture_session_v1_interface,
+            wl_resource_get_version(resource), id);
+    if (!os->session) {
+        free(os);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(os->session, &output_session_impl, os,
+            output_session_resource_destroy);
+    os->buffer_destroy.notify = output_session_buffer_destroy;
+    wl_list_init(&os->buffer_destroy.link);
+    wl_list_insert(&output_sessions, &os->link);
+    /* the first frame always has full damage */
+    damage_add(&os->output_damage, 0, 0, output_width, output_height);
+
+    send_output_constraints(os);
+    print_event("output session created (paint_cursors %s)",
+            options & EXT_IMAGE_COPY_CAPTURE_MANAGER_V1_OPTIONS_PAINT_CURSORS ?
+            "yes" : "no");
+}
+
+static void copy_capture_manager_create_pointer_cursor_session(
+        struct wl_client *client, struct wl_resource *resource, uint32_t id,
+        struct wl_resource *source, struct wl_resource *pointer)
+{
+    struct cursor_session *cs = calloc(1, sizeof(*cs));
+    if (!cs) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    cs->resource = wl_resource_create(client,
+            &ext_image_copy_capture_cursor_session_v1_interface,
+            wl_resource_get_version(resource), id);
+    if (!cs->resource) {
+        free(cs);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(cs->resource, &cursor_session_impl, cs,
+            cursor_session_resource_destroy);
+    cs->buffer_destroy.notify = cursor_session_buffer_destroy;
+    wl_list_init(&cs->buffer_destroy.link);
+    wl_list_insert(&cursor_sessions, &cs->link);
+    print_event("cursor session created");
+}
+
+static const struct ext_image_copy_capture_manager_v1_interface copy_capture_manager_impl = {
+    copy_capture_manager_create_session,
+    copy_capture_manager_create_pointer_cursor_session,
+    resource_destroy,
+};
+
+static void copy_capture_manager_bind(struct wl_client *client, void *data,
+        uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client,
+            &ext_image_copy_capture_manager_v1_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &copy_capture_manager_impl,
+            NULL, NULL);
+}
+
+static void set_cursor(int32_t width, int32_t height, int32_t hotspot_x,
+        int32_t hotspot_y, uint32_t color)
+{
+    bool resized = width != cursor_state.width ||
+        height != cursor_state.height;
+
+    cursor_state.width = width;
+    cursor_state.height = height;
+    cursor_state.hotspot_x = hotspot_x;
+    cursor_state.hotspot_y = hotspot_y;
+    cursor_state.color = color;
+    cursor_state.serial++;
+
+    struct cursor_session *cs;
+    wl_list_for_each(cs, &cursor_sessions, link) {
+        if (!cs->session)
+            continue;
+        if (resized)
+            send_cursor_constraints(cs);
+        if (cursor_state.visible)
+            ext_image_copy_capture_cursor_session_v1_send_hotspot(
+                    cs->resource, hotspot_x, hotspot_y);
+        if (cs->frame && cs->capture_requested)
+            complete_cursor_frame(cs);
+    }
+    print_event("cursor %dx%d hotspot %d %d color %06x", width, height,
+            hotspot_x, hotspot_y, color);
+}
+
+static void set_cursor_visible(bool visible)
+{
+    if (visible == cursor_state.visible)
+        return;
+    cursor_state.visible = visible;
+
+    struct cursor_session *cs;
+    wl_list_for_each(cs, &cursor_sessions, link) {
+        if (!cs->session)
+            continue;
+        if (visible)
+            send_cursor_enter(cs);
+        else
+            ext_image_copy_capture_cursor_session_v1_send_leave(cs->resource);
+    }
+    print_event("cursor %s", visible ? "shown" : "hidden");
+}
+
+enum redraw {
+    REDRAW_NEW,
+    /* damaged, but drawn the same as before */
+    REDRAW_SAME,
+    /* not damaged at all */
+    REDRAW_STILL,
+};
+
+static void redraw_output(enum redraw redraw)
+{
+    struct damage_rect old_box = output_box(output_state.box_pos);
+    if (redraw == REDRAW_NEW)
+        output_state.box_pos++;
+    struct damage_rect new_box = output_box(output_state.box_pos);
+    output_state.serial++;
+    clock_gettime(CLOCK_MONOTONIC, &output_state.commit_time);
+
+    struct output_session *os;
+    wl_list_for_each(os, &output_sessions, link) {
+        if (redraw != REDRAW_STILL) {
+            damage_add(&os->output_damage, old_box.x, old_box.y,
+                    old_box.width, old_box.height);
+            damage_add(&os->output_damage, new_box.x, new_box.y,
+                    new_box.width, new_box.height);
+        }
+        if (os->frame && os->capture_requested)
+            complete_output_frame(os);
+    }
+}
+
+static int animate_output(void *data)
+{
+    redraw_output(REDRAW_NEW);
+    wl_event_source_timer_update(output_state.timer,
+            MAX(1000 / output_state.fps, 1));
+    return 0;
+}
+
+static void set_output_animation(int fps)
+{
+    if (fps == output_state.fps)
+        return;
+
+    if (!fps) {
+        wl_event_source_timer_update(output_state.timer, 0);
+        print_event("animation stopped, %u frames copied (%" PRIu64 " bytes)",
+                output_state.frames_copied, output_state.bytes_copied);
+    } else {
+        wl_event_source_timer_update(output_state.timer,
+                MAX(1000 / fps, 1));
+        print_event("animating at %d fps", fps);
+    }
+    output_state.fps = fps;
+}
+
+static const struct zwlr_output_mode_v1_interface output_mode_impl = {
+    resource_destroy,
+};
+
+static const struct zwlr_output_head_v1_interface output_head_impl = {
+    resource_destroy,
+};
+
+static void output_head_resource_destroy(struct wl_resource *resource)
+{
+    struct output_manager *om = wl_resource_get_user_data(resource);
+    if (om && om->head == resource)
+        om->head = NULL;
+}
+
+static void output_mode_resource_destroy(struct wl_resource *resource)
+{
+    struct output_manager *om = wl_resource_get_user_data(resource);
+    if (om && om->mode == resource)
+        om->mode = NULL;
+}
+
+/* advertises the current mode as a new mode object, like wlroots does for
+ * custom modes */
+static void send_output_head_mode(struct output_manager *om)
+{
+    if (!om->head)
+        return;
+
+    struct wl_resource *mode = wl_resource_create(
+            wl_resource_get_client(om->head), &zwlr_output_mode_v1_interface,
+            wl_resource_get_version(om->head), 0);
+    if (!mode) {
+        wl_client_post_no_memory(wl_resource_get_client(om->head));
+        return;
+    }
+    wl_resource_set_implementation(mode, &output_mode_impl, om,
+            output_mode_resource_destroy);
+
+    zwlr_output_head_v1_send_mode(om->head, mode);
+    zwlr_output_mode_v1_send_size(mode, output_width, output_height);
+    if (output_refresh)
+        zwlr_output_mode_v1_send_refresh(mode, output_refresh);
+    zwlr_output_head_v1_send_current_mode(om->head, mode);
+
+    if (om->mode) {
+        zwlr_output_mode_v1_send_finished(om->mode);
+        wl_resource_set_user_data(om->mode, NULL);
+    }
+    om->mode = mode;
+}
+
+static void output_configuration_head_set_mode(struct wl_client *client,
+        struct wl_resource *resource, struct wl_resource *mode)
+{
+    struct output_configuration *oc = wl_resource_get_user_data(resource);
+    /* only the current mode is ever advertised */
+    oc->width = output_width;
+    oc->height = output_height;
+    oc->refresh = output_refresh;
+}
+
+static void output_configuration_head_set_custom_mode(struct wl_client *client,
+        struct wl_resource *resource, int32_t width, int32_t height,
+        int32_t refresh)
+{
+    struct output_configuration *oc = wl_resource_get_user_data(resource);
+    if (width <= 0 || height <= 0 || refresh < 0) {
+        wl_resource_post_error(resource,
+                ZWLR_OUTPUT_CONFIGURATION_HEAD_V1_ERROR_INVALID_CUSTOM_MODE,
+                "invalid custom mode %dx%d@%d", width, height, refresh);
+        return;
+    }
+    oc->width = width;
+    oc->height = height;
+    oc->refresh = refresh;
+}
+
+static void output_configuration_head_set_position(struct wl_client *client,
+        struct wl_resource *resource, int32_t x, int32_t y)
+{
+}
+
+static void output_configuration_head_set_transform(struct wl_client *client,
+        struct wl_resource *resource, int32_t transform)
+{
+}
+
+static void output_configuration_head_set_scale(struct wl_client *client,
+        struct wl_resource *resource, wl_fixed_t scale)
+{
+}
+
+static void output_configuration_head_set_adaptive_sync(
+        struct wl_client *client, struct wl_resource *resource, uint32_t state)
+{
+}
+
+static const struct zwlr_output_configuration_head_v1_interface output_configuration_head_impl = {
+    output_configuration_head_set_mode,
+    output_configuration_head_set_custom_mode,
+    output_configuration_head_set_position,
+    output_configuration_head_set_transform,
+    output_configuration_head_set_scale,
+    output_configuration_head_set_adaptive_sync,
+};
+
+static void output_configuration_enable_head(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id, struct wl_resource *head)
+{
+    struct output_configuration *oc = wl_resource_get_user_data(resource);
+    if (oc->head_configured) {
+        wl_resource_post_error(resource,
+                ZWLR_OUTPUT_CONFIGURATION_V1_ERROR_ALREADY_CONFIGURED_HEAD,
+                "head configured twice");
+        return;
+    }
+    oc->head_configured = true;
+
+    /* the configuration outlives its head configurations */
+    struct wl_resource *config_head = wl_resource_create(client,
+            &zwlr_output_configuration_head_v1_interface,
+            wl_resource_get_version(resource), id);
+    if (!config_head) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(config_head,
+            &output_configuration_head_impl, oc, NULL);
+}
+
+static void output_configuration_disable_head(struct wl_client *client,
+        struct wl_resource *resource, struct wl_resource *head)
+{
+    struct output_configuration *oc = wl_resource_get_user_data(resource);
+    if (oc->head_configured) {
+        wl_resource_post_error(resource,
+                ZWLR_OUTPUT_CONFIGURATION_V1_ERROR_ALREADY_CONFIGURED_HEAD,
+                "head configured twice");
+        return;
+    }
+    oc->head_configured = true;
+    oc->head_disabled = true;
+}
+
+static void set_output_mode(int32_t width, int32_t height, int32_t refresh);
+
+static void finish_output_configuration(struct wl_resource *resource,
+        bool apply)
+{
+    struct output_configuration *oc = wl_resource_get_user_data(resource);
+    if (oc->used) {
+        wl_resource_post_error(resource,
+                ZWLR_OUTPUT_CONFIGURATION_V1_ERROR_ALREADY_USED,
+                "configuration already used");
+        return;
+    }
+    oc->used = true;
+
+    if (!oc->head_configured) {
+        wl_resource_post_error(resource,
+                ZWLR_OUTPUT_CONFIGURATION_V1_ERROR_UNCONFIGURED_HEAD,
+                "head not configured");
+        return;
+    }
+
+    if (oc->serial != output_manager_serial) {
+        zwlr_output_configuration_v1_send_cancelled(resource);
+        return;
+    }
+
+    /* the stand-in output can't be turned off */
+    if (output_modeset_fails || oc->head_disabled) {
+        print_event("output configuration failed");
+        zwlr_output_configuration_v1_send_failed(resource);
+        return;
+    }
+
+    if (apply)
+        set_output_mode(oc->width ? oc->width : output_width,
+                oc->height ? oc->height : output_height,
+                oc->width ? oc->refresh : output_refresh);
+    zwlr_output_configuration_v1_send_succeeded(resource);
+}
+
+static void output_configuration_apply(struct wl_client *client,
+        struct wl_resource *resource)
+{
+    finish_output_configuration(resource, true);
+}
+
+static void output_configuration_test(struct wl_client *client,
+        struct wl_resource *resource)
+{
+    finish_output_configuration(resource, false);
+}
+
+static const struct zwlr_output_configuration_v1_interface output_configuration_impl = {
+    output_configuration_enable_head,
+    output_configuration_disable_head,
+    output_configuration_apply,
+    output_configuration_test,
+    resource_destroy,
+};
+
+static void output_configuration_resource_destroy(struct wl_resource *resource)
+{
+    free(wl_resource_get_user_data(resource));
+}
+
+static void output_manager_create_configuration(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id, uint32_t serial)
+{
+    struct output_configuration *oc = calloc(1, sizeof(*oc));
+    struct wl_resource *config = wl_resource_create(client,
+            &zwlr_output_configuration_v1_interface,
+            wl_resource_get_version(resource), id);
+    if (!oc || !config) {
+        free(oc);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    oc->serial = serial;
+    wl_resource_set_implementation(config, &output_configuration_impl, oc,
+            output_configuration_resource_destroy);
+}
+
+static void output_manager_stop(struct wl_client *client,
+        struct wl_resource *resource)
+{
+    zwlr_output_manager_v1_send_finished(resource);
+    wl_resource_destroy(resource);
+}
+
+static const struct zwlr_output_manager_v1_interface output_manager_impl = {
+    output_manager_create_configuration,
+    output_manager_stop,
+};
+
+static void output_manager_resource_destroy(struct wl_resource *resource)
+{
+    struct output_manager *om = wl_resource_get_user_data(resource);
+    if (om->head)
+        wl_resource_set_user_data(om->head, NULL);
+    if (om->mode)
+        wl_resource_set_user_data(om->mode, NULL);
+    wl_list_remove(&om->link);
+    free(om);
+}
+
+static void output_manager_bind(struct wl_client *client, void *data,
+        uint32_t version, uint32_t id)
+{
+    struct output_manager *om = calloc(1, sizeof(*om));
+    if (!om) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    om->resource = wl_resource_create(client, &zwlr_output_manager_v1_interface,
+            version, id);
+    om->head = wl_resource_create(client, &zwlr_output_head_v1_interface,
+            version, 0);
+    if (!om->resource || !om->head) {
+        if (om->resource)
+            wl_resource_destroy(om->resource);
+        free(om);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(om->resource, &output_manager_impl, om,
+            output_manager_resource_destroy);
+    wl_resource_set_implementation(om->head, &output_head_impl, om,
+            output_head_resource_destroy);
+    wl_list_insert(&output_managers, &om->link);
+
+    zwlr_output_manager_v1_send_head(om->resource, om->head);
+    zwlr_output_head_v1_send_name(om->head, output_name);
+    zwlr_output_head_v1_send_description(om->head, "mpvif stand-in output");
+    zwlr_output_head_v1_send_enabled(om->head, 1);
+    send_output_head_mode(om);
+    zwlr_output_head_v1_send_position(om->head, 0, 0);
+    zwlr_output_head_v1_send_transform(om->head, WL_OUTPUT_TRANSFORM_NORMAL);
+    zwlr_output_head_v1_send_scale(om->head, wl_fixed_from_int(1));
+    zwlr_output_manager_v1_send_done(om->resource, output_manager_serial);
+}
+
+static void set_output_mode(int32_t width, int32_t height, int32_t refresh)
+{
+    output_width = width;
+    output_height = height;
+    output_refresh = refresh;
+
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &output_resources) {
+        wl_output_send_mode(resource,
+                WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED,
+                output_width, output_height, output_refresh);
+        if (wl_resource_get_version(resource) >= WL_OUTPUT_DONE_SINCE_VERSION)
+            wl_output_send_done(resource);
+    }
+
+    struct output_session *os;
+    wl_list_for_each(os, &output_sessions, link) {
+        damage_clear(&os->output_damage);
+        damage_add(&os->output_damage, 0, 0, width, height);
+        send_output_constraints(os);
+    }
+
+    output_manager_serial++;
+    struct output_manager *om;
+    wl_list_for_each(om, &output_managers, link) {
+        send_output_head_mode(om);
+        zwlr_output_manager_v1_send_done(om->resource, output_manager_serial);
+    }
+
+    print_event("output mode %dx%d@%d", width, height, refresh);
+    redraw_output(REDRAW_NEW);
+}
+
+static const struct mpvif_pointer_constraints_v1_interface pointer_constraints_impl = {
+    resource_destroy,
+};
+
+static void pointer_constraints_manager_get_pointer_constraints(
+        struct wl_client *client, struct wl_resource *resource, uint32_t id,
+        struct wl_resource *seat)
+{
+    struct wl_resource *pc = wl_resource_create(client,
+            &mpvif_pointer_constraints_v1_interface,
+            wl_resource_get_version(resource), id);
+    if (!pc) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(pc, &pointer_constraints_impl, NULL,
+            unlink_resource);
+    wl_list_insert(&pointer_constraints_resources, wl_resource_get_link(pc));
+    mpvif_pointer_constraints_v1_send_state(pc, pointer_constraint_state);
+}
+
+static const struct mpvif_pointer_constraints_manager_v1_interface pointer_constraints_manager_impl = {
+    pointer_constraints_manager_get_pointer_constraints,
+    resource_destroy,
+};
+
+static void pointer_constraints_manager_bind(struct wl_client *client,
+        void *data, uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client,
+            &mpvif_pointer_constraints_manager_v1_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource,
+            &pointer_constraints_manager_impl, NULL, NULL);
+}
+
+static void set_pointer_constraint_state(uint32_t mask, uint32_t value)
+{
+    uint32_t state = (pointer_constraint_state & ~mask) | value;
+    if (state == pointer_constraint_state)
+        return;
+    pointer_constraint_state = state;
+
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &pointer_constraints_resources)
+        mpvif_pointer_constraints_v1_send_state(resource, state);
+    print_event("pointer constraint state %s%s%s",
+            state & MPVIF_POINTER_CONSTRAINTS_V1_STATE_LOCKED ? "locked " : "",
+            state & MPVIF_POINTER_CONSTRAINTS_V1_STATE_CONFINED ? "confined " : "",
+            state & MPVIF_POINTER_CONSTRAINTS_V1_STATE_RELATIVE ? "relative" : "");
+}
+
+static void send_pointer_warp(double x, double y)
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    uint64_t sec = tp.tv_sec;
+
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &pointer_warp_resources) {
+        mpvif_pointer_warp_v1_send_warp(resource, sec >> 32,
+                sec & 0xffffffff, tp.tv_nsec, wl_fixed_from_double(x),
+                wl_fixed_from_double(y));
+    }
+    print_event("warp %f %f", x, y);
+}
+
+static void handle_command(char *line)
+{
+    double x, y;
+    int32_t width, height, hotspot_x, hotspot_y;
+    uint32_t color = 0xffffff;
+    int n, id, count, pos = 0;
+    char word[256], yes_no[4];
+    size_t size;
+    struct toplevel *tl;
+
+    if (sscanf(line, "toplevel %d %255s %n", &id, word, &pos) >= 2) {
+        add_toplevel(id, word, pos ? line + pos : "");
+        return;
+    }
+
+    if (sscanf(line, "title %d %n", &id, &pos) >= 1 &&
+            strncmp(line, "title ", 6) == 0) {
+        if ((tl = find_toplevel(id)))
+            set_toplevel_title(tl, pos ? line + pos : "");
+        return;
+    }
+
+    if (sscanf(line, "titlestorm %d %d", &id, &count) == 2) {
+        if ((tl = find_toplevel(id))) {
+            for (int i = 0; i < count; i++) {
+                char title[64];
+                snprintf(title, sizeof(title), "FPS: %d", i % 1000);
+                set_toplevel_title(tl, title);
+            }
+            print_event("toplevel %d title changed %d times", id, count);
+        }
+        return;
+    }
+
+    if (sscanf(line, "fullscreen %d %3s", &id, yes_no) == 2) {
+        if ((tl = find_toplevel(id)))
+            set_toplevel_fullscreen(tl, strcmp(yes_no, "yes") == 0);
+        return;
+    }
+
+    if (sscanf(line, "output %d %3s", &id, yes_no) == 2) {
+        if ((tl = find_toplevel(id)))
+            set_toplevel_on_output(tl, strcmp(yes_no, "yes") == 0);
+        return;
+    }
+
+    if (sscanf(line, "close %d", &id) == 1) {
+        if ((tl = find_toplevel(id)))
+            close_toplevel(tl);
+        return;
+    }
+
+    for (int kind = 0; kind < 2; kind++) {
+        size_t len = strlen(selection_names[kind]);
+        if (strncmp(line, selection_names[kind], len) != 0 ||
+                (line[len] != ' ' && line[len] != '\0'))
+            continue;
+
+        const char *text = line[len] ? line + len + 1 : "";
+        if (*text)
+            set_selection(kind, NULL, strdup(text), strlen(text));
+        else
+            set_selection(kind, NULL, NULL, 0);
+        return;
+    }
+
+    if (sscanf(line, "selection-size %zu", &size) == 1) {
+        char *text = generate_text(size);
+        if (text)
+            set_selection(SELECTION_REGULAR, NULL, text, size);
+        return;
+    }
+
+    if (sscanf(line, "selectionstorm %d", &count) == 1) {
+        for (int i = 0; i < count; i++) {
+            char text[64];
+            snprintf(text, sizeof(text), "clip %d", i);
+            set_selection(SELECTION_REGULAR, NULL, strdup(text), strlen(text));
+        }
+        return;
+    }
+
+    if (sscanf(line, "warp %lf %lf", &x, &y) == 2)
+        send_pointer_warp(x, y);
+    else if (strcmp(line, "constraint none") == 0)
+        set_pointer_constraint_state(MPVIF_POINTER_CONSTRAINTS_V1_STATE_LOCKED |
+                MPVIF_POINTER_CONSTRAINTS_V1_STATE_CONFINED, 0);
+    else if (strcmp(line, "constraint locked") == 0)
+        set_pointer_constraint_state(MPVIF_POINTER_CONSTRAINTS_V1_STATE_LOCKED |
+                MPVIF_POINTER_CONSTRAINTS_V1_STATE_CONFINED,
+                MPVIF_POINTER_CONSTRAINTS_V1_STATE_LOCKED);
+    else if (strcmp(line, "constraint confined") == 0)
+        set_pointer_constraint_state(MPVIF_POINTER_CONSTRAINTS_V1_STATE_LOCKED |
+                MPVIF_POINTER_CONSTRAINTS_V1_STATE_CONFINED,
+                MPVIF_POINTER_CONSTRAINTS_V1_STATE_CONFINED);
+    else if (strcmp(line, "relative yes") == 0)
+        set_pointer_constraint_state(MPVIF_POINTER_CONSTRAINTS_V1_STATE_RELATIVE,
+                MPVIF_POINTER_CONSTRAINTS_V1_STATE_RELATIVE);
+    else if (strcmp(line, "relative no") == 0)
+        set_pointer_constraint_state(MPVIF_POINTER_CONSTRAINTS_V1_STATE_RELATIVE,
+                0);
+    else if (strcmp(line, "cursor hide") == 0)
+        set_cursor_visible(false);
+    else if (strcmp(line, "cursor show") == 0)
+        set_cursor_visible(true);
+    else if ((n = sscanf(line, "cursor %d %d %d %d %x", &width, &height,
+                    &hotspot_x, &hotspot_y, &color)) >= 4 &&
+            width > 0 && height > 0 && width <= 256 && height <= 256)
+        set_cursor(width, height, hotspot_x, hotspot_y, color & 0xffffff);
+    else if (strcmp(line, "redraw") == 0)
+        redraw_output(REDRAW_NEW);
+    else if (strcmp(line, "redraw same") == 0)
+        redraw_output(REDRAW_SAME);
+    else if (strcmp(line, "redraw still") == 0)
+        redraw_output(REDRAW_STILL);
+    else if (sscanf(line, "animate %d", &count) == 1 && count >= 0)
+        set_output_animation(count);
+    else if ((n = sscanf(line, "mode %d %d %d", &width, &height,
+                    &count)) >= 2 && width > 0 && height > 0)
+        set_output_mode(width, height, n == 3 ? count : output_refresh);
+    else if (strcmp(line, "modeset fail") == 0)
+        output_modeset_fails = true;
+    else if (strcmp(line, "modeset ok") == 0)
+        output_modeset_fails = false;
+    else if (sscanf(line, "quiet %3s", yes_no) == 1)
+        pointer_stats.quiet = strcmp(yes_no, "yes") == 0;
+    else if (strcmp(line, "stats") == 0)
+        print_pointer_stats();
+    else if (strcmp(line, "quit") == 0)
+        wl_display_terminate(display);
+    else if (*line != '\0')
+        fprintf(stderr, "unknown command: %s\n", line);
+}
+
+static int handle_stdin(int fd, uint32_t mask, void *data)
+{
+    if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+        wl_display_terminate(display);
+        return 0;
+    }
+
+    ssize_t ret = read(fd, stdin_buf + stdin_buf_len,
+            sizeof(stdin_buf) - stdin_buf_len - 1);
+    if (ret <= 0) {
+        if (ret == 0 || errno != EINTR)
+            wl_display_terminate(display);
+        return 0;
+    }
+    stdin_buf_len += ret;
+    stdin_buf[stdin_buf_len] = '\0';
+
+    char *line = stdin_buf;
+    char *nl;
+    while ((nl = strchr(line, '\n'))) {
+        *nl = '\0';
+        handle_command(line);
+        line = nl + 1;
+    }
+
+    stdin_buf_len -= line - stdin_buf;
+    memmove(stdin_buf, line, stdin_buf_len);
+
+    /* a line which doesn't fit is useless anyway */
+    if (stdin_buf_len == sizeof(stdin_buf) - 1)
+        stdin_buf_len = 0;
+
+    return 0;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-s socket] [-o output] [-S seat] "
+            "[-m WIDTHxHEIGHT@mHz] [-W]\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *socket_name = NULL;
+    bool pointer_warp_global = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:o:S:m:Wh")) != -1) {
+        switch (opt) {
+            case 's':
+                socket_name = optarg;
+                break;
+            case 'o':
+                output_name = optarg;
+                break;
+            case 'S':
+                seat_name = optarg;
+                break;
+            case 'm':
+                if (sscanf(optarg, "%dx%d@%d", &output_width, &output_height,
+                            &output_refresh) < 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'W':
+                /* the plugin then relies on sway's cursor_warp events, e.g.
+                 * from mpvif-sway-standin */
+                pointer_warp_global = false;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    wl_list_init(&output_resources);
+    wl_list_init(&toplevel_manager_resources);
+    wl_list_init(&toplevels);
+    wl_list_init(&pointer_warp_resources);
+    wl_list_init(&pointer_constraints_resources);
+    wl_list_init(&cursor_sessions);
+    wl_list_init(&output_sessions);
+    wl_list_init(&output_managers);
+    wl_list_init(&data_devices);
+    wl_list_init(&transfers);
+    clock_gettime(CLOCK_MONOTONIC, &pointer_stats.window_start);
+
+    /* a plugin which goes away mid-transfer shouldn't take us with it */
+    signal(SIGPIPE, SIG_IGN);
+
+    display = wl_display_create();
+    if (!display) {
+        fprintf(stderr, "failed to create the display\n");
+        return 1;
+    }
+
+    if (socket_name) {
+        if (wl_display_add_socket(display, socket_name) == -1) {
+            fprintf(stderr, "failed to add socket %s\n", socket_name);
+            wl_display_destroy(display);
+            return 1;
+        }
+    } else {
+        socket_name = wl_display_add_socket_auto(display);
+        if (!socket_name) {
+            fprintf(stderr, "failed to add a socket\n");
+            wl_display_destroy(display);
+            return 1;
+        }
+    }
+
+    if (wl_display_init_shm(display) == -1) {
+        fprintf(stderr, "failed to initialize wl_shm\n");
+        wl_display_destroy(display);
+        return 1;
+    }
+
+    wl_global_create(display, &wl_output_interface, 4, NULL, output_bind);
+    wl_global_create(display, &wl_seat_interface, 8, NULL, seat_bind);
+    wl_global_create(display, &zwlr_virtual_pointer_manager_v1_interface, 2,
+            NULL, virtual_pointer_manager_bind);
+    wl_global_create(display, &zwlr_foreign_toplevel_manager_v1_interface, 3,
+            NULL, toplevel_manager_bind);
+    if (pointer_warp_global)
+        wl_global_create(display, &mpvif_pointer_warp_manager_v1_interface, 1,
+                NULL, pointer_warp_manager_bind);
+    wl_global_create(display, &mpvif_pointer_constraints_manager_v1_interface,
+            1, NULL, pointer_constraints_manager_bind);
+    wl_global_create(display,
+            &ext_output_image_capture_source_manager_v1_interface, 1, NULL,
+            output_capture_source_manager_bind);
+    wl_global_create(display, &ext_image_copy_capture_manager_v1_interface, 1,
+            NULL, copy_capture_manager_bind);
+    wl_global_create(display, &zwlr_output_manager_v1_interface, 4, NULL,
+            output_manager_bind);
+    wl_global_create(display, &ext_data_control_manager_v1_interface, 1, NULL,
+            data_control_manager_bind);
+
+    struct wl_event_loop *loop = wl_display_get_event_loop(display);
+    struct wl_event_source *stdin_source = wl_event_loop_add_fd(loop,
+            STDIN_FILENO, WL_EVENT_READABLE, handle_stdin, NULL);
+    output_state.timer = wl_event_loop_add_timer(loop, animate_output, NULL);
+
+    fprintf(stderr, "running on WAYLAND_DISPLAY=%s\n", socket_name);
+    wl_display_run(display);
+
+    wl_event_source_remove(output_state.timer);
+    wl_event_source_remove(stdin_source);
+
+    struct transfer *t, *t_tmp;
+    wl_list_for_each_safe(t, t_tmp, &transfers, link)
+        finish_transfer(t);
+
+    wl_display_destroy_clients(display);
+    wl_display_destroy(display);
+
+    for (int kind = 0; kind < 2; kind++)
+        free(selections[kind].text);
+
+    struct toplevel *tl, *tl_tmp;
+    wl_list_for_each_safe(tl, tl_tmp, &toplevels, link)
+        close_toplevel(tl);
+    return 0;
+}
@@ -0,0 +1,576 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A stand-in for sway's IPC socket, so that the cursor_warp and output event
+ * paths of the plugin can be exercised and benchmarked without the patched
+ * sway. It speaks the i3 IPC wire format (the "i3-ipc" magic, the payload
+ * length and the message type, then JSON), answers the requests the plugin
+ * makes and emits events which are requested on stdin, optionally at a fixed
+ * rate and split into fragments.
+ *
+ * Commands (one per line on stdin):
+ *   output X Y W H             move and resize the output in the layout and
+ *                              send an output event
+ *   warp X Y                   send a cursor_warp to layout X,Y
+ *   warps N RATE               send N cursor_warps across the output, RATE per
+ *                              second (0 for as fast as possible)
+ *   outputs N RATE             the same with output events
+ *   fragment BYTES [USEC]      split every message into writes of BYTES,
+ *                              USEC apart, 0 to write them whole again
+ *   disconnect                 close every connection
+ *   shutdown                   send a shutdown event
+ *   quit                       exit
+ *
+ * usage: mpvif-sway-standin [-s socket] [-o output] [-q]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CLIENTS 8
+#define HEADER_SIZE 14
+#define MAX_PAYLOAD 65536
+
+enum message_type {
+    MESSAGE_RUN_COMMAND = 0,
+    MESSAGE_SUBSCRIBE = 2,
+    MESSAGE_GET_OUTPUTS = 3,
+    MESSAGE_GET_TREE = 4,
+    MESSAGE_GET_VERSION = 7,
+};
+
+enum event_type {
+    EVENT_OUTPUT = 1,
+    EVENT_WINDOW = 3,
+    EVENT_SHUTDOWN = 6,
+    EVENT_CURSOR_WARP = 8,
+};
+static const char *const event_names[] = {
+    [EVENT_OUTPUT] = "output",
+    [EVENT_WINDOW] = "window",
+    [EVENT_SHUTDOWN] = "shutdown",
+    [EVENT_CURSOR_WARP] = "cursor_warp",
+};
+
+struct client {
+    int fd;
+    /* a bit for every event type subscribed to */
+    uint32_t events;
+    char buf[HEADER_SIZE + MAX_PAYLOAD];
+    size_t len;
+};
+
+/* events sent at a fixed rate by warps and outputs */
+struct generator {
+    enum event_type type;
+    uint64_t count;
+    uint64_t sent;
+    double rate;
+    struct timespec start;
+};
+
+static const char *output_name = "HEADLESS-1";
+static struct { int x, y, width, height; } output_rect = { 0, 0, 1280, 720 };
+static struct client clients[MAX_CLIENTS];
+static int client_count;
+static struct generator generators[2];
+static int generator_count;
+static int timer_fd = -1;
+static size_t fragment_size;
+static useconds_t fragment_delay;
+static bool quiet;
+static bool running = true;
+
+static char stdin_buf[4096];
+static size_t stdin_buf_len;
+
+static void print_event(const char *fmt, ...)
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    printf("%lld.%09ld ", (long long)tp.tv_sec, tp.tv_nsec);
+
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+
+    putchar('\n');
+    fflush(stdout);
+}
+
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (tp.tv_sec - start->tv_sec) + (tp.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void close_client(struct client *c)
+{
+    close(c->fd);
+    *c = clients[--client_count];
+    print_event("client disconnected, %d left", client_count);
+}
+
+static bool write_all(int fd, const char *data, size_t len)
+{
+    while (len) {
+        ssize_t ret = write(fd, data, len);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+/* blocks until the client has taken the whole message, so that a slow
+ * reader slows down the generators instead of piling up events */
+static bool send_message(struct client *c, uint32_t type, const char *payload)
+{
+    uint32_t len = strlen(payload);
+    char *msg = malloc(HEADER_SIZE + len);
+    if (!msg)
+        return false;
+
+    memcpy(msg, "i3-ipc", 6);
+    memcpy(msg + 6, &len, 4);
+    memcpy(msg + 10, &type, 4);
+    memcpy(msg + HEADER_SIZE, payload, len);
+
+    bool ok;
+    if (!fragment_size) {
+        ok = write_all(c->fd, msg, HEADER_SIZE + len);
+    } else {
+        ok = true;
+        for (size_t off = 0; ok && off < HEADER_SIZE + len;
+                off += fragment_size) {
+            if (off && fragment_delay)
+                usleep(fragment_delay);
+            ok = write_all(c->fd, msg + off,
+                    MIN(fragment_size, HEADER_SIZE + len - off));
+        }
+    }
+
+    free(msg);
+    return ok;
+}
+
+static void send_event(enum event_type type, const char *payload)
+{
+    for (int i = 0; i < client_count; i++) {
+        struct client *c = &clients[i];
+        if (!(c->events & (1u << type)))
+            continue;
+        if (!send_message(c, type | 1u << 31, payload))
+            close_client(c--);
+    }
+}
+
+static void send_output_event(void)
+{
+    send_event(EVENT_OUTPUT, "{\"change\":\"unspecified\"}");
+}
+
+static void send_cursor_warp(int x, int y)
+{
+    char payload[64];
+    snprintf(payload, sizeof(payload), "{\"lx\":%d,\"ly\":%d}", x, y);
+    send_event(EVENT_CURSOR_WARP, payload);
+}
+
+static void reply_outputs(struct client *c)
+{
+    char payload[512];
+    snprintf(payload, sizeof(payload),
+            "[{\"name\":\"%s\",\"make\":\"mpvif\",\"model\":\"stand-in\","
+            "\"serial\":\"\",\"active\":true,\"dpms\":true,\"power\":true,"
+            "\"primary\":false,\"scale\":1.0,\"transform\":\"normal\","
+            "\"current_workspace\":\"1\",\"rect\":{\"x\":%d,\"y\":%d,"
+            "\"width\":%d,\"height\":%d}}]", output_name, output_rect.x,
+            output_rect.y, output_rect.width, output_rect.height);
+    send_message(c, MESSAGE_GET_OUTPUTS, payload);
+}
+
+/* the output with one workspace and nothing fullscreen */
+static void reply_tree(struct client *c)
+{
+    char payload[1024];
+    snprintf(payload, sizeof(payload),
+            "{\"id\":1,\"name\":\"root\",\"type\":\"root\",\"rect\":"
+            "{\"x\":0,\"y\":0,\"width\":%d,\"height\":%d},\"focus\":[2],"
+            "\"nodes\":[{\"id\":2,\"name\":\"%s\",\"type\":\"output\","
+            "\"rect\":{\"x\":%d,\"y\":%d,\"width\":%d,\"height\":%d},"
+            "\"focus\":[3],\"nodes\":[{\"id\":3,\"name\":\"1\","
+            "\"type\":\"workspace\",\"focus\":[],\"nodes\":[],"
+            "\"floating_nodes\":[]}],\"floating_nodes\":[]}],"
+            "\"floating_nodes\":[]}",
+            output_rect.x + output_rect.width,
+            output_rect.y + output_rect.height, output_name, output_rect.x,
+            output_rect.y, output_rect.width, output_rect.height);
+    send_message(c, MESSAGE_GET_TREE, payload);
+}
+
+static void handle_request(struct client *c, uint32_t type,
+        const char *payload)
+{
+    switch (type) {
+        case MESSAGE_SUBSCRIBE:
+            /* a JSON array of event names, none of which contains another
+             * one in quotes */
+            for (size_t i = 0; i < sizeof(event_names) / sizeof(event_names[0]); i++) {
+                char quoted[32];
+                if (!event_names[i])
+                    continue;
+                snprintf(quoted, sizeof(quoted), "\"%s\"", event_names[i]);
+                if (strstr(payload, quoted))
+                    c->events |= 1u << i;
+            }
+            print_event("subscribe %s", payload);
+            send_message(c, type, "{\"success\":true}");
+            break;
+        case MESSAGE_GET_OUTPUTS:
+            print_event("get_outputs");
+            reply_outputs(c);
+            break;
+        case MESSAGE_GET_TREE:
+            print_event("get_tree");
+            reply_tree(c);
+            break;
+        case MESSAGE_GET_VERSION:
+            send_message(c, type, "{\"major\":1,\"minor\":10,\"patch\":0,"
+                    "\"human_readable\":\"mpvif stand-in\","
+                    "\"loaded_config_file_name\":\"\"}");
+            break;
+        case MESSAGE_RUN_COMMAND:
+            print_event("run_command %s", payload);
+            send_message(c, type, "[{\"success\":true}]");
+            break;
+        default:
+            print_event("unhandled message type %u", type);
+            send_message(c, type, "[]");
+            break;
+    }
+}
+
+/* returns false if the client went away */
+static bool handle_client(struct client *c)
+{
+    ssize_t ret = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len - 1);
+    if (ret <= 0)
+        return ret == -1 && (errno == EAGAIN || errno == EINTR);
+    c->len += ret;
+
+    while (c->len >= HEADER_SIZE) {
+        uint32_t len, type;
+        if (memcmp(c->buf, "i3-ipc", 6) != 0) {
+            print_event("bad magic from client");
+            return false;
+        }
+        memcpy(&len, c->buf + 6, 4);
+        memcpy(&type, c->buf + 10, 4);
+        if (len > MAX_PAYLOAD) {
+            print_event("message of %u bytes is too large", len);
+            return false;
+        }
+        if (c->len < HEADER_SIZE + len)
+            break;
+
+        char saved = c->buf[HEADER_SIZE + len];
+        c->buf[HEADER_SIZE + len] = '\0';
+        handle_request(c, type, c->buf + HEADER_SIZE);
+        c->buf[HEADER_SIZE + len] = saved;
+
+        c->len -= HEADER_SIZE + len;
+        memmove(c->buf, c->buf + HEADER_SIZE + len, c->len);
+    }
+
+    return true;
+}
+
+static void accept_client(int listen_fd)
+{
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1)
+        return;
+
+    if (client_count == MAX_CLIENTS) {
+        close(fd);
+        return;
+    }
+
+    clients[client_count++] = (struct client){ .fd = fd };
+    print_event("client connected, %d in total", client_count);
+}
+
+static void arm_timer(bool armed)
+{
+    /* every millisecond, the generators catch up on what's due */
+    struct itimerspec spec = {0};
+    if (armed) {
+        spec.it_value.tv_nsec = 1000000;
+        spec.it_interval.tv_nsec = 1000000;
+    }
+    timerfd_settime(timer_fd, 0, &spec, NULL);
+}
+
+static void generate_event(struct generator *g)
+{
+    if (g->type == EVENT_CURSOR_WARP) {
+        /* a diagonal sweep, so that consecutive warps differ */
+        uint64_t i = g->sent;
+        send_cursor_warp(output_rect.x + i * 7 % output_rect.width,
+                output_rect.y + i * 5 % output_rect.height);
+    } else {
+        send_output_event();
+    }
+    g->sent++;
+}
+
+static void run_generators(void)
+{
+    uint64_t expirations;
+    (void)!read(timer_fd, &expirations, sizeof(expirations));
+
+    for (int i = 0; i < generator_count; i++) {
+        struct generator *g = &generators[i];
+        double elapsed = seconds_since(&g->start);
+        uint64_t due = g->count;
+        if (g->rate > 0)
+            due = MIN(g->count, (uint64_t)(elapsed * g->rate) + 1);
+
+        while (g->sent < due)
+            generate_event(g);
+
+        if (g->sent == g->count) {
+            elapsed = seconds_since(&g->start);
+            print_event("sent %" PRIu64 " %s events in %.3f s (%.0f/s)",
+                    g->count, event_names[g->type], elapsed,
+                    g->count / elapsed);
+            generators[i--] = generators[--generator_count];
+        }
+    }
+
+    if (!generator_count)
+        arm_timer(false);
+}
+
+static void start_generator(enum event_type type, uint64_t count, double rate)
+{
+    struct generator *g = NULL;
+    for (int i = 0; i < generator_count; i++) {
+        if (generators[i].type == type)
+            g = &generators[i];
+    }
+    if (!g)
+        g = &generators[generator_count++];
+
+    *g = (struct generator){ .type = type, .count = count, .rate = rate };
+    clock_gettime(CLOCK_MONOTONIC, &g->start);
+    if (rate > 0)
+        print_event("sending %" PRIu64 " %s events at %.0f/s", count,
+                event_names[type], rate);
+    else
+        print_event("sending %" PRIu64 " %s events as fast as possible", count,
+                event_names[type]);
+    arm_timer(true);
+}
+
+static void handle_command(char *line)
+{
+    int x, y, width, height, n;
+    unsigned long long count;
+    double rate;
+    size_t size;
+    unsigned int delay;
+
+    if (sscanf(line, "output %d %d %d %d", &x, &y, &width, &height) == 4 &&
+            width > 0 && height > 0) {
+        output_rect.x = x;
+        output_rect.y = y;
+        output_rect.width = width;
+        output_rect.height = height;
+        print_event("output %d,%d %dx%d", x, y, width, height);
+        send_output_event();
+    } else if (sscanf(line, "warps %llu %lf", &count, &rate) == 2) {
+        start_generator(EVENT_CURSOR_WARP, count, rate);
+    } else if (sscanf(line, "outputs %llu %lf", &count, &rate) == 2) {
+        start_generator(EVENT_OUTPUT, count, rate);
+    } else if (sscanf(line, "warp %d %d", &x, &y) == 2) {
+        if (!quiet)
+            print_event("warp %d %d", x, y);
+        send_cursor_warp(x, y);
+    } else if ((n = sscanf(line, "fragment %zu %u", &size, &delay)) >= 1) {
+        fragment_size = size;
+        fragment_delay = n == 2 ? delay : 0;
+    } else if (strcmp(line, "disconnect") == 0) {
+        while (client_count)
+            close_client(&clients[0]);
+    } else if (strcmp(line, "shutdown") == 0) {
+        send_event(EVENT_SHUTDOWN, "{\"change\":\"exit\"}");
+    } else if (strcmp(line, "quit") == 0) {
+        running = false;
+    } else if (*line != '\0') {
+        fprintf(stderr, "unknown command: %s\n", line);
+    }
+}
+
+static void handle_stdin(void)
+{
+    ssize_t ret = read(STDIN_FILENO, stdin_buf + stdin_buf_len,
+            sizeof(stdin_buf) - stdin_buf_len - 1);
+    if (ret <= 0) {
+        if (ret == 0 || errno != EINTR)
+            running = false;
+        return;
+    }
+    stdin_buf_len += ret;
+    stdin_buf[stdin_buf_len] = '\0';
+
+    char *line = stdin_buf;
+    char *nl;
+    while ((nl = strchr(line, '\n'))) {
+        *nl = '\0';
+        handle_command(line);
+        line = nl + 1;
+    }
+
+    stdin_buf_len -= line - stdin_buf;
+    memmove(stdin_buf, line, stdin_buf_len);
+
+    /* a line which doesn't fit is useless anyway */
+    if (stdin_buf_len == sizeof(stdin_buf) - 1)
+        stdin_buf_len = 0;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-s socket] [-o output] [-q]\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *socket_path = "mpvif-sway-standin.sock";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:o:qh")) != -1) {
+        switch (opt) {
+            case 's':
+                socket_path = optarg;
+                break;
+            case 'o':
+                output_name = optarg;
+                break;
+            case 'q':
+                /* single warps aren't printed */
+                quiet = true;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path is too long\n");
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(socket_path);
+    if (listen_fd == -1 ||
+            bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+            listen(listen_fd, MAX_CLIENTS) == -1) {
+        fprintf(stderr, "failed to listen on %s: %s\n", socket_path,
+                strerror(errno));
+        return 1;
+    }
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer_fd == -1) {
+        fprintf(stderr, "timerfd_create() failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    /* a client which goes away mid-message is handled like a disconnect */
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "running on SWAYSOCK=%s\n", socket_path);
+
+    while (running) {
+        struct pollfd pfd[3 + MAX_CLIENTS] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = listen_fd, .events = POLLIN },
+            { .fd = timer_fd, .events = POLLIN },
+        };
+        for (int i = 0; i < client_count; i++)
+            pfd[3 + i] = (struct pollfd){ .fd = clients[i].fd, .events = POLLIN };
+        int nfds = 3 + client_count;
+
+        if (poll(pfd, nfds, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "poll() failed: %s\n", strerror(errno));
+            break;
+        }
+
+        /* backwards, closing a client moves the last one into its place */
+        for (int i = client_count - 1; i >= 0; i--) {
+            if (pfd[3 + i].revents & (POLLIN | POLLHUP | POLLERR) &&
+                    !handle_client(&clients[i]))
+                close_client(&clients[i]);
+        }
+
+        if (pfd[0].revents & (POLLIN | POLLHUP))
+            handle_stdin();
+        if (pfd[1].revents & POLLIN)
+            accept_client(listen_fd);
+        if (pfd[2].revents & POLLIN)
+            run_generators();
+    }
+
+    while (client_count)
+        close_client(&clients[0]);
+    close(timer_fd);
+    close(listen_fd);
+    unlink(socket_path);
+    return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shader-cache.h"
+
+struct shader_cache_entry {
+    char *app_id;
+    int32_t width;
+    int32_t height;
+    int64_t cost;
+    char *chain;
+};
+
+struct shader_cache {
+    char *path;
+    struct shader_cache_entry *entries;
+    int count;
+    int capacity;
+};
+
+static struct shader_cache_entry *find_entry(struct shader_cache *cache,
+        const char *app_id, int32_t width, int32_t height)
+{
+    for (int i = 0; i < cache->count; i++) {
+        struct shader_cache_entry *e = &cache->entries[i];
+        if (e->width == width && e->height == height &&
+                strcmp(e->app_id, app_id) == 0)
+            return e;
+    }
+
+    return NULL;
+}
+
+static struct shader_cache_entry *add_entry(struct shader_cache *cache,
+        const char *app_id, int32_t width, int32_t height)
+{
+    if (cache->count == cache->capacity) {
+        int capacity = cache->capacity ? cache->capacity * 2 : 16;
+        struct shader_cache_entry *entries = realloc(cache->entries,
+                capacity * sizeof(*entries));
+        if (!entries)
+            return NULL;
+        cache->entries = entries;
+        cache->capacity = capacity;
+    }
+
+    char *app_id_dup = strdup(app_id);
+    if (!app_id_dup)
+        return NULL;
+
+    struct shader_cache_entry *e = &cache->entries[cache->count++];
+    *e = (struct shader_cache_entry){
+        .app_id = app_id_dup,
+        .width = width,
+        .height = height,
+    };
+    return e;
+}
+
+static bool set_entry(struct shader_cache *cache, const char *app_id,
+        int32_t width, int32_t height, const char *chain, int64_t cost)
+{
+    char *chain_dup = strdup(chain);
+    if (!chain_dup)
+        return false;
+
+    struct shader_cache_entry *e = find_entry(cache, app_id, width, height);
+    if (!e)
+        e = add_entry(cache, app_id, width, height);
+    if (!e) {
+        free(chain_dup);
+        return false;
+    }
+
+    free(e->chain);
+    e->chain = chain_dup;
+    e->cost = cost;
+    return true;
+}
+
+static void parse_line(struct shader_cache *cache, char *line)
+{
+    line[strcspn(line, "\n")] = '\0';
+
+    char *app_id = strsep(&line, "\t");
+    char *size = strsep(&line, "\t");
+    char *cost = strsep(&line, "\t");
+    char *chain = line;
+    if (!chain || *app_id == '\0')
+        return;
+
+    int32_t width, height;
+    int64_t cost_ns;
+    if (sscanf(size, "%" SCNd32 "x%" SCNd32, &width, &height) != 2 ||
+            sscanf(cost, "%" SCNd64, &cost_ns) != 1)
+        return;
+
+    set_entry(cache, app_id, width, height, chain, cost_ns);
+}
+
+struct shader_cache *shader_cache_load(const char *path)
+{
+    struct shader_cache *cache = calloc(1, sizeof(*cache));
+    if (!cache)
+        return NULL;
+
+    if (!path)
+        return cache;
+
+    cache->path = strdup(path);
+    if (!cache->path) {
+        free(cache);
+        return NULL;
+    }
+
+    FILE *f = fopen(path, "re");
+    if (!f)
+        return cache;
+
+    char *line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, f) != -1)
+        parse_line(cache, line);
+
+    free(line);
+    fclose(f);
+    return cache;
+}
+
+void shader_cache_destroy(struct shader_cache *cache)
+{
+    for (int i = 0; i < cache->count; i++) {
+        free(cache->entries[i].app_id);
+        free(cache->entries[i].chain);
+    }
+
+    free(cache->entries);
+    free(cache->path);
+    free(cache);
+}
+
+const char *shader_cache_get(struct shader_cache *cache, const char *app_id,
+        int32_t width, int32_t height)
+{
+    struct shader_cache_entry *e = find_entry(cache, app_id, width, height);
+    return e ? e->chain : NULL;
+}
+
+/* written to a temporary file first so that a crash can't leave a truncated
+ * cache behind */
+static bool write_cache(struct shader_cache *cache)
+{
+    char tmp_path[4096];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache->path) >=
+            (int)sizeof(tmp_path))
+        return false;
+
+    FILE *f = fopen(tmp_path, "we");
+    if (!f)
+        return false;
+
+    for (int i = 0; i < cache->count; i++) {
+        struct shader_cache_entry *e = &cache->entries[i];
+        fprintf(f, "%s\t%" PRId32 "x%" PRId32 "\t%" PRId64 "\t%s\n",
+                e->app_id, e->width, e->height, e->cost, e->chain);
+    }
+
+    if (fclose(f) != 0 || rename(tmp_path, cache->path) != 0) {
+        remove(tmp_path);
+        return false;
+    }
+
+    return true;
+}
+
+bool shader_cache_set(struct shader_cache *cache, const char *app_id,
+        int32_t width, int32_t height, const char *chain, int64_t cost)
+{
+    /* these would break the line format */
+    if (strpbrk(app_id, "\t\n") || strchr(chain, '\n') || *app_id == '\0')
+        return false;
+
+    if (!set_entry(cache, app_id, width, height, chain, cost))
+        return false;
+
+    return !cache->path || write_cache(cache);
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPVIF_SHADER_CACHE_H
+#define MPVIF_SHADER_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The shader chain picked for a game, keyed by app_id and resolution, kept in
+ * a text file with one entry per line:
+ *
+ *     app_id <TAB> WIDTHxHEIGHT <TAB> cost in ns <TAB> chain
+ *
+ * The whole file is rewritten whenever an entry is set.
+ */
+
+struct shader_cache;
+
+/* a missing file gives an empty cache, NULL only on allocation failure. With
+ * a NULL path the cache is only kept in memory. */
+struct shader_cache *shader_cache_load(const char *path);
+void shader_cache_destroy(struct shader_cache *cache);
+
+/* NULL if there is no entry, the chain may be an empty string */
+const char *shader_cache_get(struct shader_cache *cache, const char *app_id,
+        int32_t width, int32_t height);
+/* returns false if the entry couldn't be stored or the file written */
+bool shader_cache_set(struct shader_cache *cache, const char *app_id,
+        int32_t width, int32_t height, const char *chain, int64_t cost);
+
+#endif
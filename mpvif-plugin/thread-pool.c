@@ -0,0 +1,139 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "thread-pool.h"
+
+struct thread_pool {
+    pthread_mutex_t lock;
+    /* signaled when a batch is submitted or the pool is destroyed */
+    pthread_cond_t work_cond;
+    /* signaled when the last job of a batch is done */
+    pthread_cond_t done_cond;
+    pthread_t *workers;
+    int num_workers;
+
+    thread_pool_fn fn;
+    void *data;
+    int jobs;
+    int next_job;
+    int done_jobs;
+    bool stop;
+};
+
+/* takes and runs jobs of the current batch, called with the lock held */
+static void run_jobs(struct thread_pool *pool)
+{
+    while (pool->next_job < pool->jobs) {
+        int job = pool->next_job++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->fn(pool->data, job);
+        pthread_mutex_lock(&pool->lock);
+
+        if (++pool->done_jobs == pool->jobs)
+            pthread_cond_signal(&pool->done_cond);
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    struct thread_pool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop) {
+        if (pool->next_job < pool->jobs)
+            run_jobs(pool);
+        else
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+struct thread_pool *thread_pool_create(int threads)
+{
+    struct thread_pool *pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    if (threads > 1) {
+        pool->workers = calloc(threads - 1, sizeof(pthread_t));
+        if (!pool->workers) {
+            thread_pool_destroy(pool);
+            return NULL;
+        }
+    }
+
+    /* fewer workers than asked for still works */
+    for (int i = 0; i < threads - 1; i++) {
+        if (pthread_create(&pool->workers[i], NULL, worker_main, pool) != 0)
+            break;
+        pool->num_workers++;
+    }
+
+    return pool;
+}
+
+void thread_pool_destroy(struct thread_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_workers; i++)
+        pthread_join(pool->workers[i], NULL);
+
+    free(pool->workers);
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+int thread_pool_threads(struct thread_pool *pool)
+{
+    return pool->num_workers + 1;
+}
+
+void thread_pool_run(struct thread_pool *pool, thread_pool_fn fn, void *data,
+        int jobs)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->data = data;
+    pool->jobs = jobs;
+    pool->next_job = 0;
+    pool->done_jobs = 0;
+    if (pool->num_workers > 0)
+        pthread_cond_broadcast(&pool->work_cond);
+
+    run_jobs(pool);
+    while (pool->done_jobs < pool->jobs)
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
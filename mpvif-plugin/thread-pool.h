@@ -0,0 +1,42 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPVIF_THREAD_POOL_H
+#define MPVIF_THREAD_POOL_H
+
+/*
+ * A fixed set of threads which split up one batch of jobs at a time, for
+ * spreading the rows of a frame over several cores. The thread submitting a
+ * batch runs jobs as well and returns once all of them are done.
+ */
+
+struct thread_pool;
+
+typedef void (*thread_pool_fn)(void *data, int job);
+
+/* threads includes the submitting thread, so 1 creates no extra threads */
+struct thread_pool *thread_pool_create(int threads);
+void thread_pool_destroy(struct thread_pool *pool);
+int thread_pool_threads(struct thread_pool *pool);
+
+/* runs fn(data, 0) .. fn(data, jobs - 1), must not be called concurrently */
+void thread_pool_run(struct thread_pool *pool, thread_pool_fn fn, void *data,
+        int jobs);
+
+#endif
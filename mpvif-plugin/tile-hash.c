@@ -0,0 +1,238 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#include "tile-hash.h"
+
+static const uint32_t key[4] = {
+    0x9e3779b1, 0x85ebca77, 0xc2b2ae3d, 0x27d4eb2f,
+};
+
+/* per block, odd so that every block index gives a different key */
+static const uint32_t key_step[4] = {
+    0x165667b1, 0xd3a2646d, 0xfd7046c5, 0xb55a4f09,
+};
+
+static uint64_t finish(uint64_t acc0, uint64_t acc1, int32_t width,
+        int32_t height)
+{
+    uint64_t h = acc0 ^ (acc1 << 29 | acc1 >> 35) ^
+        ((uint64_t)(uint32_t)width << 32 | (uint32_t)height);
+
+    /* splitmix64 finalizer */
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111eb;
+    h ^= h >> 31;
+    return h;
+}
+
+static void scalar_block(const uint32_t d[4], uint32_t index, uint64_t acc[2])
+{
+    uint32_t dk[4];
+    for (int j = 0; j < 4; j++)
+        dk[j] = d[j] ^ (key[j] + index * key_step[j]);
+
+    acc[0] += (uint64_t)dk[0] * dk[1] + ((uint64_t)d[1] << 32 | d[0]);
+    acc[1] += (uint64_t)dk[2] * dk[3] + ((uint64_t)d[3] << 32 | d[2]);
+}
+
+/* the last 1-3 pixels of a row, zero padded to a block */
+static void load_tail(uint32_t d[4], const char *row, int32_t pixels)
+{
+    memset(d, 0, 16);
+    memcpy(d, row, pixels * 4);
+}
+
+static uint64_t tile_hash_scalar(const void *data, size_t stride,
+        int32_t width, int32_t height)
+{
+    uint64_t acc[2] = {0, 0};
+    uint32_t index = 0;
+    int32_t blocks = width / 4, tail = width % 4;
+
+    for (int32_t y = 0; y < height; y++) {
+        const char *row = (const char *)data + y * stride;
+        uint32_t d[4];
+
+        for (int32_t b = 0; b < blocks; b++) {
+            memcpy(d, row + b * 16, 16);
+            scalar_block(d, index++, acc);
+        }
+
+        if (tail) {
+            load_tail(d, row + blocks * 16, tail);
+            scalar_block(d, index++, acc);
+        }
+    }
+
+    return finish(acc[0], acc[1], width, height);
+}
+
+#ifdef HAVE_X86
+
+static inline __m128i sse2_key(uint32_t index)
+{
+    return _mm_set_epi32(key[3] + index * key_step[3],
+            key[2] + index * key_step[2], key[1] + index * key_step[1],
+            key[0] + index * key_step[0]);
+}
+
+static inline __m128i sse2_block(__m128i acc, __m128i d, __m128i k)
+{
+    __m128i dk = _mm_xor_si128(d, k);
+    __m128i p = _mm_mul_epu32(dk, _mm_srli_epi64(dk, 32));
+    return _mm_add_epi64(acc, _mm_add_epi64(p, d));
+}
+
+static uint64_t tile_hash_sse2(const void *data, size_t stride,
+        int32_t width, int32_t height)
+{
+    const __m128i step = _mm_loadu_si128((const __m128i *)key_step);
+    __m128i acc = _mm_setzero_si128();
+    uint32_t index = 0;
+    int32_t blocks = width / 4, tail = width % 4;
+
+    for (int32_t y = 0; y < height; y++) {
+        const char *row = (const char *)data + y * stride;
+        __m128i k = sse2_key(index);
+
+        for (int32_t b = 0; b < blocks; b++) {
+            __m128i d = _mm_loadu_si128((const __m128i *)(row + b * 16));
+            acc = sse2_block(acc, d, k);
+            k = _mm_add_epi32(k, step);
+        }
+        index += blocks;
+
+        if (tail) {
+            uint32_t d[4];
+            load_tail(d, row + blocks * 16, tail);
+            acc = sse2_block(acc, _mm_loadu_si128((const __m128i *)d), k);
+            index++;
+        }
+    }
+
+    uint64_t a[2];
+    _mm_storeu_si128((__m128i *)a, acc);
+    return finish(a[0], a[1], width, height);
+}
+
+__attribute__((target("avx2")))
+static uint64_t tile_hash_avx2(const void *data, size_t stride,
+        int32_t width, int32_t height)
+{
+    const __m128i step = _mm_loadu_si128((const __m128i *)key_step);
+    /* two blocks per vector, so the keys advance by two steps */
+    const __m256i step2 = _mm256_slli_epi32(
+            _mm256_broadcastsi128_si256(step), 1);
+    __m256i acc = _mm256_setzero_si256();
+    __m128i acc_single = _mm_setzero_si128();
+    uint32_t index = 0;
+    int32_t blocks = width / 4, tail = width % 4;
+
+    for (int32_t y = 0; y < height; y++) {
+        const char *row = (const char *)data + y * stride;
+        __m256i k = _mm256_set_m128i(sse2_key(index + 1), sse2_key(index));
+        int32_t b = 0;
+
+        for (; b + 2 <= blocks; b += 2) {
+            __m256i d = _mm256_loadu_si256((const __m256i *)(row + b * 16));
+            __m256i dk = _mm256_xor_si256(d, k);
+            __m256i p = _mm256_mul_epu32(dk, _mm256_srli_epi64(dk, 32));
+            acc = _mm256_add_epi64(acc, _mm256_add_epi64(p, d));
+            k = _mm256_add_epi32(k, step2);
+        }
+        index += b;
+
+        if (b < blocks) {
+            __m128i d = _mm_loadu_si128((const __m128i *)(row + b * 16));
+            acc_single = sse2_block(acc_single, d, sse2_key(index));
+            index++;
+        }
+
+        if (tail) {
+            uint32_t d[4];
+            load_tail(d, row + blocks * 16, tail);
+            acc_single = sse2_block(acc_single,
+                    _mm_loadu_si128((const __m128i *)d), sse2_key(index));
+            index++;
+        }
+    }
+
+    /* the sum doesn't depend on which lane a block went through */
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc),
+            _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi64(sum, acc_single);
+
+    uint64_t a[2];
+    _mm_storeu_si128((__m128i *)a, sum);
+    return finish(a[0], a[1], width, height);
+}
+
+#endif
+
+tile_hash_fn tile_hash_get(enum tile_hash_impl impl)
+{
+    switch (impl) {
+        case TILE_HASH_SCALAR:
+            return tile_hash_scalar;
+#ifdef HAVE_X86
+        case TILE_HASH_SSE2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2") ? tile_hash_sse2 : NULL;
+        case TILE_HASH_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? tile_hash_avx2 : NULL;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+tile_hash_fn tile_hash_best(void)
+{
+    for (int i = TILE_HASH_IMPL_COUNT - 1; i >= 0; i--) {
+        tile_hash_fn fn = tile_hash_get(i);
+        if (fn)
+            return fn;
+    }
+    return tile_hash_scalar;
+}
+
+const char *tile_hash_impl_name(enum tile_hash_impl impl)
+{
+    switch (impl) {
+        case TILE_HASH_SCALAR:
+            return "scalar";
+        case TILE_HASH_SSE2:
+            return "sse2";
+        case TILE_HASH_AVX2:
+            return "avx2";
+        default:
+            return "unknown";
+    }
+}
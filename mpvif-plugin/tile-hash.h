@@ -0,0 +1,56 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPVIF_TILE_HASH_H
+#define MPVIF_TILE_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Hashing of rectangles of 32-bit pixels, used to find out whether a captured
+ * frame is the same as the previous one in the regions the compositor said
+ * were damaged.
+ *
+ * Every implementation computes the same hash: each 16-byte block is mixed
+ * with a key that depends on its position in the rectangle, multiplied in
+ * 32x32->64 bit halves and summed into two 64-bit accumulators. This maps
+ * directly onto SSE2 (pmuludq) and AVX2, and the scalar version is the
+ * reference. It's not meant to resist deliberate collisions.
+ */
+
+#define TILE_SIZE 64
+
+enum tile_hash_impl {
+    TILE_HASH_SCALAR,
+    TILE_HASH_SSE2,
+    TILE_HASH_AVX2,
+    TILE_HASH_IMPL_COUNT,
+};
+
+typedef uint64_t (*tile_hash_fn)(const void *data, size_t stride,
+        int32_t width, int32_t height);
+
+/* NULL if the implementation isn't built in or the CPU doesn't support it */
+tile_hash_fn tile_hash_get(enum tile_hash_impl impl);
+/* the fastest supported implementation */
+tile_hash_fn tile_hash_best(void);
+const char *tile_hash_impl_name(enum tile_hash_impl impl);
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+struct trace_record {
+    /* the index of the event plus one once it's written, 0 while it's being
+     * written */
+    _Atomic uint64_t seq;
+    const char *name;
+    const char *arg_name;
+    int64_t start;
+    int64_t duration;
+    int64_t arg;
+    pid_t tid;
+};
+
+struct trace_ring {
+    _Atomic uint64_t head;
+    size_t mask;
+    struct trace_record *records;
+};
+
+static _Thread_local pid_t thread_id;
+
+struct trace_ring *trace_ring_create(size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity)
+        size *= 2;
+
+    struct trace_ring *ring = calloc(1, sizeof(*ring));
+    if (!ring)
+        return NULL;
+
+    ring->records = calloc(size, sizeof(*ring->records));
+    if (!ring->records) {
+        free(ring);
+        return NULL;
+    }
+    ring->mask = size - 1;
+
+    return ring;
+}
+
+void trace_ring_destroy(struct trace_ring *ring)
+{
+    free(ring->records);
+    free(ring);
+}
+
+void trace_ring_add(struct trace_ring *ring, const char *name, int64_t start,
+        int64_t duration, const char *arg_name, int64_t arg)
+{
+    if (!thread_id)
+        thread_id = gettid();
+
+    uint64_t index = atomic_fetch_add_explicit(&ring->head, 1,
+            memory_order_relaxed);
+    struct trace_record *r = &ring->records[index & ring->mask];
+
+    atomic_store_explicit(&r->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    r->name = name;
+    r->arg_name = arg_name;
+    r->start = start;
+    r->duration = duration;
+    r->arg = arg;
+    r->tid = thread_id;
+    atomic_store_explicit(&r->seq, index + 1, memory_order_release);
+}
+
+/* copies the record if it still holds the event with the given index */
+static bool read_record(struct trace_ring *ring, uint64_t index,
+        struct trace_record *copy)
+{
+    struct trace_record *r = &ring->records[index & ring->mask];
+
+    if (atomic_load_explicit(&r->seq, memory_order_acquire) != index + 1)
+        return false;
+
+    copy->name = r->name;
+    copy->arg_name = r->arg_name;
+    copy->start = r->start;
+    copy->duration = r->duration;
+    copy->arg = r->arg;
+    copy->tid = r->tid;
+
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&r->seq, memory_order_relaxed) == index + 1;
+}
+
+bool trace_ring_write(struct trace_ring *ring, const char *path,
+        int64_t clock_offset)
+{
+    FILE *f = fopen(path, "we");
+    if (!f)
+        return false;
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t first = head > ring->mask + 1 ? head - (ring->mask + 1) : 0;
+    pid_t pid = getpid();
+    bool comma = false;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (uint64_t i = first; i < head; i++) {
+        struct trace_record r;
+        if (!read_record(ring, i, &r))
+            continue;
+
+        /* timestamps are in microseconds */
+        int64_t ts = r.start + clock_offset;
+        fprintf(f, "%s\n{\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%" PRId64 ".%03" PRId64,
+                comma ? "," : "", r.name, (int)pid, (int)r.tid,
+                ts / 1000, ts % 1000);
+        if (r.duration >= 0)
+            fprintf(f, ",\"ph\":\"X\",\"dur\":%" PRId64 ".%03" PRId64,
+                    r.duration / 1000, r.duration % 1000);
+        else
+            fprintf(f, ",\"ph\":\"i\",\"s\":\"t\"");
+        if (r.arg_name)
+            fprintf(f, ",\"args\":{\"%s\":%" PRId64 "}", r.arg_name, r.arg);
+        fprintf(f, "}");
+        comma = true;
+    }
+    fprintf(f, "\n]}\n");
+
+    return fclose(f) == 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPVIF_TRACE_H
+#define MPVIF_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * An in-memory ring of timeline events, written out as Chrome trace-event
+ * JSON which Perfetto and chrome://tracing can show.
+ *
+ * Adding an event claims a slot with a single atomic increment and never
+ * blocks, so any thread may add events. Once the ring is full, the oldest
+ * events are overwritten. Writing the ring out skips slots which are being
+ * written at the same time.
+ */
+
+struct trace_ring;
+
+/* capacity is rounded up to a power of two */
+struct trace_ring *trace_ring_create(size_t capacity);
+void trace_ring_destroy(struct trace_ring *ring);
+
+/* name and arg_name must be static strings, arg_name may be NULL if there is
+ * no argument. start and duration are in nanoseconds on CLOCK_MONOTONIC,
+ * duration is negative for instant events. */
+void trace_ring_add(struct trace_ring *ring, const char *name, int64_t start,
+        int64_t duration, const char *arg_name, int64_t arg);
+
+/* clock_offset is added to every timestamp, e.g. to move them to the clock
+ * of another trace */
+bool trace_ring_write(struct trace_ring *ring, const char *path,
+        int64_t clock_offset);
+
+#endif
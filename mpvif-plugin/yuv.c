@@ -0,0 +1,302 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#include "yuv.h"
+
+#define ROUND_HALF (1 << (YUV_COEFF_BITS - 1))
+
+static int16_t round_coeff(double x)
+{
+    return x < 0 ? x - 0.5 : x + 0.5;
+}
+
+void yuv_coeffs_init(struct yuv_coeffs *c, enum yuv_matrix matrix, int depth)
+{
+    double kr = matrix == YUV_BT709 ? 0.2126 : 0.299;
+    double kb = matrix == YUV_BT709 ? 0.0722 : 0.114;
+    double one = 1 << YUV_COEFF_BITS;
+    int shift = depth - 8;
+    double ys = (219 << shift) / 255.0 * one;
+    double cs = (224 << shift) / 255.0 * one;
+
+    c->depth = depth;
+
+    /* the middle coefficient takes the rounding error, so that greys stay
+     * neutral and white and black land exactly on the range limits */
+    c->y[0] = round_coeff(kb * ys);
+    c->y[2] = round_coeff(kr * ys);
+    c->y[1] = round_coeff(ys) - c->y[0] - c->y[2];
+
+    c->u[0] = round_coeff(cs / 2);
+    c->u[2] = round_coeff(-kr / (1 - kb) * cs / 2);
+    c->u[1] = -c->u[0] - c->u[2];
+
+    c->v[2] = round_coeff(cs / 2);
+    c->v[0] = round_coeff(-kb / (1 - kr) * cs / 2);
+    c->v[1] = -c->v[0] - c->v[2];
+
+    c->y_offset = ((16 << shift) << YUV_COEFF_BITS) + ROUND_HALF;
+    c->c_offset = ((128 << shift) << YUV_COEFF_BITS) + ROUND_HALF;
+}
+
+enum yuv_matrix yuv_guess_matrix(int32_t width, int32_t height)
+{
+    /* same as mp_csp_guess_colorspace() */
+    return width >= 1280 || height > 576 ? YUV_BT709 : YUV_BT601;
+}
+
+size_t yuv_frame_size(int32_t width, int32_t height, int depth)
+{
+    return (size_t)width * height * 3 * (depth > 8 ? 2 : 1);
+}
+
+static inline int32_t scalar_sample(const int16_t k[3], int32_t offset,
+        uint32_t p)
+{
+    int32_t b = p & 0xff, g = p >> 8 & 0xff, r = p >> 16 & 0xff;
+    return (b * k[0] + g * k[1] + r * k[2] + offset) >> YUV_COEFF_BITS;
+}
+
+static void yuv_row_scalar(const struct yuv_coeffs *c, const void *src,
+        void *y, void *u, void *v, int32_t width)
+{
+    const uint32_t *s = src;
+
+    /* the coefficients keep every sample in range, no clamping needed */
+    for (int32_t i = 0; i < width; i++) {
+        int32_t ys = scalar_sample(c->y, c->y_offset, s[i]);
+        int32_t us = scalar_sample(c->u, c->c_offset, s[i]);
+        int32_t vs = scalar_sample(c->v, c->c_offset, s[i]);
+        if (c->depth > 8) {
+            ((uint16_t *)y)[i] = ys;
+            ((uint16_t *)u)[i] = us;
+            ((uint16_t *)v)[i] = vs;
+        } else {
+            ((uint8_t *)y)[i] = ys;
+            ((uint8_t *)u)[i] = us;
+            ((uint8_t *)v)[i] = vs;
+        }
+    }
+}
+
+/* the pixels a vector loop didn't get to */
+static void row_tail(yuv_row_fn fn, const struct yuv_coeffs *c,
+        const void *src, void *y, void *u, void *v, int32_t start,
+        int32_t width)
+{
+    size_t bps = c->depth > 8 ? 2 : 1;
+    fn(c, (const uint32_t *)src + start, (char *)y + start * bps,
+            (char *)u + start * bps, (char *)v + start * bps, width - start);
+}
+
+#ifdef HAVE_X86
+
+static inline __m128i sse2_coeffs(const int16_t k[3])
+{
+    /* pixels are B, G, R, X as 16-bit lanes */
+    return _mm_set_epi16(0, k[2], k[1], k[0], 0, k[2], k[1], k[0]);
+}
+
+/* one plane of 4 pixels, lo and hi are the pixels widened to 16 bits */
+static inline __m128i sse2_plane4(__m128i lo, __m128i hi, __m128i k,
+        __m128i offset)
+{
+    __m128 a = _mm_castsi128_ps(_mm_madd_epi16(lo, k));
+    __m128 b = _mm_castsi128_ps(_mm_madd_epi16(hi, k));
+    __m128i bg = _mm_castps_si128(_mm_shuffle_ps(a, b,
+                _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i r = _mm_castps_si128(_mm_shuffle_ps(a, b,
+                _MM_SHUFFLE(3, 1, 3, 1)));
+    __m128i sum = _mm_add_epi32(_mm_add_epi32(bg, r), offset);
+    return _mm_srai_epi32(sum, YUV_COEFF_BITS);
+}
+
+static inline void sse2_store8(__m128i w, void *dst, int32_t i, int depth)
+{
+    if (depth > 8)
+        _mm_storeu_si128((__m128i *)((uint16_t *)dst + i), w);
+    else
+        _mm_storel_epi64((__m128i *)((uint8_t *)dst + i),
+                _mm_packus_epi16(w, w));
+}
+
+static void yuv_row_sse2(const struct yuv_coeffs *c, const void *src,
+        void *y, void *u, void *v, int32_t width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ky = sse2_coeffs(c->y), ku = sse2_coeffs(c->u),
+          kv = sse2_coeffs(c->v);
+    const __m128i y_offset = _mm_set1_epi32(c->y_offset),
+          c_offset = _mm_set1_epi32(c->c_offset);
+    const char *s = src;
+    int32_t i = 0;
+
+    for (; i + 8 <= width; i += 8) {
+        __m128i p0 = _mm_loadu_si128((const __m128i *)(s + i * 4));
+        __m128i p1 = _mm_loadu_si128((const __m128i *)(s + i * 4 + 16));
+        __m128i lo0 = _mm_unpacklo_epi8(p0, zero);
+        __m128i hi0 = _mm_unpackhi_epi8(p0, zero);
+        __m128i lo1 = _mm_unpacklo_epi8(p1, zero);
+        __m128i hi1 = _mm_unpackhi_epi8(p1, zero);
+
+        sse2_store8(_mm_packs_epi32(sse2_plane4(lo0, hi0, ky, y_offset),
+                    sse2_plane4(lo1, hi1, ky, y_offset)), y, i, c->depth);
+        sse2_store8(_mm_packs_epi32(sse2_plane4(lo0, hi0, ku, c_offset),
+                    sse2_plane4(lo1, hi1, ku, c_offset)), u, i, c->depth);
+        sse2_store8(_mm_packs_epi32(sse2_plane4(lo0, hi0, kv, c_offset),
+                    sse2_plane4(lo1, hi1, kv, c_offset)), v, i, c->depth);
+    }
+
+    if (i < width)
+        row_tail(yuv_row_scalar, c, src, y, u, v, i, width);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_plane8(__m256i lo, __m256i hi, __m256i k,
+        __m256i offset)
+{
+    /* the same as sse2_plane4 in each 128-bit lane, which keeps the pixels
+     * in order */
+    __m256 a = _mm256_castsi256_ps(_mm256_madd_epi16(lo, k));
+    __m256 b = _mm256_castsi256_ps(_mm256_madd_epi16(hi, k));
+    __m256i bg = _mm256_castps_si256(_mm256_shuffle_ps(a, b,
+                _MM_SHUFFLE(2, 0, 2, 0)));
+    __m256i r = _mm256_castps_si256(_mm256_shuffle_ps(a, b,
+                _MM_SHUFFLE(3, 1, 3, 1)));
+    __m256i sum = _mm256_add_epi32(_mm256_add_epi32(bg, r), offset);
+    return _mm256_srai_epi32(sum, YUV_COEFF_BITS);
+}
+
+__attribute__((target("avx2")))
+static inline void avx2_store16(__m256i a, __m256i b, void *dst, int32_t i,
+        int depth)
+{
+    /* packing works within lanes, the permutes put the pixels back in
+     * order */
+    __m256i w = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b),
+            _MM_SHUFFLE(3, 1, 2, 0));
+    if (depth > 8) {
+        _mm256_storeu_si256((__m256i *)((uint16_t *)dst + i), w);
+    } else {
+        __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(w, w),
+                _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i *)((uint8_t *)dst + i),
+                _mm256_castsi256_si128(bytes));
+    }
+}
+
+__attribute__((target("avx2")))
+static void yuv_row_avx2(const struct yuv_coeffs *c, const void *src,
+        void *y, void *u, void *v, int32_t width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ky = _mm256_broadcastsi128_si256(sse2_coeffs(c->y)),
+          ku = _mm256_broadcastsi128_si256(sse2_coeffs(c->u)),
+          kv = _mm256_broadcastsi128_si256(sse2_coeffs(c->v));
+    const __m256i y_offset = _mm256_set1_epi32(c->y_offset),
+          c_offset = _mm256_set1_epi32(c->c_offset);
+    const char *s = src;
+    int32_t i = 0;
+
+    for (; i + 16 <= width; i += 16) {
+        __m256i p0 = _mm256_loadu_si256((const __m256i *)(s + i * 4));
+        __m256i p1 = _mm256_loadu_si256((const __m256i *)(s + i * 4 + 32));
+        __m256i lo0 = _mm256_unpacklo_epi8(p0, zero);
+        __m256i hi0 = _mm256_unpackhi_epi8(p0, zero);
+        __m256i lo1 = _mm256_unpacklo_epi8(p1, zero);
+        __m256i hi1 = _mm256_unpackhi_epi8(p1, zero);
+
+        avx2_store16(avx2_plane8(lo0, hi0, ky, y_offset),
+                avx2_plane8(lo1, hi1, ky, y_offset), y, i, c->depth);
+        avx2_store16(avx2_plane8(lo0, hi0, ku, c_offset),
+                avx2_plane8(lo1, hi1, ku, c_offset), u, i, c->depth);
+        avx2_store16(avx2_plane8(lo0, hi0, kv, c_offset),
+                avx2_plane8(lo1, hi1, kv, c_offset), v, i, c->depth);
+    }
+
+    if (i < width)
+        row_tail(yuv_row_sse2, c, src, y, u, v, i, width);
+}
+
+#endif
+
+yuv_row_fn yuv_row_get(enum yuv_impl impl)
+{
+    switch (impl) {
+        case YUV_SCALAR:
+            return yuv_row_scalar;
+#ifdef HAVE_X86
+        case YUV_SSE2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2") ? yuv_row_sse2 : NULL;
+        case YUV_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? yuv_row_avx2 : NULL;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+yuv_row_fn yuv_row_best(void)
+{
+    for (int i = YUV_IMPL_COUNT - 1; i >= 0; i--) {
+        yuv_row_fn fn = yuv_row_get(i);
+        if (fn)
+            return fn;
+    }
+    return yuv_row_scalar;
+}
+
+const char *yuv_impl_name(enum yuv_impl impl)
+{
+    switch (impl) {
+        case YUV_SCALAR:
+            return "scalar";
+        case YUV_SSE2:
+            return "sse2";
+        case YUV_AVX2:
+            return "avx2";
+        default:
+            return "unknown";
+    }
+}
+
+void yuv_convert_rows(yuv_row_fn fn, const struct yuv_coeffs *c,
+        const void *src, size_t stride, void *dst, int32_t width,
+        int32_t height, int32_t y0, int32_t y1)
+{
+    size_t bps = c->depth > 8 ? 2 : 1;
+    size_t row_size = (size_t)width * bps;
+    size_t plane_size = row_size * height;
+
+    for (int32_t row = y0; row < y1; row++) {
+        char *y = (char *)dst + row * row_size;
+        fn(c, (const char *)src + row * stride, y, y + plane_size,
+                y + 2 * plane_size, width);
+    }
+}
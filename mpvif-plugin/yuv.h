@@ -0,0 +1,87 @@
+/*
+ * Copyright 2025 Attila Fidan
+ *
+ * This file is part of mpvif-plugin.
+ *
+ * mpvif-plugin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or (at
+ * your option) any later version.
+ *
+ * mpvif-plugin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpvif-plugin. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPVIF_YUV_H
+#define MPVIF_YUV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Conversion of XRGB8888 frames to planar YUV444 with 8 or 10 bits per
+ * sample, for shaders which only work on YUV.
+ *
+ * The frames are converted with the matrix and range mpv assumes for untagged
+ * YUV video of the same size (limited range, BT.709 for HD and BT.601
+ * otherwise), and the transfer function is left alone, so mpv shows the same
+ * picture as with --vf=format=fmt=yuv444p10:gamma=bt.1886:convert=yes.
+ *
+ * Every implementation computes the same result with 13-bit fixed point
+ * coefficients, which maps onto pmaddwd. The scalar version is the reference.
+ */
+
+enum yuv_impl {
+    YUV_SCALAR,
+    YUV_SSE2,
+    YUV_AVX2,
+    YUV_IMPL_COUNT,
+};
+
+enum yuv_matrix {
+    YUV_BT601,
+    YUV_BT709,
+};
+
+#define YUV_COEFF_BITS 13
+
+struct yuv_coeffs {
+    int depth;
+    /* multipliers of B, G and R for each plane */
+    int16_t y[3];
+    int16_t u[3];
+    int16_t v[3];
+    /* plane offsets, including rounding */
+    int32_t y_offset;
+    int32_t c_offset;
+};
+
+/* converts a row of width pixels, the planes have 1 byte per sample for a
+ * depth of 8 and 2 otherwise */
+typedef void (*yuv_row_fn)(const struct yuv_coeffs *c, const void *src,
+        void *y, void *u, void *v, int32_t width);
+
+void yuv_coeffs_init(struct yuv_coeffs *c, enum yuv_matrix matrix, int depth);
+/* the matrix mpv picks for YUV video without colorspace information */
+enum yuv_matrix yuv_guess_matrix(int32_t width, int32_t height);
+/* size of a frame with three tightly packed planes */
+size_t yuv_frame_size(int32_t width, int32_t height, int depth);
+
+/* NULL if the implementation isn't built in or the CPU doesn't support it */
+yuv_row_fn yuv_row_get(enum yuv_impl impl);
+/* the fastest supported implementation */
+yuv_row_fn yuv_row_best(void);
+const char *yuv_impl_name(enum yuv_impl impl);
+
+/* converts rows [y0, y1) of a width x height frame into a frame laid out as
+ * described by yuv_frame_size */
+void yuv_convert_rows(yuv_row_fn fn, const struct yuv_coeffs *c,
+        const void *src, size_t stride, void *dst, int32_t width,
+        int32_t height, int32_t y0, int32_t y1);
+
+#endif